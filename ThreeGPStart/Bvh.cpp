@@ -0,0 +1,382 @@
+#include "Bvh.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+namespace Helpers
+{
+	// Candidate split positions per axis and the most items a leaf is made with if splitting does not pay
+	static const int KNumBins = 12;
+	static const GLuint KMaxLeafItems = 4;
+
+	// Parent of the root
+	static const GLuint KNoParent = 0xFFFFFFFF;
+
+	static float SurfaceArea(const BoundingBox& box)
+	{
+		if (box.IsEmpty())
+			return 0;
+
+		glm::vec3 size{ box.max - box.min };
+		return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+	}
+
+	// Top down, each node is split where the surface area heuristic says the two halves will be cheapest to visit
+	void Bvh::BuildNodes(const std::vector<BoundingBox>& items, std::vector<Node>& nodes, std::vector<GLuint>& itemOrder)
+	{
+		nodes.clear();
+		itemOrder.resize(items.size());
+		for (GLuint i = 0; i < (GLuint)items.size(); i++)
+			itemOrder[i] = i;
+
+		if (items.empty())
+			return;
+
+		std::vector<glm::vec3> centres(items.size());
+		for (size_t i = 0; i < items.size(); i++)
+			centres[i] = items[i].Centre();
+
+		nodes.reserve(items.size() * 2);
+		Node root;
+		root.first = 0;
+		root.count = (GLuint)items.size();
+		nodes.push_back(root);
+
+		std::vector<GLuint> toSplit{ 0 };
+		while (!toSplit.empty())
+		{
+			GLuint nodeIndex{ toSplit.back() };
+			toSplit.pop_back();
+
+			const GLuint first{ nodes[nodeIndex].first };
+			const GLuint count{ nodes[nodeIndex].count };
+
+			BoundingBox bounds, centreBounds;
+			for (GLuint i = first; i < first + count; i++)
+			{
+				bounds.Include(items[itemOrder[i]]);
+				centreBounds.Include(centres[itemOrder[i]]);
+			}
+			nodes[nodeIndex].bounds = bounds;
+
+			if (count <= 1)
+				continue;
+
+			// Try every bin boundary on every axis
+			float bestCost{ FLT_MAX };
+			int bestAxis{ -1 };
+			int bestSplit{ 0 };
+			for (int axis = 0; axis < 3; axis++)
+			{
+				float axisMin{ centreBounds.min[axis] };
+				float axisExtent{ centreBounds.max[axis] - axisMin };
+				if (axisExtent <= 0)
+					continue;
+
+				BoundingBox binBounds[KNumBins];
+				GLuint binCounts[KNumBins]{};
+				for (GLuint i = first; i < first + count; i++)
+				{
+					int bin{ std::min((int)((centres[itemOrder[i]][axis] - axisMin) / axisExtent * KNumBins), KNumBins - 1) };
+					binBounds[bin].Include(items[itemOrder[i]]);
+					binCounts[bin]++;
+				}
+
+				// Sweep from the right to get the cost of everything above each boundary
+				float rightAreas[KNumBins];
+				GLuint rightCounts[KNumBins];
+				BoundingBox right;
+				GLuint rightCount{ 0 };
+				for (int bin = KNumBins - 1; bin > 0; bin--)
+				{
+					right.Include(binBounds[bin]);
+					rightCount += binCounts[bin];
+					rightAreas[bin] = SurfaceArea(right);
+					rightCounts[bin] = rightCount;
+				}
+
+				BoundingBox left;
+				GLuint leftCount{ 0 };
+				for (int split = 1; split < KNumBins; split++)
+				{
+					left.Include(binBounds[split - 1]);
+					leftCount += binCounts[split - 1];
+					if (leftCount == 0 || rightCounts[split] == 0)
+						continue;
+
+					float cost{ leftCount * SurfaceArea(left) + rightCounts[split] * rightAreas[split] };
+					if (cost < bestCost)
+					{
+						bestCost = cost;
+						bestAxis = axis;
+						bestSplit = split;
+					}
+				}
+			}
+
+			// Small nodes stay leaves unless splitting is cheaper than testing every item
+			float leafCost{ count * SurfaceArea(bounds) };
+			if (bestAxis < 0 || (count <= KMaxLeafItems && bestCost >= leafCost))
+				continue;
+
+			float axisMin{ centreBounds.min[bestAxis] };
+			float axisExtent{ centreBounds.max[bestAxis] - axisMin };
+			auto middle = std::partition(itemOrder.begin() + first, itemOrder.begin() + first + count, [&](GLuint item)
+			{
+				return std::min((int)((centres[item][bestAxis] - axisMin) / axisExtent * KNumBins), KNumBins - 1) < bestSplit;
+			});
+			GLuint leftCount{ (GLuint)(middle - (itemOrder.begin() + first)) };
+
+			Node leftChild, rightChild;
+			leftChild.first = first;
+			leftChild.count = leftCount;
+			rightChild.first = first + leftCount;
+			rightChild.count = count - leftCount;
+
+			GLuint children{ (GLuint)nodes.size() };
+			nodes.push_back(leftChild);
+			nodes.push_back(rightChild);
+
+			nodes[nodeIndex].first = children;
+			nodes[nodeIndex].count = 0;
+
+			toSplit.push_back(children);
+			toSplit.push_back(children + 1);
+		}
+	}
+
+	// Fills in m_parents and m_itemLeaf for the current nodes
+	void Bvh::LinkNodes()
+	{
+		m_parents.assign(m_nodes.size(), KNoParent);
+		m_itemLeaf.assign(m_items.size(), 0);
+
+		for (GLuint i = 0; i < (GLuint)m_nodes.size(); i++)
+		{
+			const Node& node{ m_nodes[i] };
+			if (node.IsLeaf())
+			{
+				for (GLuint j = node.first; j < node.first + node.count; j++)
+					m_itemLeaf[m_itemOrder[j]] = i;
+			}
+			else
+			{
+				m_parents[node.first] = i;
+				m_parents[node.first + 1] = i;
+			}
+		}
+	}
+
+	// Replaces the tree with one over these boxes, item i is box i
+	void Bvh::Build(const std::vector<BoundingBox>& items)
+	{
+		// Anything building in the background is for the old items
+		m_pendingBuild.reset();
+
+		m_items = items;
+		BuildNodes(m_items, m_nodes, m_itemOrder);
+		LinkNodes();
+		m_refitsSinceBuild = 0;
+	}
+
+	void Bvh::RefitLeaf(Node& leaf)
+	{
+		leaf.bounds = BoundingBox();
+		for (GLuint i = leaf.first; i < leaf.first + leaf.count; i++)
+			leaf.bounds.Include(m_items[m_itemOrder[i]]);
+	}
+
+	// Moves one item's box, its leaf and every node above it are grown or shrunk to fit
+	void Bvh::RefitItem(GLuint item, const BoundingBox& bounds)
+	{
+		m_items[item] = bounds;
+		m_refitsSinceBuild++;
+
+		GLuint nodeIndex{ m_itemLeaf[item] };
+		RefitLeaf(m_nodes[nodeIndex]);
+
+		for (GLuint parent = m_parents[nodeIndex]; parent != KNoParent; parent = m_parents[parent])
+		{
+			Node& node{ m_nodes[parent] };
+			node.bounds = m_nodes[node.first].bounds;
+			node.bounds.Include(m_nodes[node.first + 1].bounds);
+		}
+	}
+
+	// Starts a background rebuild once enough refits have loosened the tree and swaps in a finished one
+	void Bvh::UpdateRebuild()
+	{
+		if (m_pendingBuild)
+		{
+			if (!m_pendingBuild->finished.load(std::memory_order_acquire))
+				return;
+
+			m_nodes.swap(m_pendingBuild->nodes);
+			m_itemOrder.swap(m_pendingBuild->itemOrder);
+			m_pendingBuild.reset();
+			LinkNodes();
+
+			// Items may have moved since the copy was taken, children come after their parents so one backwards pass fixes every box
+			for (size_t i = m_nodes.size(); i-- > 0;)
+			{
+				Node& node{ m_nodes[i] };
+				if (node.IsLeaf())
+				{
+					RefitLeaf(node);
+				}
+				else
+				{
+					node.bounds = m_nodes[node.first].bounds;
+					node.bounds.Include(m_nodes[node.first + 1].bounds);
+				}
+			}
+			return;
+		}
+
+		// Rebuild once a good share of the items have moved
+		if (m_refitsSinceBuild < std::max<size_t>(64, m_items.size() / 4))
+			return;
+
+		m_refitsSinceBuild = 0;
+
+		// The job owns everything it touches, so it is safe even if this tree is destroyed or rebuilt first
+		std::shared_ptr<PendingBuild> build{ std::make_shared<PendingBuild>() };
+		build->items = m_items;
+		m_pendingBuild = build;
+
+		ThreadPool::Get().Submit([build]()
+		{
+			BuildNodes(build->items, build->nodes, build->itemOrder);
+			build->finished.store(true, std::memory_order_release);
+		});
+	}
+
+	// Appends every item whose box is at least partly inside the frustum
+	// Once a node is wholly inside, everything below it is taken without testing
+	void Bvh::QueryFrustum(const Frustum& frustum, std::vector<GLuint>& items) const
+	{
+		if (m_nodes.empty())
+			return;
+
+		std::vector<std::pair<GLuint, bool>> stack{ { 0, false } };
+		while (!stack.empty())
+		{
+			GLuint nodeIndex{ stack.back().first };
+			bool inside{ stack.back().second };
+			stack.pop_back();
+
+			const Node& node{ m_nodes[nodeIndex] };
+			if (!inside)
+			{
+				Containment containment{ frustum.Classify(node.bounds) };
+				if (containment == Containment::Outside)
+					continue;
+				inside = containment == Containment::Inside;
+			}
+
+			if (node.IsLeaf())
+			{
+				for (GLuint i = node.first; i < node.first + node.count; i++)
+				{
+					GLuint item{ m_itemOrder[i] };
+					if (inside || frustum.IsBoxVisible(m_items[item]))
+						items.push_back(item);
+				}
+			}
+			else
+			{
+				stack.push_back({ node.first, inside });
+				stack.push_back({ node.first + 1, inside });
+			}
+		}
+	}
+
+	// Appends every item whose box is within radius of centre
+	void Bvh::QueryRadius(const glm::vec3& centre, float radius, std::vector<GLuint>& items) const
+	{
+		if (m_nodes.empty())
+			return;
+
+		const float radiusSquared{ radius * radius };
+		auto overlaps = [&](const BoundingBox& box)
+		{
+			if (box.IsEmpty())
+				return false;
+			glm::vec3 closest{ glm::clamp(centre, box.min, box.max) };
+			glm::vec3 offset{ closest - centre };
+			return glm::dot(offset, offset) <= radiusSquared;
+		};
+
+		std::vector<GLuint> stack{ 0 };
+		while (!stack.empty())
+		{
+			const Node& node{ m_nodes[stack.back()] };
+			stack.pop_back();
+
+			if (!overlaps(node.bounds))
+				continue;
+
+			if (node.IsLeaf())
+			{
+				for (GLuint i = node.first; i < node.first + node.count; i++)
+				{
+					if (overlaps(m_items[m_itemOrder[i]]))
+						items.push_back(m_itemOrder[i]);
+				}
+			}
+			else
+			{
+				stack.push_back(node.first);
+				stack.push_back(node.first + 1);
+			}
+		}
+	}
+
+	// Appends every item whose box the ray passes through within maxDistance
+	void Bvh::QueryRay(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, std::vector<GLuint>& items) const
+	{
+		if (m_nodes.empty() || glm::length(direction) == 0)
+			return;
+
+		const glm::vec3 unitDirection{ glm::normalize(direction) };
+		const glm::vec3 inverseDirection{ 1.0f / unitDirection };
+
+		// Slab test, infinities from axis aligned rays fall out of the min and max correctly
+		auto hits = [&](const BoundingBox& box)
+		{
+			if (box.IsEmpty())
+				return false;
+			glm::vec3 t0{ (box.min - origin) * inverseDirection };
+			glm::vec3 t1{ (box.max - origin) * inverseDirection };
+			glm::vec3 tNear{ glm::min(t0, t1) };
+			glm::vec3 tFar{ glm::max(t0, t1) };
+			float enter{ std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f)) };
+			float exit{ std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxDistance)) };
+			return enter <= exit;
+		};
+
+		std::vector<GLuint> stack{ 0 };
+		while (!stack.empty())
+		{
+			const Node& node{ m_nodes[stack.back()] };
+			stack.pop_back();
+
+			if (!hits(node.bounds))
+				continue;
+
+			if (node.IsLeaf())
+			{
+				for (GLuint i = node.first; i < node.first + node.count; i++)
+				{
+					if (hits(m_items[m_itemOrder[i]]))
+						items.push_back(m_itemOrder[i]);
+				}
+			}
+			else
+			{
+				stack.push_back(node.first);
+				stack.push_back(node.first + 1);
+			}
+		}
+	}
+}
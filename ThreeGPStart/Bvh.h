@@ -0,0 +1,78 @@
+#pragma once
+
+#include "ExternalLibraryHeaders.h"
+#include "Frustum.h"
+
+#include <atomic>
+#include <memory>
+
+namespace Helpers
+{
+	// Bounding volume hierarchy over a set of boxes, e.g. one per scene object, so culling and spatial
+	// queries only visit the parts of the world near what they are looking for.
+	// Built top down with a binned surface area heuristic. Moving an item refits the boxes on the path
+	// from its leaf to the root, which is cheap but slowly loosens the tree, so after enough refits
+	// a fresh tree is built on the thread pool and swapped in when it is done.
+	class Bvh
+	{
+	private:
+		// Leaves have items [first, first + count) of m_itemOrder, other nodes have two children at first and first + 1
+		struct Node
+		{
+			BoundingBox bounds;
+			GLuint first{ 0 };
+			GLuint count{ 0 };
+
+			bool IsLeaf() const { return count > 0; }
+		};
+
+		// A tree being built in the background, the worker only ever touches this
+		struct PendingBuild
+		{
+			std::vector<BoundingBox> items;
+			std::vector<Node> nodes;
+			std::vector<GLuint> itemOrder;
+			std::atomic<bool> finished{ false };
+		};
+
+		std::vector<Node> m_nodes;
+		std::vector<GLuint> m_itemOrder;
+		std::vector<BoundingBox> m_items;
+
+		// For refitting, the parent of each node and the leaf holding each item
+		std::vector<GLuint> m_parents;
+		std::vector<GLuint> m_itemLeaf;
+
+		size_t m_refitsSinceBuild{ 0 };
+		std::shared_ptr<PendingBuild> m_pendingBuild;
+
+		static void BuildNodes(const std::vector<BoundingBox>& items, std::vector<Node>& nodes, std::vector<GLuint>& itemOrder);
+
+		// Fills in m_parents and m_itemLeaf for the current nodes
+		void LinkNodes();
+
+		void RefitLeaf(Node& leaf);
+	public:
+		// Replaces the tree with one over these boxes, item i is box i
+		void Build(const std::vector<BoundingBox>& items);
+
+		size_t NumItems() const { return m_items.size(); }
+		const BoundingBox& GetItemBounds(GLuint item) const { return m_items[item]; }
+
+		// Moves one item's box, its leaf and every node above it are grown or shrunk to fit
+		void RefitItem(GLuint item, const BoundingBox& bounds);
+
+		// Call once a frame. Starts a background rebuild once enough refits have loosened the tree
+		// and swaps in a finished one, refitting it to any moves made while it was being built.
+		void UpdateRebuild();
+
+		// Appends every item whose box is at least partly inside the frustum
+		void QueryFrustum(const Frustum& frustum, std::vector<GLuint>& items) const;
+
+		// Appends every item whose box is within radius of centre
+		void QueryRadius(const glm::vec3& centre, float radius, std::vector<GLuint>& items) const;
+
+		// Appends every item whose box the ray passes through within maxDistance, direction need not be normalised
+		void QueryRay(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, std::vector<GLuint>& items) const;
+	};
+}
@@ -37,6 +37,22 @@ namespace Helpers
 			m_rotations.x = -KMaxVerticalAngle;
 	}
 
+	// Places this part way from one camera to another, turns take the shorter way round
+	void Camera::Interpolate(const Camera& from, const Camera& to, float t)
+	{
+		*this = to;
+
+		// Yaw wraps at 360 degrees, so go the short way across the wrap rather than all the way back round
+		glm::vec3 rotationChange{ to.m_rotations - from.m_rotations };
+		if (rotationChange.y > glm::pi<float>())
+			rotationChange.y -= glm::two_pi<float>();
+		else if (rotationChange.y < -glm::pi<float>())
+			rotationChange.y += glm::two_pi<float>();
+
+		m_position = glm::mix(from.m_position, to.m_position, t);
+		SetRotations(from.m_rotations + rotationChange * t);
+	}
+
 	// The look vector can be calulcated from the inverse of the rotation matrix, third column
 	glm::vec3 Camera::GetLookVector() const
 	{
@@ -41,7 +41,10 @@ namespace Helpers
 		void SetPosition(const glm::vec3& newPos) { m_position = newPos; }
 
 		// Set world rotations
-		void SetRotations(const glm::vec3& newRots) { m_rotations = newRots; ClampRotations(); }
+		void SetRotations(const glm::vec3& newRots) { m_rotations = newRots; ClampRotations(); m_rotationMatrix = CalcRotationMatrix(); }
+
+		// Places this part way from one camera to another, t of 0 is from and 1 is to. Turns take the shorter way round.
+		void Interpolate(const Camera& from, const Camera& to, float t);
 
 		// The camera needs updating to handle user input
 		void Update(GLFWwindow* window, float timePassedSecs);
@@ -0,0 +1,21 @@
+#version 330
+
+// Shared by every program, written once a frame
+layout(std140) uniform PerFrame
+{
+	mat4 combined_xform;
+	vec4 camera_position;
+};
+
+layout(location = 0) in vec3 vertex_position;
+
+// Per instance, read from an instance buffer or set as a constant attribute for single draws
+layout(location = 3) in mat4 model_xform;
+
+// Must match vertex_shader.glsl exactly so the colour pass passes its GL_EQUAL depth test
+invariant gl_Position;
+
+void main(void)
+{
+	gl_Position = combined_xform * model_xform * vec4(vertex_position, 1.0);
+}
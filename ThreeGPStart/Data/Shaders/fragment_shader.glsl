@@ -2,32 +2,69 @@
 
 uniform sampler2D sampler_tex;
 
+// Per material values, the range for the material being drawn is bound before each draw
+layout(std140) uniform Material
+{
+	vec4 diffuse_colour;
+};
+
+// Clustered point lights, written once a frame by LightGrid
+layout(std140) uniform Lights
+{
+	mat4 view_xform;
+	vec4 ambient_colour;
+	vec4 cluster_scale;
+	uvec4 cluster_counts;
+};
+
+// Two texels a light, position and radius then colour
+uniform samplerBuffer light_tex;
+
+// Offset into light_index_tex and count for each cluster
+uniform usamplerBuffer cluster_tex;
+uniform usamplerBuffer light_index_tex;
+
 in vec2 varying_coord;
 in vec3 varying_normals;
 in vec3 varying_position;
+in vec4 varying_tint;
 
 out vec4 fragment_colour;
 
-void main(void)
+// Sum of the lights reaching P, only those listed for its cluster are looked at
+vec3 ClusterLighting(vec3 P, vec3 N)
 {
-	vec3 light_position = vec3(0, 400, 0);
+	float depth = max(-(view_xform * vec4(P, 1.0)).z, 1e-4);
+	uvec3 cluster = uvec3(uvec2(gl_FragCoord.xy * cluster_scale.xy), uint(max(log(depth) * cluster_scale.z + cluster_scale.w, 0.0)));
+	cluster = min(cluster, cluster_counts.xyz - 1u);
 
-	//render with texture
-	vec3 tex_colour = texture(sampler_tex, varying_coord).rgb;
+	uvec2 range = texelFetch(cluster_tex, int(cluster.x + cluster_counts.x * (cluster.y + cluster_counts.y * cluster.z))).xy;
 
-	vec3 P = varying_position;
+	vec3 total = vec3(0);
+	for (uint i = 0u; i < range.y; i++)
+	{
+		int light = int(texelFetch(light_index_tex, int(range.x + i)).r);
+		vec4 position_radius = texelFetch(light_tex, light * 2);
+		vec3 colour = texelFetch(light_tex, light * 2 + 1).rgb;
 
-	vec3 light_direction = P - light_position;
+		// Fades smoothly to nothing at the radius
+		vec3 to_light = position_radius.xyz - P;
+		float distance_squared = dot(to_light, to_light);
+		float falloff = max(1.0 - distance_squared / (position_radius.w * position_radius.w), 0.0);
+		float diffuse_intensity = max(dot(N, to_light * inversesqrt(max(distance_squared, 1e-4))), 0.0);
 
-	vec3 L = normalize(-light_direction);
-	vec3 N = normalize(varying_normals);
-
-	float diffuse_intensity = max(0, dot(L,N));
+		total += colour * falloff * falloff * diffuse_intensity;
+	}
+	return total;
+}
 
-	vec3 light_colour = vec3(1,0.2,0.2);
-
-	vec3 final_colour = tex_colour + diffuse_intensity + light_colour;
+void main(void)
+{
+	//render with texture
+	vec3 tex_colour = texture(sampler_tex, varying_coord).rgb * diffuse_colour.rgb * varying_tint.rgb;
 
-	fragment_colour = vec4(tex_colour, 1.0);
+	vec3 N = normalize(varying_normals);
+	vec3 final_colour = tex_colour * (ambient_colour.rgb + ClusterLighting(varying_position, N));
 
-}
\ No newline at end of file
+	fragment_colour = vec4(final_colour, 1.0);
+}
@@ -0,0 +1,12 @@
+#version 330
+
+uniform samplerCube sky_tex;
+
+in vec3 varying_direction;
+
+out vec4 fragment_colour;
+
+void main(void)
+{
+	fragment_colour = vec4(texture(sky_tex, varying_direction).rgb, 1.0);
+}
@@ -0,0 +1,26 @@
+#version 330
+
+// Shared by every program, written once a frame
+layout(std140) uniform PerFrame
+{
+	mat4 combined_xform;
+	vec4 camera_position;
+};
+
+// Takes clip space back to world space, set once a frame
+uniform mat4 inverse_combined_xform;
+
+out vec3 varying_direction;
+
+void main(void)
+{
+	// One triangle covering the screen, corners at (-1,-1), (3,-1) and (-1,3)
+	vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2) * 2.0 - 1.0;
+
+	// The point on the far plane behind this corner, the sky is looked up in the direction from the camera to it
+	vec4 far_point = inverse_combined_xform * vec4(corner, 1.0, 1.0);
+	varying_direction = far_point.xyz / far_point.w - camera_position.xyz;
+
+	// z equal to w puts it exactly at depth 1.0
+	gl_Position = vec4(corner, 1.0, 1.0);
+}
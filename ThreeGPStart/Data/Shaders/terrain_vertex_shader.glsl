@@ -0,0 +1,55 @@
+#version 330
+
+// Shared by every program, written once a frame
+layout(std140) uniform PerFrame
+{
+	mat4 combined_xform;
+	vec4 camera_position;
+};
+
+uniform mat4 model_xform;
+
+// Terrain heights, one texel per grid vertex
+uniform sampler2D height_tex;
+
+// Layout of the whole terrain grid
+uniform vec3 terrain_origin;
+uniform float cell_size;
+uniform ivec2 num_cells;
+
+// Where this chunk starts in the grid and how many vertices are in each of its rows
+uniform ivec2 chunk_first_vert;
+uniform int chunk_verts_x;
+
+//render with texture
+out vec2 varying_coord;
+out vec3 varying_normals;
+out vec3 varying_position;
+
+float height_at(ivec2 grid_vert)
+{
+	return texelFetch(height_tex, clamp(grid_vert, ivec2(0), num_cells), 0).r;
+}
+
+void main(void)
+{
+	// The shared index buffer holds chunk local vertex numbers, turn these back into a grid vertex
+	ivec2 grid_vert = chunk_first_vert + ivec2(gl_VertexID % chunk_verts_x, gl_VertexID / chunk_verts_x);
+
+	// Grid z runs along world -z
+	vec3 vertex_position = vec3(terrain_origin.x + grid_vert.x * cell_size,
+		height_at(grid_vert),
+		terrain_origin.z - grid_vert.y * cell_size);
+
+	// Normal from the slope between the neighbouring vertices
+	float dhdx = (height_at(grid_vert + ivec2(1, 0)) - height_at(grid_vert - ivec2(1, 0))) / (2.0 * cell_size);
+	float dhdz = -(height_at(grid_vert + ivec2(0, 1)) - height_at(grid_vert - ivec2(0, 1))) / (2.0 * cell_size);
+	vec3 vertex_normal = normalize(vec3(-dhdx, 1.0, -dhdz));
+
+	varying_coord = vec2(grid_vert) / vec2(num_cells);
+	varying_normals = mat3(model_xform) * vertex_normal;
+
+	varying_position = mat4x3(model_xform) * vec4(vertex_position, 1.0);
+
+	gl_Position = combined_xform * model_xform * vec4(vertex_position, 1.0);
+}
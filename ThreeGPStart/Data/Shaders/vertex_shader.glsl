@@ -1,20 +1,33 @@
 #version 330
 
-uniform mat4 combined_xform;
-uniform mat4 model_xform;
+// Shared by every program, written once a frame
+layout(std140) uniform PerFrame
+{
+	mat4 combined_xform;
+	vec4 camera_position;
+};
 
 layout(location = 0) in vec3 vertex_position;
 layout(location = 1) in vec3 vertex_normal;
 layout(location = 2) in vec2 tex_coord;
 
+// Per instance, read from an instance buffer or set as a constant attribute for single draws
+layout(location = 3) in mat4 model_xform;
+layout(location = 7) in vec4 instance_tint;
+
 //render with texture
 out vec2 varying_coord;
 out vec3 varying_normals;
 out vec3 varying_position;
+out vec4 varying_tint;
+
+// Must match depth_vertex_shader.glsl exactly so the depth pre-pass leaves the same depths
+invariant gl_Position;
 
 void main(void)
 {
 	varying_coord = tex_coord;
+	varying_tint = instance_tint;
 	varying_normals = mat3(model_xform) * vertex_normal;
 
 	varying_position = mat4x3(model_xform) * vec4(vertex_position, 1.0);
@@ -0,0 +1,189 @@
+#include "Frustum.h"
+
+#ifdef HELPERS_FRUSTUM_SSE
+#include <xmmintrin.h>
+#endif
+
+namespace Helpers
+{
+	// Box around this one once transformed, not as tight as transforming the contents
+	BoundingBox BoundingBox::Transformed(const glm::mat4& xform) const
+	{
+		if (IsEmpty())
+			return *this;
+
+		glm::vec3 centre{ xform * glm::vec4(Centre(), 1.0f) };
+
+		// Each world axis gets the extents projected onto it
+		glm::mat3 absolute{ xform };
+		for (int column = 0; column < 3; column++)
+			absolute[column] = glm::abs(absolute[column]);
+		glm::vec3 extents{ absolute * Extents() };
+
+		BoundingBox box;
+		box.min = centre - extents;
+		box.max = centre + extents;
+		return box;
+	}
+
+	// Pulls the planes out of a projection * view (* model) matrix
+	// Each plane is the last row of the matrix plus or minus one of the others
+	void Frustum::Extract(const glm::mat4& combinedXform)
+	{
+		glm::mat4 rows{ glm::transpose(combinedXform) };
+
+		m_planes[0] = rows[3] + rows[0]; // Left
+		m_planes[1] = rows[3] - rows[0]; // Right
+		m_planes[2] = rows[3] + rows[1]; // Bottom
+		m_planes[3] = rows[3] - rows[1]; // Top
+		m_planes[4] = rows[3] + rows[2]; // Near
+		m_planes[5] = rows[3] - rows[2]; // Far
+
+		// Normalised so distances are in world units
+		for (glm::vec4& plane : m_planes)
+			plane /= glm::length(glm::vec3(plane));
+	}
+
+	// False only if the box is wholly outside one of the planes
+	bool Frustum::IsBoxVisible(const BoundingBox& box) const
+	{
+		glm::vec3 centre{ box.Centre() };
+		glm::vec3 extents{ box.Extents() };
+
+		for (const glm::vec4& plane : m_planes)
+		{
+			glm::vec3 normal{ plane };
+			float distance{ glm::dot(normal, centre) + plane.w };
+			float radius{ glm::dot(glm::abs(normal), extents) };
+			if (distance + radius < 0)
+				return false;
+		}
+
+		return true;
+	}
+
+	// Also tells when the box is wholly inside, so anything within it needs no further tests
+	Containment Frustum::Classify(const BoundingBox& box) const
+	{
+		glm::vec3 centre{ box.Centre() };
+		glm::vec3 extents{ box.Extents() };
+
+		Containment result{ Containment::Inside };
+		for (const glm::vec4& plane : m_planes)
+		{
+			glm::vec3 normal{ plane };
+			float distance{ glm::dot(normal, centre) + plane.w };
+			float radius{ glm::dot(glm::abs(normal), extents) };
+			if (distance + radius < 0)
+				return Containment::Outside;
+			if (distance - radius < 0)
+				result = Containment::Intersects;
+		}
+
+		return result;
+	}
+
+	void BoundsSoA::Clear()
+	{
+		m_centreX.clear();
+		m_centreY.clear();
+		m_centreZ.clear();
+		m_extentX.clear();
+		m_extentY.clear();
+		m_extentZ.clear();
+		m_count = 0;
+	}
+
+	// Returns the box's index
+	size_t BoundsSoA::Add(const BoundingBox& box)
+	{
+		// Kept three floats longer than needed so four wide loads from any index stay in bounds
+		size_t index{ m_count++ };
+		size_t paddedSize{ m_count + 3 };
+		for (std::vector<float>* values : { &m_centreX, &m_centreY, &m_centreZ, &m_extentX, &m_extentY, &m_extentZ })
+			values->resize(paddedSize, 0.0f);
+
+		Set(index, box);
+		return index;
+	}
+
+	void BoundsSoA::Set(size_t index, const BoundingBox& box)
+	{
+		glm::vec3 centre{ box.Centre() };
+		glm::vec3 extents{ box.Extents() };
+
+		m_centreX[index] = centre.x;
+		m_centreY[index] = centre.y;
+		m_centreZ[index] = centre.z;
+		m_extentX[index] = extents.x;
+		m_extentY[index] = extents.y;
+		m_extentZ[index] = extents.z;
+	}
+
+	// Appends the indices in [first, first + count) of the boxes at least partly inside the frustum
+	void BoundsSoA::Cull(const Frustum& frustum, size_t first, size_t count, std::vector<GLuint>& visible) const
+	{
+		const size_t end{ first + count };
+
+#ifdef HELPERS_FRUSTUM_SSE
+		// Planes splatted across all four lanes once, along with their absolute normals
+		__m128 planeX[6], planeY[6], planeZ[6], planeW[6];
+		__m128 absX[6], absY[6], absZ[6];
+		for (int p = 0; p < 6; p++)
+		{
+			const glm::vec4& plane{ frustum.Plane(p) };
+			planeX[p] = _mm_set1_ps(plane.x);
+			planeY[p] = _mm_set1_ps(plane.y);
+			planeZ[p] = _mm_set1_ps(plane.z);
+			planeW[p] = _mm_set1_ps(plane.w);
+			absX[p] = _mm_set1_ps(std::abs(plane.x));
+			absY[p] = _mm_set1_ps(std::abs(plane.y));
+			absZ[p] = _mm_set1_ps(std::abs(plane.z));
+		}
+		const __m128 zero{ _mm_setzero_ps() };
+
+		for (size_t i = first; i < end; i += 4)
+		{
+			__m128 centreX{ _mm_loadu_ps(&m_centreX[i]) };
+			__m128 centreY{ _mm_loadu_ps(&m_centreY[i]) };
+			__m128 centreZ{ _mm_loadu_ps(&m_centreZ[i]) };
+			__m128 extentX{ _mm_loadu_ps(&m_extentX[i]) };
+			__m128 extentY{ _mm_loadu_ps(&m_extentY[i]) };
+			__m128 extentZ{ _mm_loadu_ps(&m_extentZ[i]) };
+
+			// A lane stays set while its box is not wholly outside any plane
+			__m128 inside{ _mm_cmpeq_ps(zero, zero) };
+			for (int p = 0; p < 6; p++)
+			{
+				__m128 distance{ _mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX[p], centreX), _mm_mul_ps(planeY[p], centreY)),
+					_mm_add_ps(_mm_mul_ps(planeZ[p], centreZ), planeW[p])) };
+				__m128 radius{ _mm_add_ps(_mm_add_ps(_mm_mul_ps(absX[p], extentX), _mm_mul_ps(absY[p], extentY)),
+					_mm_mul_ps(absZ[p], extentZ)) };
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, radius), zero));
+			}
+
+			int mask{ _mm_movemask_ps(inside) };
+			for (size_t lane = 0; mask != 0 && i + lane < end; lane++, mask >>= 1)
+			{
+				if (mask & 1)
+					visible.push_back((GLuint)(i + lane));
+			}
+		}
+#else
+		for (size_t i = first; i < end; i++)
+		{
+			bool inside{ true };
+			for (int p = 0; p < 6 && inside; p++)
+			{
+				const glm::vec4& plane{ frustum.Plane(p) };
+				float distance{ plane.x * m_centreX[i] + plane.y * m_centreY[i] + plane.z * m_centreZ[i] + plane.w };
+				float radius{ std::abs(plane.x) * m_extentX[i] + std::abs(plane.y) * m_extentY[i] + std::abs(plane.z) * m_extentZ[i] };
+				inside = distance + radius >= 0;
+			}
+
+			if (inside)
+				visible.push_back((GLuint)i);
+		}
+#endif
+	}
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "ExternalLibraryHeaders.h"
+
+#include <cfloat>
+
+// Boxes are tested four at a time with SSE where the compiler targets it
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define HELPERS_FRUSTUM_SSE 1
+#endif
+
+namespace Helpers
+{
+	// Axis aligned box, starts empty so any point or box included makes it valid
+	struct BoundingBox
+	{
+		glm::vec3 min{ FLT_MAX };
+		glm::vec3 max{ -FLT_MAX };
+
+		bool IsEmpty() const { return max.x < min.x; }
+		glm::vec3 Centre() const { return (min + max) * 0.5f; }
+		glm::vec3 Extents() const { return (max - min) * 0.5f; }
+
+		void Include(const glm::vec3& point)
+		{
+			min = glm::min(min, point);
+			max = glm::max(max, point);
+		}
+
+		void Include(const BoundingBox& other)
+		{
+			min = glm::min(min, other.min);
+			max = glm::max(max, other.max);
+		}
+
+		// Box around this one once transformed, not as tight as transforming the contents
+		BoundingBox Transformed(const glm::mat4& xform) const;
+	};
+
+	// How a box lies relative to a frustum
+	enum class Containment
+	{
+		Outside,
+		Intersects,
+		Inside
+	};
+
+	// The six planes of a view volume, each with its normal pointing inwards
+	class Frustum
+	{
+	private:
+		glm::vec4 m_planes[6];
+	public:
+		// Pulls the planes out of a projection * view (* model) matrix
+		void Extract(const glm::mat4& combinedXform);
+
+		const glm::vec4& Plane(int index) const { return m_planes[index]; }
+
+		// False only if the box is wholly outside one of the planes
+		bool IsBoxVisible(const BoundingBox& box) const;
+
+		// Also tells when the box is wholly inside, so anything within it needs no further tests
+		Containment Classify(const BoundingBox& box) const;
+	};
+
+	// Many boxes stored as separate arrays of centres and extents so they can be tested
+	// against the frustum a register's worth at a time
+	class BoundsSoA
+	{
+	private:
+		std::vector<float> m_centreX, m_centreY, m_centreZ;
+		std::vector<float> m_extentX, m_extentY, m_extentZ;
+		size_t m_count{ 0 };
+	public:
+		void Clear();
+
+		// Returns the box's index
+		size_t Add(const BoundingBox& box);
+		void Set(size_t index, const BoundingBox& box);
+
+		size_t Size() const { return m_count; }
+
+		// Appends the indices in [first, first + count) of the boxes at least partly inside the frustum
+		void Cull(const Frustum& frustum, size_t first, size_t count, std::vector<GLuint>& visible) const;
+		void Cull(const Frustum& frustum, std::vector<GLuint>& visible) const { Cull(frustum, 0, m_count, visible); }
+	};
+}
@@ -0,0 +1,200 @@
+#include "GeometryBuffer.h"
+
+namespace Helpers
+{
+	// Extends the range, the new space is free
+	void RangeAllocator::Grow(size_t newCapacity)
+	{
+		if (newCapacity <= m_capacity)
+			return;
+
+		size_t oldCapacity{ m_capacity };
+		m_capacity = newCapacity;
+		Free(oldCapacity, newCapacity - oldCapacity);
+	}
+
+	// Returns false if there is no free range big enough
+	bool RangeAllocator::Allocate(size_t size, size_t& offset)
+	{
+		for (auto it = m_free.begin(); it != m_free.end(); ++it)
+		{
+			if (it->second < size)
+				continue;
+
+			offset = it->first;
+			size_t remaining{ it->second - size };
+			m_free.erase(it);
+			if (remaining > 0)
+				m_free[offset + size] = remaining;
+			return true;
+		}
+
+		return false;
+	}
+
+	void RangeAllocator::Free(size_t offset, size_t size)
+	{
+		if (size == 0)
+			return;
+
+		auto next{ m_free.lower_bound(offset) };
+
+		// Merge with the free range after
+		if (next != m_free.end() && offset + size == next->first)
+		{
+			size += next->second;
+			next = m_free.erase(next);
+		}
+
+		// and the one before
+		if (next != m_free.begin())
+		{
+			auto previous{ std::prev(next) };
+			if (previous->first + previous->second == offset)
+			{
+				previous->second += size;
+				return;
+			}
+		}
+
+		m_free[offset] = size;
+	}
+
+	GeometryBufferBase::~GeometryBufferBase()
+	{
+		glDeleteVertexArrays(1, &m_VAO);
+		glDeleteBuffers(1, &m_VBO);
+		glDeleteBuffers(1, &m_EBO);
+	}
+
+	// Creates the buffers with room for the given number of vertices and indices to start with
+	void GeometryBufferBase::Initialise(size_t initialVertices, size_t initialIndices)
+	{
+		glGenBuffers(1, &m_VBO);
+		glBindBuffer(GL_ARRAY_BUFFER, m_VBO);
+		glBufferData(GL_ARRAY_BUFFER, m_vertexStride * initialVertices, nullptr, GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		// The element buffer binding belongs to the VAO so go through a target that does not
+		glGenBuffers(1, &m_EBO);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, m_EBO);
+		glBufferData(GL_COPY_WRITE_BUFFER, sizeof(GLuint) * initialIndices, nullptr, GL_STATIC_DRAW);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+		glGenVertexArrays(1, &m_VAO);
+		SetupVAO(m_VAO);
+		glBindVertexArray(0);
+
+		m_vertexRanges.Grow(initialVertices);
+		m_indexRanges.Grow(initialIndices);
+	}
+
+	// Points a VAO at the current buffers, leaving it bound
+	void GeometryBufferBase::SetupVAO(GLuint VAO) const
+	{
+		glBindVertexArray(VAO);
+
+		glBindBuffer(GL_ARRAY_BUFFER, m_VBO);
+		m_setupAttributes();
+
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_EBO);
+
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	// Replaces a buffer with a bigger one holding the same contents, the copy stays on the GPU
+	GLuint GeometryBufferBase::GrowBuffer(GLuint buffer, GLsizeiptr oldBytes, GLsizeiptr newBytes)
+	{
+		GLuint newBuffer;
+		glGenBuffers(1, &newBuffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, newBuffer);
+		glBufferData(GL_COPY_WRITE_BUFFER, newBytes, nullptr, GL_STATIC_DRAW);
+
+		if (oldBytes > 0)
+		{
+			glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, oldBytes);
+			glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		}
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+		glDeleteBuffers(1, &buffer);
+		return newBuffer;
+	}
+
+	// Reserves space for a mesh, the contents are undefined until written
+	GeometryAllocation GeometryBufferBase::Allocate(GLuint numVertices, GLuint numIndices)
+	{
+		GeometryAllocation allocation;
+		size_t firstVertex{ 0 };
+		size_t firstIndex{ 0 };
+
+		if (!m_vertexRanges.Allocate(numVertices, firstVertex))
+		{
+			size_t oldCapacity{ m_vertexRanges.Capacity() };
+			size_t newCapacity{ std::max(oldCapacity * 2, oldCapacity + numVertices) };
+			m_VBO = GrowBuffer(m_VBO, m_vertexStride * oldCapacity, m_vertexStride * newCapacity);
+			m_vertexRanges.Grow(newCapacity);
+			m_vertexRanges.Allocate(numVertices, firstVertex);
+			SetupVAO(m_VAO);
+			glBindVertexArray(0);
+			m_bufferGeneration++;
+		}
+
+		if (!m_indexRanges.Allocate(numIndices, firstIndex))
+		{
+			size_t oldCapacity{ m_indexRanges.Capacity() };
+			size_t newCapacity{ std::max(oldCapacity * 2, oldCapacity + numIndices) };
+			m_EBO = GrowBuffer(m_EBO, sizeof(GLuint) * oldCapacity, sizeof(GLuint) * newCapacity);
+			m_indexRanges.Grow(newCapacity);
+			m_indexRanges.Allocate(numIndices, firstIndex);
+			SetupVAO(m_VAO);
+			glBindVertexArray(0);
+			m_bufferGeneration++;
+		}
+
+		allocation.firstVertex = (GLuint)firstVertex;
+		allocation.numVertices = numVertices;
+		allocation.firstIndex = (GLuint)firstIndex;
+		allocation.numIndices = numIndices;
+		return allocation;
+	}
+
+	void GeometryBufferBase::Free(GeometryAllocation& allocation)
+	{
+		m_vertexRanges.Free(allocation.firstVertex, allocation.numVertices);
+		m_indexRanges.Free(allocation.firstIndex, allocation.numIndices);
+		allocation = GeometryAllocation();
+	}
+
+	// Maps part of an allocation for writing, the previous contents of the range are discarded
+	GLubyte* GeometryBufferBase::MapVertices(const GeometryAllocation& allocation, GLuint first, GLuint count)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, m_VBO);
+		return (GLubyte*)glMapBufferRange(GL_ARRAY_BUFFER, m_vertexStride * (allocation.firstVertex + first),
+			m_vertexStride * count, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+	}
+
+	GLuint* GeometryBufferBase::MapIndices(const GeometryAllocation& allocation)
+	{
+		// The element buffer binding belongs to the VAO so go through a target that does not
+		glBindBuffer(GL_COPY_WRITE_BUFFER, m_EBO);
+		return (GLuint*)glMapBufferRange(GL_COPY_WRITE_BUFFER, sizeof(GLuint) * allocation.firstIndex,
+			sizeof(GLuint) * allocation.numIndices, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+	}
+
+	// Returns false if the data was lost while mapped and must be written again
+	bool GeometryBufferBase::UnmapVertices()
+	{
+		bool unmapped{ glUnmapBuffer(GL_ARRAY_BUFFER) == GL_TRUE };
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		return unmapped;
+	}
+
+	bool GeometryBufferBase::UnmapIndices()
+	{
+		bool unmapped{ glUnmapBuffer(GL_COPY_WRITE_BUFFER) == GL_TRUE };
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		return unmapped;
+	}
+}
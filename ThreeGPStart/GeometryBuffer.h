@@ -0,0 +1,114 @@
+#pragma once
+
+#include "ExternalLibraryHeaders.h"
+#include "VertexFormat.h"
+
+namespace Helpers
+{
+	// Where a mesh lives in a GeometryBuffer, indices are relative to firstVertex
+	struct GeometryAllocation
+	{
+		GLuint firstVertex{ 0 };
+		GLuint numVertices{ 0 };
+		GLuint firstIndex{ 0 };
+		GLuint numIndices{ 0 };
+
+		bool IsValid() const { return numVertices > 0; }
+	};
+
+	// First fit free list over a range of elements, neighbouring free ranges are merged when released
+	class RangeAllocator
+	{
+	private:
+		// Free ranges keyed by their first element
+		std::map<size_t, size_t> m_free;
+		size_t m_capacity{ 0 };
+	public:
+		// Extends the range, the new space is free
+		void Grow(size_t newCapacity);
+
+		size_t Capacity() const { return m_capacity; }
+
+		// Returns false if there is no free range big enough
+		bool Allocate(size_t size, size_t& offset);
+		void Free(size_t offset, size_t size);
+	};
+
+	// One large vertex buffer and index buffer shared by many meshes, along with the single VAO describing them
+	// Meshes are drawn with a base vertex so they only need binding once for the lot.
+	// The buffers grow (copying on the GPU) when an allocation does not fit.
+	// Use GeometryBuffer<Format> below, this holds the parts that do not depend on the vertex format.
+	class GeometryBufferBase
+	{
+	private:
+		const size_t m_vertexStride;
+		void (*const m_setupAttributes)();
+
+		GLuint m_VAO{ 0 };
+		GLuint m_VBO{ 0 };
+		GLuint m_EBO{ 0 };
+
+		RangeAllocator m_vertexRanges;
+		RangeAllocator m_indexRanges;
+
+		// Bumped whenever growing replaces a buffer
+		unsigned int m_bufferGeneration{ 0 };
+
+		// Replaces a buffer with a bigger one holding the same contents
+		static GLuint GrowBuffer(GLuint buffer, GLsizeiptr oldBytes, GLsizeiptr newBytes);
+	protected:
+		GeometryBufferBase(size_t vertexStride, void (*setupAttributes)())
+			: m_vertexStride(vertexStride), m_setupAttributes(setupAttributes) {}
+	public:
+		~GeometryBufferBase();
+
+		GeometryBufferBase(const GeometryBufferBase&) = delete;
+		GeometryBufferBase& operator=(const GeometryBufferBase&) = delete;
+
+		// Creates the buffers with room for the given number of vertices and indices to start with
+		void Initialise(size_t initialVertices, size_t initialIndices);
+
+		// Reserves space for a mesh, the contents are undefined until written
+		GeometryAllocation Allocate(GLuint numVertices, GLuint numIndices);
+		void Free(GeometryAllocation& allocation);
+
+		// Maps part of an allocation for writing, the previous contents of the range are discarded
+		// Returns nullptr on failure. Fill with the format's Write and unmap before drawing.
+		GLubyte* MapVertices(const GeometryAllocation& allocation, GLuint first, GLuint count);
+		GLubyte* MapVertices(const GeometryAllocation& allocation) { return MapVertices(allocation, 0, allocation.numVertices); }
+		GLuint* MapIndices(const GeometryAllocation& allocation);
+
+		// Returns false if the data was lost while mapped and must be written again
+		bool UnmapVertices();
+		bool UnmapIndices();
+
+		// Bind once, then draw any number of allocations
+		void Bind() const { glBindVertexArray(m_VAO); }
+		GLuint GetVAO() const { return m_VAO; }
+
+		// Points another VAO at the vertex and element buffers, e.g. one that adds per instance attributes
+		// Leaves the VAO bound. Must be repeated when BufferGeneration changes.
+		void SetupVAO(GLuint VAO) const;
+		unsigned int BufferGeneration() const { return m_bufferGeneration; }
+		void Draw(const GeometryAllocation& allocation) const
+		{
+			glDrawElementsBaseVertex(GL_TRIANGLES, allocation.numIndices, GL_UNSIGNED_INT,
+				(void*)(sizeof(GLuint) * allocation.firstIndex), allocation.firstVertex);
+		}
+		void DrawInstanced(const GeometryAllocation& allocation, GLsizei numInstances) const
+		{
+			glDrawElementsInstancedBaseVertex(GL_TRIANGLES, allocation.numIndices, GL_UNSIGNED_INT,
+				(void*)(sizeof(GLuint) * allocation.firstIndex), numInstances, allocation.firstVertex);
+		}
+	};
+
+	// Geometry buffer holding vertices of one VertexFormat
+	template <typename Format>
+	class GeometryBuffer : public GeometryBufferBase
+	{
+	public:
+		using VertexFormat = Format;
+
+		GeometryBuffer() : GeometryBufferBase(Format::Stride(), &Format::SetupAttributes) {}
+	};
+}
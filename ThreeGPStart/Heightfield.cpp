@@ -0,0 +1,277 @@
+#include "Heightfield.h"
+#include "ImageLoader.h"
+
+#include <cfloat>
+
+namespace Helpers
+{
+	// Flat grid of numCellsX by numCellsZ cells centred on the world origin
+	void Heightfield::Create(int numCellsX, int numCellsZ, float cellSize)
+	{
+		m_numCellsX = numCellsX;
+		m_numCellsZ = numCellsZ;
+		m_cellSize = cellSize;
+		m_origin = glm::vec3(-(numCellsX * cellSize) / 2, 0, (numCellsZ * cellSize) / 2);
+		m_heights.assign((size_t)NumVertsX() * NumVertsZ(), 0.0f);
+	}
+
+	// As Create but heights are taken from the red channel of an image. Returns false on error.
+	bool Heightfield::LoadFromImage(const std::string& filename, int numCellsX, int numCellsZ, float cellSize)
+	{
+		Create(numCellsX, numCellsZ, cellSize);
+
+		ImageLoader heightMap;
+		if (!heightMap.Load(filename))
+			return false;
+
+		const unsigned char* texels = (const unsigned char*)heightMap.GetData();
+
+		for (int z = 0; z < NumVertsZ(); z++)
+		{
+			for (int x = 0; x < NumVertsX(); x++)
+			{
+				glm::vec2 uv{ GetVertexUV(x, z) };
+
+				int heightMapX = (int)(uv.x * (heightMap.Width() - 1));
+				int heightMapY = (int)(uv.y * (heightMap.Height() - 1));
+
+				int offset = (heightMapX + heightMapY * heightMap.Width()) * 4;
+				SetHeight(x, z, texels[offset]);
+			}
+		}
+
+		return true;
+	}
+
+	// The pattern flips every cell and, when there is an even number of cells in total, once more
+	// at the end of each row so neighbouring rows do not line up
+	bool Heightfield::IsDiamondCell(int cellX, int cellZ) const
+	{
+		bool flipEachRow{ (m_numCellsX * m_numCellsZ) % 2 == 0 };
+		int flips{ cellZ * m_numCellsX + cellX + (flipEachRow ? cellZ : 0) };
+		return flips % 2 == 0;
+	}
+
+	// Grid corners of the two triangles making up a cell, in the same winding as the index buffer
+	void Heightfield::GetCellTriangles(int cellX, int cellZ, glm::ivec2 corners[2][3]) const
+	{
+		glm::ivec2 v00{ cellX, cellZ };
+		glm::ivec2 v10{ cellX + 1, cellZ };
+		glm::ivec2 v01{ cellX, cellZ + 1 };
+		glm::ivec2 v11{ cellX + 1, cellZ + 1 };
+
+		if (IsDiamondCell(cellX, cellZ))
+		{
+			corners[0][0] = v00; corners[0][1] = v10; corners[0][2] = v01;
+			corners[1][0] = v10; corners[1][1] = v11; corners[1][2] = v01;
+		}
+		else
+		{
+			corners[0][0] = v10; corners[0][1] = v11; corners[0][2] = v00;
+			corners[1][0] = v11; corners[1][1] = v01; corners[1][2] = v00;
+		}
+	}
+
+	// Height under a world x/z, interpolated across the same triangles the mesh uses
+	bool Heightfield::SampleHeight(float worldX, float worldZ, float& height) const
+	{
+		glm::vec2 grid{ WorldToGrid(worldX, worldZ) };
+		// Written this way round so a NaN position is also rejected
+		if (!(grid.x >= 0 && grid.y >= 0 && grid.x <= m_numCellsX && grid.y <= m_numCellsZ))
+			return false;
+
+		int cellX{ std::min((int)grid.x, m_numCellsX - 1) };
+		int cellZ{ std::min((int)grid.y, m_numCellsZ - 1) };
+		float fx{ grid.x - cellX };
+		float fz{ grid.y - cellZ };
+
+		float h00{ GetHeight(cellX, cellZ) };
+		float h10{ GetHeight(cellX + 1, cellZ) };
+		float h01{ GetHeight(cellX, cellZ + 1) };
+		float h11{ GetHeight(cellX + 1, cellZ + 1) };
+
+		if (IsDiamondCell(cellX, cellZ))
+		{
+			if (fx + fz <= 1.0f)
+				height = h00 + fx * (h10 - h00) + fz * (h01 - h00);
+			else
+				height = h11 + (1.0f - fx) * (h01 - h11) + (1.0f - fz) * (h10 - h11);
+		}
+		else
+		{
+			if (fx >= fz)
+				height = h00 + fx * (h10 - h00) + fz * (h11 - h10);
+			else
+				height = h00 + fz * (h01 - h00) + fx * (h11 - h01);
+		}
+
+		return true;
+	}
+
+	// Vertex normal as the sum of the face normals of the triangles using the vertex
+	glm::vec3 Heightfield::ComputeNormal(int x, int z) const
+	{
+		glm::vec3 normal{ 0 };
+
+		// Only the (up to) four cells around the vertex can contain it
+		for (int cellZ = std::max(z - 1, 0); cellZ <= std::min(z, m_numCellsZ - 1); cellZ++)
+		{
+			for (int cellX = std::max(x - 1, 0); cellX <= std::min(x, m_numCellsX - 1); cellX++)
+			{
+				glm::ivec2 corners[2][3];
+				GetCellTriangles(cellX, cellZ, corners);
+
+				for (int tri = 0; tri < 2; tri++)
+				{
+					const glm::ivec2* c{ corners[tri] };
+					if (c[0] != glm::ivec2(x, z) && c[1] != glm::ivec2(x, z) && c[2] != glm::ivec2(x, z))
+						continue;
+
+					glm::vec3 v0{ GetVertexPosition(c[0].x, c[0].y) };
+					glm::vec3 v1{ GetVertexPosition(c[1].x, c[1].y) };
+					glm::vec3 v2{ GetVertexPosition(c[2].x, c[2].y) };
+					normal += glm::normalize(glm::cross(v1 - v0, v2 - v0));
+				}
+			}
+		}
+
+		return glm::normalize(normal);
+	}
+
+	// Grid vertices within radius of a world x/z, clipped to the grid
+	GridRect Heightfield::RegionAround(const glm::vec2& centreXZ, float radius) const
+	{
+		glm::vec2 grid{ WorldToGrid(centreXZ.x, centreXZ.y) };
+		float gridRadius{ radius / m_cellSize };
+
+		GridRect region;
+		region.minX = std::max((int)std::ceil(grid.x - gridRadius), 0);
+		region.minZ = std::max((int)std::ceil(grid.y - gridRadius), 0);
+		region.maxX = std::min((int)std::floor(grid.x + gridRadius), m_numCellsX);
+		region.maxZ = std::min((int)std::floor(grid.y + gridRadius), m_numCellsZ);
+		return region;
+	}
+
+	// Smooth falloff, 1 at the centre down to 0 at the radius
+	static float BrushWeight(float distance, float radius)
+	{
+		if (distance >= radius)
+			return 0.0f;
+
+		float r{ distance / radius };
+		float w{ 1.0f - r * r };
+		return w * w;
+	}
+
+	void Heightfield::Raise(const glm::vec2& centreXZ, float radius, float amount)
+	{
+		GridRect region{ RegionAround(centreXZ, radius) };
+		if (region.IsEmpty())
+			return;
+
+		for (int z = region.minZ; z <= region.maxZ; z++)
+		{
+			for (int x = region.minX; x <= region.maxX; x++)
+			{
+				glm::vec3 pos{ GetVertexPosition(x, z) };
+				float weight{ BrushWeight(glm::length(glm::vec2(pos.x, pos.z) - centreXZ), radius) };
+				SetHeight(x, z, pos.y + amount * weight);
+			}
+		}
+
+		MarkDirty(region);
+	}
+
+	// Pulls heights towards targetHeight, strength 1 sets them exactly at the centre
+	void Heightfield::Flatten(const glm::vec2& centreXZ, float radius, float targetHeight, float strength)
+	{
+		GridRect region{ RegionAround(centreXZ, radius) };
+		if (region.IsEmpty())
+			return;
+
+		strength = glm::clamp(strength, 0.0f, 1.0f);
+
+		for (int z = region.minZ; z <= region.maxZ; z++)
+		{
+			for (int x = region.minX; x <= region.maxX; x++)
+			{
+				glm::vec3 pos{ GetVertexPosition(x, z) };
+				float weight{ strength * BrushWeight(glm::length(glm::vec2(pos.x, pos.z) - centreXZ), radius) };
+				SetHeight(x, z, glm::mix(pos.y, targetHeight, weight));
+			}
+		}
+
+		MarkDirty(region);
+	}
+
+	// Applies a brush of brushWidth x brushDepth heights centred on a world x/z, one brush texel per grid vertex
+	void Heightfield::Stamp(const glm::vec2& centreXZ, const std::vector<float>& brush, int brushWidth, int brushDepth,
+		float scale, StampMode mode)
+	{
+		if (brushWidth <= 0 || brushDepth <= 0 || brush.size() < (size_t)brushWidth * brushDepth)
+			return;
+
+		glm::vec2 grid{ WorldToGrid(centreXZ.x, centreXZ.y) };
+		int startX{ (int)std::round(grid.x) - brushWidth / 2 };
+		int startZ{ (int)std::round(grid.y) - brushDepth / 2 };
+
+		GridRect region;
+		region.minX = std::max(startX, 0);
+		region.minZ = std::max(startZ, 0);
+		region.maxX = std::min(startX + brushWidth - 1, m_numCellsX);
+		region.maxZ = std::min(startZ + brushDepth - 1, m_numCellsZ);
+		if (region.IsEmpty())
+			return;
+
+		for (int z = region.minZ; z <= region.maxZ; z++)
+		{
+			for (int x = region.minX; x <= region.maxX; x++)
+			{
+				float value{ brush[(size_t)(z - startZ) * brushWidth + (x - startX)] * scale };
+				float current{ GetHeight(x, z) };
+
+				switch (mode)
+				{
+				case StampMode::Add:
+					SetHeight(x, z, current + value);
+					break;
+				case StampMode::Max:
+					SetHeight(x, z, std::max(current, value));
+					break;
+				case StampMode::Replace:
+					SetHeight(x, z, value);
+					break;
+				}
+			}
+		}
+
+		MarkDirty(region);
+	}
+
+	// Lowest and highest heights of the vertices in an inclusive region
+	void Heightfield::GetHeightRange(const GridRect& region, float& minHeight, float& maxHeight) const
+	{
+		minHeight = FLT_MAX;
+		maxHeight = -FLT_MAX;
+
+		for (int z = std::max(region.minZ, 0); z <= std::min(region.maxZ, m_numCellsZ); z++)
+		{
+			for (int x = std::max(region.minX, 0); x <= std::min(region.maxX, m_numCellsX); x++)
+			{
+				minHeight = std::min(minHeight, GetHeight(x, z));
+				maxHeight = std::max(maxHeight, GetHeight(x, z));
+			}
+		}
+	}
+
+	// Returns the vertices changed since the last call and clears the record. False if nothing changed.
+	bool Heightfield::TakeDirtyRegion(GridRect& region)
+	{
+		if (m_dirtyRegion.IsEmpty())
+			return false;
+
+		region = m_dirtyRegion;
+		m_dirtyRegion = GridRect();
+		return true;
+	}
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include "ExternalLibraryHeaders.h"
+
+namespace Helpers
+{
+	// Inclusive range of grid vertices
+	struct GridRect
+	{
+		int minX{ 0 };
+		int minZ{ 0 };
+		int maxX{ -1 };
+		int maxZ{ -1 };
+
+		bool IsEmpty() const { return maxX < minX || maxZ < minZ; }
+
+		// Grows this to also cover other
+		void Include(const GridRect& other)
+		{
+			if (other.IsEmpty())
+				return;
+			if (IsEmpty())
+			{
+				*this = other;
+				return;
+			}
+			minX = std::min(minX, other.minX);
+			minZ = std::min(minZ, other.minZ);
+			maxX = std::max(maxX, other.maxX);
+			maxZ = std::max(maxZ, other.maxZ);
+		}
+	};
+
+	// How Heightfield::Stamp combines the brush with the existing heights
+	enum class StampMode
+	{
+		Add,
+		Max,
+		Replace
+	};
+
+	// CPU side copy of the terrain heights, one per grid vertex
+	// Vertex (0,0) sits at the origin corner, x runs along world +x and z runs along world -z
+	// to match the layout the terrain mesh has always been built with
+	class Heightfield
+	{
+	private:
+		int m_numCellsX{ 0 };
+		int m_numCellsZ{ 0 };
+		float m_cellSize{ 1.0f };
+		glm::vec3 m_origin{ 0 };
+
+		// Row major, m_numCellsX + 1 entries per row
+		std::vector<float> m_heights;
+
+		// Vertices changed by edits since the last TakeDirtyRegion
+		GridRect m_dirtyRegion;
+
+		// Grid vertices within radius of a world x/z, clipped to the grid
+		GridRect RegionAround(const glm::vec2& centreXZ, float radius) const;
+	public:
+		// Flat grid of numCellsX by numCellsZ cells centred on the world origin
+		void Create(int numCellsX, int numCellsZ, float cellSize);
+
+		// As Create but heights are taken from the red channel of an image. Returns false on error.
+		bool LoadFromImage(const std::string& filename, int numCellsX, int numCellsZ, float cellSize);
+
+		int NumCellsX() const { return m_numCellsX; }
+		int NumCellsZ() const { return m_numCellsZ; }
+		int NumVertsX() const { return m_numCellsX + 1; }
+		int NumVertsZ() const { return m_numCellsZ + 1; }
+		float CellSize() const { return m_cellSize; }
+		glm::vec3 Origin() const { return m_origin; }
+
+		float GetHeight(int x, int z) const { return m_heights[(size_t)z * NumVertsX() + x]; }
+		void SetHeight(int x, int z, float height) { m_heights[(size_t)z * NumVertsX() + x] = height; }
+		const std::vector<float>& GetHeights() const { return m_heights; }
+
+		// World position of a grid vertex
+		glm::vec3 GetVertexPosition(int x, int z) const
+		{
+			return glm::vec3(m_origin.x + x * m_cellSize, GetHeight(x, z), m_origin.z - z * m_cellSize);
+		}
+
+		// Texture coordinate of a grid vertex, 0-1 across the whole terrain
+		glm::vec2 GetVertexUV(int x, int z) const
+		{
+			return glm::vec2((float)x / m_numCellsX, (float)z / m_numCellsZ);
+		}
+
+		// Converts a world x/z into continuous grid coordinates (may be outside the grid)
+		glm::vec2 WorldToGrid(float worldX, float worldZ) const
+		{
+			return glm::vec2((worldX - m_origin.x) / m_cellSize, (m_origin.z - worldZ) / m_cellSize);
+		}
+
+		// The triangles alternate their shared edge between cells to give the diamond pattern
+		// True means the cell is split from (x+1,z) to (x,z+1), false from (x,z) to (x+1,z+1)
+		bool IsDiamondCell(int cellX, int cellZ) const;
+
+		// Grid corners of the two triangles making up a cell, in the same winding as the index buffer
+		void GetCellTriangles(int cellX, int cellZ, glm::ivec2 corners[2][3]) const;
+
+		// Height under a world x/z, interpolated across the same triangles the mesh uses
+		// Returns false if the point is off the terrain
+		bool SampleHeight(float worldX, float worldZ, float& height) const;
+
+		// Vertex normal as the sum of the face normals of the triangles using the vertex
+		// Gives the same result as accumulating over the whole index buffer but only touches the neighbours
+		glm::vec3 ComputeNormal(int x, int z) const;
+
+		// Lowest and highest heights of the vertices in an inclusive region, e.g. for bounding boxes
+		void GetHeightRange(const GridRect& region, float& minHeight, float& maxHeight) const;
+
+		// Edits, all x/z positions are in world space and the falloff is smooth towards the radius
+		// Each one records the vertices it changed, see TakeDirtyRegion
+		void Raise(const glm::vec2& centreXZ, float radius, float amount);
+		void Lower(const glm::vec2& centreXZ, float radius, float amount) { Raise(centreXZ, radius, -amount); }
+
+		// Pulls heights towards targetHeight, strength 1 sets them exactly at the centre
+		void Flatten(const glm::vec2& centreXZ, float radius, float targetHeight, float strength);
+
+		// Applies a brush of brushWidth x brushDepth heights centred on a world x/z, one brush texel per grid vertex
+		void Stamp(const glm::vec2& centreXZ, const std::vector<float>& brush, int brushWidth, int brushDepth,
+			float scale, StampMode mode);
+
+		// Marks vertices as changed for anything that edits heights directly via SetHeight
+		void MarkDirty(const GridRect& region) { m_dirtyRegion.Include(region); }
+
+		// Returns the vertices changed since the last call and clears the record. False if nothing changed.
+		bool TakeDirtyRegion(GridRect& region);
+	};
+}
@@ -63,9 +63,72 @@ namespace Helpers
 
 		glfwSwapInterval(-1);
 
+#ifdef _DEBUG
+		if (!EnableGLDebugOutput())
+			std::cout << "GL debug output not supported" << std::endl;
+#endif
+
 		return window;
 	}
 
+	static const char* DebugSourceName(GLenum source)
+	{
+		switch (source)
+		{
+		case GL_DEBUG_SOURCE_API: return "API";
+		case GL_DEBUG_SOURCE_WINDOW_SYSTEM: return "Window system";
+		case GL_DEBUG_SOURCE_SHADER_COMPILER: return "Shader compiler";
+		case GL_DEBUG_SOURCE_THIRD_PARTY: return "Third party";
+		case GL_DEBUG_SOURCE_APPLICATION: return "Application";
+		default: return "Other";
+		}
+	}
+
+	static const char* DebugTypeName(GLenum type)
+	{
+		switch (type)
+		{
+		case GL_DEBUG_TYPE_ERROR: return "Error";
+		case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR: return "Deprecated behaviour";
+		case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR: return "Undefined behaviour";
+		case GL_DEBUG_TYPE_PORTABILITY: return "Portability";
+		case GL_DEBUG_TYPE_PERFORMANCE: return "Performance";
+		default: return "Other";
+		}
+	}
+
+	static const char* DebugSeverityName(GLenum severity)
+	{
+		switch (severity)
+		{
+		case GL_DEBUG_SEVERITY_HIGH: return "high";
+		case GL_DEBUG_SEVERITY_MEDIUM: return "medium";
+		case GL_DEBUG_SEVERITY_LOW: return "low";
+		default: return "notification";
+		}
+	}
+
+	static void GLAPIENTRY DebugMessageCallback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei /*length*/,
+		const GLchar* message, const void* /*userParam*/)
+	{
+		std::cerr << "GL " << DebugTypeName(type) << " (" << DebugSeverityName(severity) << ", " << DebugSourceName(source)
+			<< " " << id << "): " << message << std::endl;
+	}
+
+	// Routes GL errors and warnings to std::cerr as they happen through KHR_debug
+	// Synchronous so a breakpoint in the callback stops on the call that caused the message
+	bool EnableGLDebugOutput()
+	{
+		if (!GLEW_VERSION_4_3 && !GLEW_KHR_debug)
+			return false;
+
+		glEnable(GL_DEBUG_OUTPUT);
+		glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+		glDebugMessageCallback(DebugMessageCallback, nullptr);
+		glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_NOTIFICATION, 0, nullptr, GL_FALSE);
+		return true;
+	}
+
 	// Loads a whole file into a string e.g. for shaders
 	std::string stringFromFile(std::string filepath)
 	{
@@ -16,7 +16,12 @@ namespace Helpers
 	// Load and compile a shader of shaderType from file shaderFilename. Returns 0 on error.
 	GLuint LoadAndCompileShader(GLenum shaderType, const std::string& shaderFilename);
 
+	// Routes GL errors and warnings to std::cerr as they happen through KHR_debug, so nothing has to poll glGetError
+	// Notifications are filtered out. Returns false if the context has no debug output.
+	bool EnableGLDebugOutput();
+
 	// Check for an OpenGL errot and output its type if there was one
+	// Round trips to the driver so keep it to loading code, frames rely on EnableGLDebugOutput
 	inline bool CheckForGLError()
 	{
 		GLenum error{ glGetError() };
@@ -54,6 +54,7 @@ namespace Helpers
 		// so will cause a crash) - just let it go out of scope and the memory will be returned to the stack.
 		BYTE* textureData{ FreeImage_GetBits(bitmap32) };
 
+		delete[] m_data;
 		m_data = new GLbyte[(size_t)m_width * (size_t)m_height * 1 * 4];
 
 		// Copy to mine, Note: Freeimage data format is GL_BGRA while I need GL_RGBA
@@ -14,6 +14,12 @@ namespace Helpers
 		int m_height{ 0 };
 		GLbyte* m_data{ nullptr };
 	public:
+		ImageLoader() = default;
+		~ImageLoader() { delete[] m_data; }
+
+		ImageLoader(const ImageLoader&) = delete;
+		ImageLoader& operator=(const ImageLoader&) = delete;
+
 		// Width in texels of the image
 		int Width() const { return m_width; }
 
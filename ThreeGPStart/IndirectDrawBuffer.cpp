@@ -0,0 +1,70 @@
+#include "IndirectDrawBuffer.h"
+
+namespace Helpers
+{
+	IndirectDrawBuffer::~IndirectDrawBuffer()
+	{
+		glDeleteBuffers(1, &m_commandBuffer);
+		glDeleteBuffers(1, &m_instanceBuffer);
+	}
+
+	// Multi draw indirect with a base instance needs GL 4.3 or the extensions
+	bool IndirectDrawBuffer::IsSupported()
+	{
+		return GLEW_VERSION_4_3 || (GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance);
+	}
+
+	// Starts a new frame, the memory is kept
+	void IndirectDrawBuffer::Clear()
+	{
+		m_commands.clear();
+		m_instances.clear();
+	}
+
+	// Returns the base instance to give a command drawing this instance
+	GLuint IndirectDrawBuffer::AddInstance(const InstanceData& instance)
+	{
+		m_instances.push_back(instance);
+		return (GLuint)m_instances.size() - 1;
+	}
+
+	GLsizei IndirectDrawBuffer::AddCommand(const DrawElementsIndirectCommand& command)
+	{
+		m_commands.push_back(command);
+		return (GLsizei)m_commands.size() - 1;
+	}
+
+	// Sends the frame's commands and instances, each buffer is orphaned so the GPU can still be reading last frame's
+	bool IndirectDrawBuffer::Upload()
+	{
+		bool instanceBufferRecreated{ false };
+
+		if (m_commandBuffer == 0)
+			glGenBuffers(1, &m_commandBuffer);
+		if (m_commands.size() > m_commandCapacity)
+			m_commandCapacity = std::max<size_t>(m_commands.size() * 2, 256);
+
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_commandBuffer);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(DrawElementsIndirectCommand) * m_commandCapacity, nullptr, GL_STREAM_DRAW);
+		if (!m_commands.empty())
+			glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, sizeof(DrawElementsIndirectCommand) * m_commands.size(), m_commands.data());
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+		// A VAO holds the buffer name, so only a new name means it needs setting up again
+		if (m_instanceBuffer == 0)
+		{
+			glGenBuffers(1, &m_instanceBuffer);
+			instanceBufferRecreated = true;
+		}
+		if (m_instances.size() > m_instanceCapacity)
+			m_instanceCapacity = std::max<size_t>(m_instances.size() * 2, 256);
+
+		glBindBuffer(GL_ARRAY_BUFFER, m_instanceBuffer);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(InstanceData) * m_instanceCapacity, nullptr, GL_STREAM_DRAW);
+		if (!m_instances.empty())
+			glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(InstanceData) * m_instances.size(), m_instances.data());
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		return instanceBufferRecreated;
+	}
+}
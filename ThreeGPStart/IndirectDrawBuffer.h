@@ -0,0 +1,67 @@
+#pragma once
+
+#include "ExternalLibraryHeaders.h"
+#include "InstanceBuffer.h"
+
+namespace Helpers
+{
+	// Layout of one draw as read by glMultiDrawElementsIndirect
+	struct DrawElementsIndirectCommand
+	{
+		GLuint count{ 0 };
+		GLuint instanceCount{ 0 };
+		GLuint firstIndex{ 0 };
+		GLint baseVertex{ 0 };
+		GLuint baseInstance{ 0 };
+	};
+
+	// Draw commands and per draw instance data written each frame, so a whole batch of meshes
+	// sharing a program, VAO and material goes to GL as one glMultiDrawElementsIndirect call.
+	// Per draw values reach the shader through the base instance, which offsets the instance attributes.
+	class IndirectDrawBuffer
+	{
+	private:
+		GLuint m_commandBuffer{ 0 };
+		GLuint m_instanceBuffer{ 0 };
+		size_t m_commandCapacity{ 0 };
+		size_t m_instanceCapacity{ 0 };
+
+		std::vector<DrawElementsIndirectCommand> m_commands;
+		std::vector<InstanceData> m_instances;
+	public:
+		IndirectDrawBuffer() = default;
+		~IndirectDrawBuffer();
+
+		IndirectDrawBuffer(const IndirectDrawBuffer&) = delete;
+		IndirectDrawBuffer& operator=(const IndirectDrawBuffer&) = delete;
+
+		// Multi draw indirect with a base instance needs GL 4.3 or the extensions, GL 3.3 must draw one at a time
+		static bool IsSupported();
+
+		// Starts a new frame, the memory is kept
+		void Clear();
+
+		// Returns the base instance to give a command drawing this instance
+		GLuint AddInstance(const InstanceData& instance);
+
+		// Returns the command's index
+		GLsizei AddCommand(const DrawElementsIndirectCommand& command);
+
+		// Sends the frame's commands and instances. Returns true if the instance buffer was recreated,
+		// any VAO reading it must then be set up again.
+		bool Upload();
+
+		GLuint GetInstanceBuffer() const { return m_instanceBuffer; }
+
+		// Binds the command buffer for Draw
+		void Bind() const { glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_commandBuffer); }
+		static void Unbind() { glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0); }
+
+		// Draws a run of commands using the bound VAO, whose indices must be GL_UNSIGNED_INT
+		void Draw(GLsizei firstCommand, GLsizei numCommands) const
+		{
+			glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+				(void*)(sizeof(DrawElementsIndirectCommand) * firstCommand), numCommands, 0);
+		}
+	};
+}
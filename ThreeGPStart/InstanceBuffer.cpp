@@ -0,0 +1,132 @@
+#include "InstanceBuffer.h"
+
+namespace Helpers
+{
+	InstanceBuffer::~InstanceBuffer()
+	{
+		glDeleteBuffers(1, &m_buffer);
+	}
+
+	void InstanceBuffer::MarkDirty(size_t index)
+	{
+		m_dirtyMin = std::min(m_dirtyMin, index);
+		m_dirtyMax = std::max(m_dirtyMax, index);
+	}
+
+	InstanceHandle InstanceBuffer::Add(const InstanceData& instance)
+	{
+		InstanceHandle handle;
+		if (!m_freeHandles.empty())
+		{
+			handle = m_freeHandles.back();
+			m_freeHandles.pop_back();
+		}
+		else
+		{
+			handle = (InstanceHandle)m_handleToIndex.size();
+			m_handleToIndex.push_back(0);
+		}
+
+		m_handleToIndex[handle] = (GLuint)m_instances.size();
+		m_indexToHandle.push_back(handle);
+		m_instances.push_back(instance);
+		MarkDirty(m_instances.size() - 1);
+
+		return handle;
+	}
+
+	void InstanceBuffer::Update(InstanceHandle handle, const InstanceData& instance)
+	{
+		GLuint index{ m_handleToIndex[handle] };
+		m_instances[index] = instance;
+		MarkDirty(index);
+	}
+
+	// The last instance moves into the gap so the buffer stays packed
+	void InstanceBuffer::Remove(InstanceHandle handle)
+	{
+		GLuint index{ m_handleToIndex[handle] };
+		GLuint last{ (GLuint)m_instances.size() - 1 };
+
+		if (index != last)
+		{
+			m_instances[index] = m_instances[last];
+			m_indexToHandle[index] = m_indexToHandle[last];
+			m_handleToIndex[m_indexToHandle[index]] = index;
+			MarkDirty(index);
+		}
+
+		m_instances.pop_back();
+		m_indexToHandle.pop_back();
+		m_freeHandles.push_back(handle);
+	}
+
+	// Sends the changes since the last call, the buffer is recreated if it has grown
+	bool InstanceBuffer::Upload()
+	{
+		bool recreated{ false };
+		if (m_instances.size() > m_capacity || m_buffer == 0)
+		{
+			m_capacity = std::max<size_t>(m_instances.size() * 2, 64);
+
+			glDeleteBuffers(1, &m_buffer);
+			glGenBuffers(1, &m_buffer);
+			glBindBuffer(GL_ARRAY_BUFFER, m_buffer);
+			glBufferData(GL_ARRAY_BUFFER, sizeof(InstanceData) * m_capacity, nullptr, GL_DYNAMIC_DRAW);
+
+			// Everything needs sending to the new buffer
+			m_dirtyMin = 0;
+			m_dirtyMax = m_instances.size();
+			recreated = true;
+		}
+		else
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, m_buffer);
+		}
+
+		// Anything past the end was removed and does not need sending
+		m_dirtyMax = std::min(m_dirtyMax, m_instances.size() - 1);
+		if (!m_instances.empty() && m_dirtyMin <= m_dirtyMax)
+		{
+			glBufferSubData(GL_ARRAY_BUFFER, sizeof(InstanceData) * m_dirtyMin, sizeof(InstanceData) * (m_dirtyMax - m_dirtyMin + 1),
+				&m_instances[m_dirtyMin]);
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		m_dirtyMin = SIZE_MAX;
+		m_dirtyMax = 0;
+
+		return recreated;
+	}
+
+	// Points the per instance attributes of the bound VAO at any buffer of InstanceData
+	void InstanceBuffer::SetupAttributes(GLuint buffer)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, buffer);
+
+		// A mat4 attribute is four vec4 columns in consecutive locations
+		for (GLuint column = 0; column < 4; column++)
+		{
+			GLuint location{ KModelXformLocation + column };
+			glEnableVertexAttribArray(location);
+			glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+				(void*)(offsetof(InstanceData, modelXform) + sizeof(glm::vec4) * column));
+			glVertexAttribDivisor(location, 1);
+		}
+
+		glEnableVertexAttribArray(KTintLocation);
+		glVertexAttribPointer(KTintLocation, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)offsetof(InstanceData, tint));
+		glVertexAttribDivisor(KTintLocation, 1);
+
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	// Sets the non array values of the per instance attributes
+	void InstanceBuffer::SetCurrentInstance(const InstanceData& instance)
+	{
+		for (GLuint column = 0; column < 4; column++)
+			glVertexAttrib4fv(KModelXformLocation + column, glm::value_ptr(instance.modelXform[column]));
+
+		glVertexAttrib4fv(KTintLocation, glm::value_ptr(instance.tint));
+	}
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "ExternalLibraryHeaders.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Helpers
+{
+	// Per instance values read by the vertex shader, advanced once per instance rather than per vertex
+	struct InstanceData
+	{
+		glm::mat4 modelXform{ 1.0f };
+		glm::vec4 tint{ 1.0f };
+	};
+
+	// Stays valid however many other instances are added or removed
+	using InstanceHandle = GLuint;
+
+	// GPU buffer of instances kept tightly packed so one instanced draw covers them all
+	// Removing an instance moves the last one into its place, so handles map to a packed index.
+	// Changes are made on the CPU copy and sent in one range by Upload.
+	class InstanceBuffer
+	{
+	private:
+		GLuint m_buffer{ 0 };
+		size_t m_capacity{ 0 };
+
+		std::vector<InstanceData> m_instances;
+		std::vector<InstanceHandle> m_indexToHandle;
+		std::vector<GLuint> m_handleToIndex;
+		std::vector<InstanceHandle> m_freeHandles;
+
+		// Packed indices changed since the last upload, empty when min > max
+		size_t m_dirtyMin{ SIZE_MAX };
+		size_t m_dirtyMax{ 0 };
+
+		void MarkDirty(size_t index);
+	public:
+		// Vertex shader locations used by SetupAttributes, the transform takes four
+		static const GLuint KModelXformLocation{ 3 };
+		static const GLuint KTintLocation{ 7 };
+
+		InstanceBuffer() = default;
+		~InstanceBuffer();
+
+		InstanceBuffer(const InstanceBuffer&) = delete;
+		InstanceBuffer& operator=(const InstanceBuffer&) = delete;
+
+		InstanceHandle Add(const InstanceData& instance);
+		void Update(InstanceHandle handle, const InstanceData& instance);
+		void Remove(InstanceHandle handle);
+
+		const InstanceData& Get(InstanceHandle handle) const { return m_instances[m_handleToIndex[handle]]; }
+
+		// Every instance, packed in no particular order
+		const std::vector<InstanceData>& Instances() const { return m_instances; }
+		GLsizei Count() const { return (GLsizei)m_instances.size(); }
+
+		// Sends the changes since the last call, the buffer is recreated if it has grown
+		// Returns true if the buffer was recreated, any VAO using it must then be set up again
+		bool Upload();
+
+		// Points the per instance attributes of the bound VAO at this buffer
+		void SetupAttributes() const { SetupAttributes(m_buffer); }
+
+		// Points the per instance attributes of the bound VAO at any buffer of InstanceData
+		static void SetupAttributes(GLuint buffer);
+
+		// Sets the non array values of the per instance attributes, used by draws of a single
+		// unmoving copy whose VAO has no instance buffer
+		static void SetCurrentInstance(const InstanceData& instance);
+	};
+}
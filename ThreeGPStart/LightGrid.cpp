@@ -0,0 +1,236 @@
+#include "LightGrid.h"
+#include "ThreadPool.h"
+
+namespace Helpers
+{
+	LightGrid::~LightGrid()
+	{
+		glDeleteTextures(1, &m_lightTexture);
+		glDeleteTextures(1, &m_clusterTexture);
+		glDeleteTextures(1, &m_indexTexture);
+		glDeleteBuffers(1, &m_lightBuffer);
+		glDeleteBuffers(1, &m_clusterBuffer);
+		glDeleteBuffers(1, &m_indexBuffer);
+	}
+
+	// Reads the driver's texture buffer limit, call with a GL context current before the first Build
+	void LightGrid::Initialise()
+	{
+		GLint maxTexels{ 0 };
+		glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+		m_maxTexels = std::max(maxTexels, m_maxTexels);
+	}
+
+	// Works out the lights in each cluster for this camera
+	void LightGrid::Build(const std::vector<PointLight>& lights, const glm::mat4& viewXform, const glm::mat4& projectionXform,
+		float nearPlane, float farPlane, int framebufferWidth, int framebufferHeight, const glm::vec3& ambientColour)
+	{
+		// Two texels a light
+		const size_t numLights{ std::min(std::min(lights.size(), (size_t)KMaxLights), (size_t)m_maxTexels / 2) };
+
+		m_lightTexels.resize(numLights * 2);
+		m_viewLights.resize(numLights);
+		for (size_t i = 0; i < numLights; i++)
+		{
+			const PointLight& light{ lights[i] };
+			m_lightTexels[i * 2] = glm::vec4(light.position, light.radius);
+			m_lightTexels[i * 2 + 1] = glm::vec4(light.colour, 0);
+			m_viewLights[i] = glm::vec4(glm::vec3(viewXform * glm::vec4(light.position, 1.0f)), light.radius);
+		}
+
+		// Tiles are whole pixels, so the last row and column may reach past the edge of the screen
+		const int width{ std::max(framebufferWidth, 1) };
+		const int height{ std::max(framebufferHeight, 1) };
+		const int tileWidth{ (width + KClustersX - 1) / KClustersX };
+		const int tileHeight{ (height + KClustersY - 1) / KClustersY };
+
+		// Tile edges as x / depth, from the projection's tan of half the field of view
+		const float tanHalfX{ 1.0f / projectionXform[0][0] };
+		const float tanHalfY{ 1.0f / projectionXform[1][1] };
+		m_tileEdgesX.resize(KClustersX + 1);
+		for (int i = 0; i <= KClustersX; i++)
+			m_tileEdgesX[i] = ((float)(i * tileWidth) / width * 2.0f - 1.0f) * tanHalfX;
+		m_tileEdgesY.resize(KClustersY + 1);
+		for (int j = 0; j <= KClustersY; j++)
+			m_tileEdgesY[j] = ((float)(j * tileHeight) / height * 2.0f - 1.0f) * tanHalfY;
+
+		const float logDepthRange{ std::log(farPlane / nearPlane) };
+
+		m_uniforms.viewXform = viewXform;
+		m_uniforms.ambientColour = glm::vec4(ambientColour, 1.0f);
+		m_uniforms.clusterScale = glm::vec4(1.0f / tileWidth, 1.0f / tileHeight, KClustersZ / logDepthRange, -KClustersZ * std::log(nearPlane) / logDepthRange);
+		m_uniforms.clusterCounts = glm::uvec4(KClustersX, KClustersY, KClustersZ, (GLuint)numLights);
+
+		// Slices share nothing but the inputs, each writes its own clusters and list
+		m_clusters.assign((size_t)KClustersX * KClustersY * KClustersZ, glm::uvec2(0));
+		m_sliceIndices.resize(KClustersZ);
+		if (numLights > 0)
+		{
+			ThreadPool::Get().ParallelFor(KClustersZ, 1, [this, nearPlane, farPlane](size_t begin, size_t end)
+			{
+				for (size_t slice = begin; slice < end; slice++)
+					BinSlice((int)slice, nearPlane, farPlane);
+			});
+		}
+		else
+		{
+			for (auto& sliceIndices : m_sliceIndices)
+				sliceIndices.clear();
+		}
+
+		// Slice offsets were from the start of their own list. Past what the index texture buffer
+		// holds clusters lose their lights rather than reading beyond it.
+		const GLuint maxIndices{ (GLuint)m_maxTexels };
+		m_indices.clear();
+		for (int slice = 0; slice < KClustersZ; slice++)
+		{
+			const GLuint sliceStart{ (GLuint)m_indices.size() };
+			glm::uvec2* cluster{ &m_clusters[(size_t)slice * KClustersX * KClustersY] };
+			for (int i = 0; i < KClustersX * KClustersY; i++)
+			{
+				cluster[i].x += sliceStart;
+				if (cluster[i].x >= maxIndices)
+					cluster[i] = glm::uvec2(0);
+				else
+					cluster[i].y = std::min(cluster[i].y, maxIndices - cluster[i].x);
+			}
+
+			const std::vector<uint16_t>& sliceIndices{ m_sliceIndices[slice] };
+			const size_t kept{ std::min(sliceIndices.size(), (size_t)(maxIndices - sliceStart)) };
+			m_indices.insert(m_indices.end(), sliceIndices.begin(), sliceIndices.begin() + kept);
+		}
+	}
+
+	void LightGrid::BinSlice(int slice, float nearPlane, float farPlane)
+	{
+		// Depths grow by the same factor every slice, so near slices are thin and far ones deep
+		const float sliceNear{ nearPlane * std::pow(farPlane / nearPlane, (float)slice / KClustersZ) };
+		const float sliceFar{ nearPlane * std::pow(farPlane / nearPlane, (float)(slice + 1) / KClustersZ) };
+
+		// View space extents of each tile column and row across the slice's depth
+		float tileMinX[KClustersX], tileMaxX[KClustersX], tileMinY[KClustersY], tileMaxY[KClustersY];
+		for (int i = 0; i < KClustersX; i++)
+		{
+			tileMinX[i] = std::min(m_tileEdgesX[i] * sliceNear, m_tileEdgesX[i] * sliceFar);
+			tileMaxX[i] = std::max(m_tileEdgesX[i + 1] * sliceNear, m_tileEdgesX[i + 1] * sliceFar);
+		}
+		for (int j = 0; j < KClustersY; j++)
+		{
+			tileMinY[j] = std::min(m_tileEdgesY[j] * sliceNear, m_tileEdgesY[j] * sliceFar);
+			tileMaxY[j] = std::max(m_tileEdgesY[j + 1] * sliceNear, m_tileEdgesY[j + 1] * sliceFar);
+		}
+
+		// Lights reaching into the slice and the tiles their bounding boxes overlap
+		struct Candidate
+		{
+			uint16_t light;
+			int minI, maxI, minJ, maxJ;
+		};
+		std::vector<Candidate> candidates;
+		for (size_t l = 0; l < m_viewLights.size(); l++)
+		{
+			const glm::vec4& light{ m_viewLights[l] };
+			const float depth{ -light.z };
+			if (depth + light.w < sliceNear || depth - light.w > sliceFar)
+				continue;
+
+			Candidate candidate{ (uint16_t)l, KClustersX, -1, KClustersY, -1 };
+			for (int i = 0; i < KClustersX; i++)
+			{
+				if (light.x + light.w >= tileMinX[i] && light.x - light.w <= tileMaxX[i])
+				{
+					candidate.minI = std::min(candidate.minI, i);
+					candidate.maxI = i;
+				}
+			}
+			for (int j = 0; j < KClustersY; j++)
+			{
+				if (light.y + light.w >= tileMinY[j] && light.y - light.w <= tileMaxY[j])
+				{
+					candidate.minJ = std::min(candidate.minJ, j);
+					candidate.maxJ = j;
+				}
+			}
+			if (candidate.minI <= candidate.maxI && candidate.minJ <= candidate.maxJ)
+				candidates.push_back(candidate);
+		}
+
+		// Then the sphere against each cluster's box, which cuts out the corners of the overlap
+		std::vector<uint16_t>& indices{ m_sliceIndices[slice] };
+		indices.clear();
+		glm::uvec2* clusters{ &m_clusters[(size_t)slice * KClustersX * KClustersY] };
+		for (int j = 0; j < KClustersY; j++)
+		{
+			for (int i = 0; i < KClustersX; i++)
+			{
+				const glm::vec3 boxMin{ tileMinX[i], tileMinY[j], -sliceFar };
+				const glm::vec3 boxMax{ tileMaxX[i], tileMaxY[j], -sliceNear };
+				const GLuint start{ (GLuint)indices.size() };
+
+				for (const Candidate& candidate : candidates)
+				{
+					if (i < candidate.minI || i > candidate.maxI || j < candidate.minJ || j > candidate.maxJ)
+						continue;
+
+					const glm::vec4& light{ m_viewLights[candidate.light] };
+					const glm::vec3 centre{ light };
+					const glm::vec3 offset{ glm::clamp(centre, boxMin, boxMax) - centre };
+					if (glm::dot(offset, offset) <= light.w * light.w)
+						indices.push_back(candidate.light);
+				}
+
+				clusters[j * KClustersX + i] = glm::uvec2(start, (GLuint)indices.size() - start);
+			}
+		}
+	}
+
+	// Sends the lists built by the last Build to the texture buffers
+	void LightGrid::Upload()
+	{
+		if (!m_lightBuffer)
+		{
+			glGenBuffers(1, &m_lightBuffer);
+			glGenBuffers(1, &m_clusterBuffer);
+			glGenBuffers(1, &m_indexBuffer);
+			glGenTextures(1, &m_lightTexture);
+			glGenTextures(1, &m_clusterTexture);
+			glGenTextures(1, &m_indexTexture);
+		}
+
+		// Nothing to send while there are no lights and the last upload had none either
+		if (m_lightTexels.empty() && m_uploadedEmpty)
+			return;
+		m_uploadedEmpty = m_lightTexels.empty();
+
+		// Replaced whole each frame, orphaning the old storage so the GPU can still be reading it
+		// An empty buffer cannot back a texture so each has room for at least one texel
+		auto upload = [](GLuint buffer, GLuint texture, GLenum format, const void* data, size_t bytes, size_t minBytes)
+		{
+			glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+			glBufferData(GL_TEXTURE_BUFFER, std::max(bytes, minBytes), nullptr, GL_STREAM_DRAW);
+			if (bytes > 0)
+				glBufferSubData(GL_TEXTURE_BUFFER, 0, bytes, data);
+			glBindTexture(GL_TEXTURE_BUFFER, texture);
+			glTexBuffer(GL_TEXTURE_BUFFER, format, buffer);
+		};
+
+		upload(m_lightBuffer, m_lightTexture, GL_RGBA32F, m_lightTexels.data(), m_lightTexels.size() * sizeof(glm::vec4), sizeof(glm::vec4));
+		upload(m_clusterBuffer, m_clusterTexture, GL_RG32UI, m_clusters.data(), m_clusters.size() * sizeof(glm::uvec2), sizeof(glm::uvec2));
+		upload(m_indexBuffer, m_indexTexture, GL_R16UI, m_indices.data(), m_indices.size() * sizeof(uint16_t), sizeof(uint16_t));
+
+		glBindTexture(GL_TEXTURE_BUFFER, 0);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	}
+
+	// Binds the light, cluster and index texture buffers to the units the shaders sample them on
+	void LightGrid::Bind(GLint lightUnit, GLint clusterUnit, GLint indexUnit) const
+	{
+		glActiveTexture(GL_TEXTURE0 + lightUnit);
+		glBindTexture(GL_TEXTURE_BUFFER, m_lightTexture);
+		glActiveTexture(GL_TEXTURE0 + clusterUnit);
+		glBindTexture(GL_TEXTURE_BUFFER, m_clusterTexture);
+		glActiveTexture(GL_TEXTURE0 + indexUnit);
+		glBindTexture(GL_TEXTURE_BUFFER, m_indexTexture);
+		glActiveTexture(GL_TEXTURE0);
+	}
+}
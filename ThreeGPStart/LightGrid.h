@@ -0,0 +1,105 @@
+#pragma once
+
+#include "ExternalLibraryHeaders.h"
+
+#include <cstdint>
+
+namespace Helpers
+{
+	// A light reaching as far as radius, fading to nothing there
+	struct PointLight
+	{
+		glm::vec3 position{ 0 };
+		float radius{ 100.0f };
+		glm::vec3 colour{ 1.0f };
+	};
+
+	// Matches the Lights uniform block in the fragment shaders, std140 layout
+	struct LightGridUniforms
+	{
+		glm::mat4 viewXform;
+
+		// Added to the lights, 1 keeps unlit surfaces at their texture colour
+		glm::vec4 ambientColour;
+
+		// Pixels to tiles in x and y, then scale and bias from log view depth to slice
+		glm::vec4 clusterScale;
+
+		// Clusters in x, y and z then the number of lights
+		glm::uvec4 clusterCounts;
+	};
+
+	// Splits the view volume into clusters, screen tiles cut into slices growing exponentially with
+	// depth, and lists the lights touching each so a fragment only looks at the lights of its own
+	// cluster. Slices are binned in parallel on the thread pool, each light only tested against the
+	// tiles its sphere overlaps. Lights, per cluster ranges and the concatenated light lists are
+	// sent as texture buffers, the fragment shader finds its cluster from gl_FragCoord and depth.
+	class LightGrid
+	{
+	private:
+		// Real texture buffers and their textures, lights as two texels each, clusters as
+		// offset and count, light indices 16 bit
+		GLuint m_lightBuffer{ 0 };
+		GLuint m_clusterBuffer{ 0 };
+		GLuint m_indexBuffer{ 0 };
+		GLuint m_lightTexture{ 0 };
+		GLuint m_clusterTexture{ 0 };
+		GLuint m_indexTexture{ 0 };
+
+		bool m_uploadedEmpty{ false };
+
+		// Most texels a texture buffer may hold, 65536 is the least GL 3.3 allows
+		GLint m_maxTexels{ 65536 };
+
+		LightGridUniforms m_uniforms;
+
+		std::vector<glm::vec4> m_lightTexels;
+		std::vector<glm::uvec2> m_clusters;
+		std::vector<uint16_t> m_indices;
+
+		// Per slice during Build, concatenated afterwards
+		std::vector<std::vector<uint16_t>> m_sliceIndices;
+		std::vector<glm::vec4> m_viewLights;
+
+		// Tile extents at a slice's near and far depth as tan of the angle from the view axis
+		std::vector<float> m_tileEdgesX;
+		std::vector<float> m_tileEdgesY;
+
+		void BinSlice(int slice, float nearPlane, float farPlane);
+	public:
+		// Clusters across, down and in depth
+		static const int KClustersX{ 16 };
+		static const int KClustersY{ 9 };
+		static const int KClustersZ{ 24 };
+
+		// Indices are 16 bit, lights past this or past what the light texture buffer holds are ignored
+		static const size_t KMaxLights{ 65535 };
+
+		LightGrid() = default;
+		~LightGrid();
+
+		LightGrid(const LightGrid&) = delete;
+		LightGrid& operator=(const LightGrid&) = delete;
+
+		// Reads the driver's texture buffer limit, call with a GL context current before the first Build
+		void Initialise();
+
+		// Works out the lights in each cluster for this camera, lights are in world space
+		// projection must be a symmetric perspective one with these planes
+		void Build(const std::vector<PointLight>& lights, const glm::mat4& viewXform, const glm::mat4& projectionXform,
+			float nearPlane, float farPlane, int framebufferWidth, int framebufferHeight, const glm::vec3& ambientColour);
+
+		// Sends the lists built by the last Build to the texture buffers
+		void Upload();
+
+		// Binds the light, cluster and index texture buffers to the units the shaders sample them on
+		void Bind(GLint lightUnit, GLint clusterUnit, GLint indexUnit) const;
+
+		// For the Lights uniform block, valid after Build
+		const LightGridUniforms& GetUniforms() const { return m_uniforms; }
+
+		// Per cluster offset into and count of the light indices, x fastest then y then slice
+		const std::vector<glm::uvec2>& GetClusters() const { return m_clusters; }
+		const std::vector<uint16_t>& GetLightIndices() const { return m_indices; }
+	};
+}
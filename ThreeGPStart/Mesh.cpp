@@ -252,7 +252,8 @@ namespace Helpers
 		for (size_t i = 0; i < node->mNumMeshes; i++)
 			newNode->meshIndices.push_back(node->mMeshes[i]);
 
-		newNode->transform = *((glm::mat4*) & node->mTransformation);
+		// Assimp matrices are row major, glm ones column major
+		newNode->transform = glm::transpose(*((glm::mat4*) & node->mTransformation));
 
 		if (node->mMetaData)
 			EsOutput("Ignoring: node has metadata");
@@ -0,0 +1,99 @@
+#include "Noise.h"
+
+namespace Helpers
+{
+	// Integer hash with good avalanche so neighbouring lattice points get unrelated gradients
+	static unsigned int HashLattice(int x, int z, unsigned int seed)
+	{
+		unsigned int h{ seed };
+		h ^= (unsigned int)x * 0x8da6b343u;
+		h ^= (unsigned int)z * 0xd8163841u;
+		h ^= h >> 16;
+		h *= 0x7feb352du;
+		h ^= h >> 15;
+		h *= 0x846ca68bu;
+		h ^= h >> 16;
+		return h;
+	}
+
+	// Quintic fade so the noise has continuous first and second derivatives
+	static float Fade(float t)
+	{
+		return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+	}
+
+	// Unit gradient at a lattice point picked from 16 evenly spaced directions
+	glm::vec2 Noise::Gradient(int x, int z) const
+	{
+		static const float KTwoPi = 6.28318530718f;
+		float angle{ (HashLattice(x, z, m_seed) & 15u) * (KTwoPi / 16.0f) };
+		return glm::vec2(std::cos(angle), std::sin(angle));
+	}
+
+	// Single octave of gradient (Perlin style) noise, roughly -1 to 1
+	float Noise::Gradient2D(float x, float z) const
+	{
+		float floorX{ std::floor(x) };
+		float floorZ{ std::floor(z) };
+		int x0{ (int)floorX };
+		int z0{ (int)floorZ };
+		float fx{ x - floorX };
+		float fz{ z - floorZ };
+
+		float n00{ glm::dot(Gradient(x0, z0), glm::vec2(fx, fz)) };
+		float n10{ glm::dot(Gradient(x0 + 1, z0), glm::vec2(fx - 1.0f, fz)) };
+		float n01{ glm::dot(Gradient(x0, z0 + 1), glm::vec2(fx, fz - 1.0f)) };
+		float n11{ glm::dot(Gradient(x0 + 1, z0 + 1), glm::vec2(fx - 1.0f, fz - 1.0f)) };
+
+		float u{ Fade(fx) };
+		float v{ Fade(fz) };
+
+		// Scaled so the result uses most of the -1 to 1 range
+		return glm::mix(glm::mix(n00, n10, u), glm::mix(n01, n11, u), v) * 1.41421356f;
+	}
+
+	// Fractal Brownian motion normalised to roughly -1 to 1
+	float Noise::Fbm(float x, float z, int octaves, float lacunarity, float gain) const
+	{
+		float sum{ 0 };
+		float amplitude{ 1.0f };
+		float totalAmplitude{ 0 };
+
+		for (int i = 0; i < octaves; i++)
+		{
+			// Offsetting each octave stops the lattice points lining up at the origin
+			sum += amplitude * Gradient2D(x + i * 17.31f, z - i * 11.77f);
+			totalAmplitude += amplitude;
+			x *= lacunarity;
+			z *= lacunarity;
+			amplitude *= gain;
+		}
+
+		return totalAmplitude > 0 ? sum / totalAmplitude : 0.0f;
+	}
+
+	// Ridged multifractal, each octave is weighted by the previous one so detail collects on the ridges
+	float Noise::Ridged(float x, float z, int octaves, float lacunarity, float gain) const
+	{
+		float sum{ 0 };
+		float amplitude{ 1.0f };
+		float totalAmplitude{ 0 };
+		float weight{ 1.0f };
+
+		for (int i = 0; i < octaves; i++)
+		{
+			float ridge{ 1.0f - std::abs(Gradient2D(x + i * 17.31f, z - i * 11.77f)) };
+			ridge *= ridge;
+			ridge *= weight;
+			weight = glm::clamp(ridge * 2.0f, 0.0f, 1.0f);
+
+			sum += ridge * amplitude;
+			totalAmplitude += amplitude;
+			x *= lacunarity;
+			z *= lacunarity;
+			amplitude *= gain;
+		}
+
+		return totalAmplitude > 0 ? sum / totalAmplitude : 0.0f;
+	}
+}
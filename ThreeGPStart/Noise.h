@@ -0,0 +1,28 @@
+#pragma once
+
+#include "ExternalLibraryHeaders.h"
+
+namespace Helpers
+{
+	// Deterministic 2D gradient noise. The same seed and position always give the same value on
+	// any thread, there are no tables to set up so it is safe to call from worker threads.
+	class Noise
+	{
+	private:
+		unsigned int m_seed{ 0 };
+
+		glm::vec2 Gradient(int x, int z) const;
+	public:
+		explicit Noise(unsigned int seed = 0) : m_seed(seed) {}
+
+		// Single octave of gradient (Perlin style) noise, roughly -1 to 1
+		float Gradient2D(float x, float z) const;
+
+		// Fractal Brownian motion, octaves of noise each at lacunarity times the frequency and gain times the amplitude
+		// Result is normalised to roughly -1 to 1
+		float Fbm(float x, float z, int octaves, float lacunarity = 2.0f, float gain = 0.5f) const;
+
+		// Ridged multifractal, sharp crests where the noise crosses zero, roughly 0 to 1
+		float Ridged(float x, float z, int octaves, float lacunarity = 2.0f, float gain = 0.5f) const;
+	};
+}
@@ -0,0 +1,235 @@
+#include "OcclusionBuffer.h"
+#include "ThreadPool.h"
+
+#ifdef HELPERS_FRUSTUM_SSE
+#include <xmmintrin.h>
+#endif
+
+namespace Helpers
+{
+	// Sizes are rounded up to whole tiles
+	void OcclusionBuffer::Resize(int width, int height)
+	{
+		m_tilesX = std::max((width + KTileSize - 1) / KTileSize, 1);
+		m_tilesY = std::max((height + KTileSize - 1) / KTileSize, 1);
+		m_width = m_tilesX * KTileSize;
+		m_height = m_tilesY * KTileSize;
+
+		m_depth.assign((size_t)m_width * m_height, 1.0f);
+		m_tileMaxDepth.assign((size_t)m_tilesX * m_tilesY, 1.0f);
+		m_bandTriangles.resize(m_tilesY);
+	}
+
+	// Empties the buffer and sets the camera for the next occluders and tests
+	void OcclusionBuffer::Clear(const glm::mat4& viewProjection)
+	{
+		m_viewProjection = viewProjection;
+		std::fill(m_depth.begin(), m_depth.end(), 1.0f);
+		std::fill(m_tileMaxDepth.begin(), m_tileMaxDepth.end(), 1.0f);
+	}
+
+	// Draws world space triangles that hide whatever is behind them
+	void OcclusionBuffer::Rasterise(const std::vector<glm::vec3>& vertices, const std::vector<GLuint>& indices)
+	{
+		if (m_width == 0)
+			return;
+
+		m_clipVertices.resize(vertices.size());
+		for (size_t i = 0; i < vertices.size(); i++)
+			m_clipVertices[i] = m_viewProjection * glm::vec4(vertices[i], 1.0f);
+
+		m_triangles.clear();
+		for (auto& band : m_bandTriangles)
+			band.clear();
+
+		// Set up each triangle once and put it in the bands it touches
+		for (size_t i = 0; i + 2 < indices.size(); i += 3)
+		{
+			glm::vec3 screen[3];
+			bool usable{ true };
+			for (int corner = 0; corner < 3; corner++)
+			{
+				const glm::vec4& clip{ m_clipVertices[indices[i + corner]] };
+
+				// Not clipped, leaving out an occluder crossing the near plane only means hiding less
+				if (clip.w <= 0 || clip.z < -clip.w)
+				{
+					usable = false;
+					break;
+				}
+
+				glm::vec3 ndc{ glm::vec3(clip) / clip.w };
+				screen[corner] = glm::vec3((ndc.x * 0.5f + 0.5f) * m_width, (ndc.y * 0.5f + 0.5f) * m_height, ndc.z);
+			}
+			if (!usable)
+				continue;
+
+			const glm::vec3& p0{ screen[0] };
+			const glm::vec3& p1{ screen[1] };
+			const glm::vec3& p2{ screen[2] };
+
+			// Back faces and slivers are skipped
+			float area{ (p1.x - p0.x) * (p2.y - p0.y) - (p2.x - p0.x) * (p1.y - p0.y) };
+			if (area <= 0)
+				continue;
+
+			Triangle triangle;
+			triangle.minX = std::max((int)std::floor(std::min(std::min(p0.x, p1.x), p2.x)), 0);
+			triangle.maxX = std::min((int)std::ceil(std::max(std::max(p0.x, p1.x), p2.x)), m_width - 1);
+			triangle.minY = std::max((int)std::floor(std::min(std::min(p0.y, p1.y), p2.y)), 0);
+			triangle.maxY = std::min((int)std::ceil(std::max(std::max(p0.y, p1.y), p2.y)), m_height - 1);
+			if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+				continue;
+
+			// Edge functions are positive inside a counter clockwise triangle
+			triangle.edgeA = glm::vec3(p1.y - p2.y, p2.x - p1.x, p1.x * p2.y - p2.x * p1.y);
+			triangle.edgeB = glm::vec3(p2.y - p0.y, p0.x - p2.x, p2.x * p0.y - p0.x * p2.y);
+			triangle.edgeC = glm::vec3(p0.y - p1.y, p1.x - p0.x, p0.x * p1.y - p1.x * p0.y);
+
+			// Depth as a plane z = a x + b y + c
+			float a{ ((p1.z - p0.z) * (p2.y - p0.y) - (p2.z - p0.z) * (p1.y - p0.y)) / area };
+			float b{ ((p2.z - p0.z) * (p1.x - p0.x) - (p1.z - p0.z) * (p2.x - p0.x)) / area };
+			triangle.depth = glm::vec3(a, b, p0.z - a * p0.x - b * p0.y);
+
+			GLuint triangleIndex{ (GLuint)m_triangles.size() };
+			m_triangles.push_back(triangle);
+			for (int band = triangle.minY / KTileSize; band <= triangle.maxY / KTileSize; band++)
+				m_bandTriangles[band].push_back(triangleIndex);
+		}
+
+		// Bands share no pixels so need no locking
+		ThreadPool::Get().ParallelFor(m_tilesY, 1, [this](size_t begin, size_t end)
+		{
+			for (size_t band = begin; band < end; band++)
+				RasteriseBand((int)band);
+		});
+	}
+
+	void OcclusionBuffer::RasteriseBand(int band)
+	{
+		const int bandMinY{ band * KTileSize };
+		const int bandMaxY{ bandMinY + KTileSize - 1 };
+
+		for (GLuint triangleIndex : m_bandTriangles[band])
+		{
+			const Triangle& triangle{ m_triangles[triangleIndex] };
+			const int minY{ std::max(triangle.minY, bandMinY) };
+			const int maxY{ std::min(triangle.maxY, bandMaxY) };
+
+			// Four pixel groups start on a multiple of four so they never run past the end of a row
+			const int startX{ triangle.minX & ~3 };
+
+			for (int y = minY; y <= maxY; y++)
+			{
+				float* row{ &m_depth[(size_t)y * m_width] };
+				const float centreY{ y + 0.5f };
+
+#ifdef HELPERS_FRUSTUM_SSE
+				const __m128 laneOffsets{ _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f) };
+				const __m128 zero{ _mm_setzero_ps() };
+				auto edgeRow = [centreY](const glm::vec3& edge) { return _mm_set1_ps(edge.y * centreY + edge.z); };
+				const __m128 rowA{ edgeRow(triangle.edgeA) }, rowB{ edgeRow(triangle.edgeB) }, rowC{ edgeRow(triangle.edgeC) };
+				const __m128 rowDepth{ edgeRow(triangle.depth) };
+				const __m128 stepA{ _mm_set1_ps(triangle.edgeA.x) }, stepB{ _mm_set1_ps(triangle.edgeB.x) }, stepC{ _mm_set1_ps(triangle.edgeC.x) };
+				const __m128 stepDepth{ _mm_set1_ps(triangle.depth.x) };
+
+				for (int x = startX; x <= triangle.maxX; x += 4)
+				{
+					__m128 centreX{ _mm_add_ps(_mm_set1_ps((float)x), laneOffsets) };
+					__m128 inside{ _mm_and_ps(_mm_and_ps(
+						_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(stepA, centreX), rowA), zero),
+						_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(stepB, centreX), rowB), zero)),
+						_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(stepC, centreX), rowC), zero)) };
+					if (_mm_movemask_ps(inside) == 0)
+						continue;
+
+					__m128 depth{ _mm_add_ps(_mm_mul_ps(stepDepth, centreX), rowDepth) };
+					__m128 current{ _mm_loadu_ps(row + x) };
+					__m128 nearest{ _mm_min_ps(current, depth) };
+					_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, current)));
+				}
+#else
+				for (int x = startX; x <= triangle.maxX; x++)
+				{
+					glm::vec3 centre{ x + 0.5f, centreY, 1.0f };
+					if (glm::dot(triangle.edgeA, centre) < 0 || glm::dot(triangle.edgeB, centre) < 0 || glm::dot(triangle.edgeC, centre) < 0)
+						continue;
+
+					row[x] = std::min(row[x], glm::dot(triangle.depth, centre));
+				}
+#endif
+			}
+		}
+
+		// Farthest depth of each tile in the band
+		for (int tileX = 0; tileX < m_tilesX; tileX++)
+		{
+			float maxDepth{ 0 };
+			for (int y = bandMinY; y <= bandMaxY; y++)
+			{
+				const float* row{ &m_depth[(size_t)y * m_width + tileX * KTileSize] };
+				maxDepth = std::max(maxDepth, *std::max_element(row, row + KTileSize));
+			}
+			m_tileMaxDepth[(size_t)band * m_tilesX + tileX] = maxDepth;
+		}
+	}
+
+	// False if every pixel the box covers already has an occluder in front of the whole box
+	bool OcclusionBuffer::IsBoxVisible(const BoundingBox& box) const
+	{
+		if (m_width == 0 || box.IsEmpty())
+			return true;
+
+		// Screen rectangle and nearest depth of the box's corners
+		glm::vec2 screenMin{ FLT_MAX }, screenMax{ -FLT_MAX };
+		float nearestDepth{ FLT_MAX };
+		for (int corner = 0; corner < 8; corner++)
+		{
+			glm::vec3 position{ (corner & 1) ? box.max.x : box.min.x, (corner & 2) ? box.max.y : box.min.y, (corner & 4) ? box.max.z : box.min.z };
+			glm::vec4 clip{ m_viewProjection * glm::vec4(position, 1.0f) };
+
+			// Reaches behind the camera, the projection is meaningless so assume it can be seen
+			if (clip.w <= 0 || clip.z < -clip.w)
+				return true;
+
+			glm::vec3 ndc{ glm::vec3(clip) / clip.w };
+			screenMin = glm::min(screenMin, glm::vec2(ndc));
+			screenMax = glm::max(screenMax, glm::vec2(ndc));
+			nearestDepth = std::min(nearestDepth, ndc.z);
+		}
+
+		int minX{ std::max((int)std::floor((screenMin.x * 0.5f + 0.5f) * m_width), 0) };
+		int maxX{ std::min((int)std::floor((screenMax.x * 0.5f + 0.5f) * m_width), m_width - 1) };
+		int minY{ std::max((int)std::floor((screenMin.y * 0.5f + 0.5f) * m_height), 0) };
+		int maxY{ std::min((int)std::floor((screenMax.y * 0.5f + 0.5f) * m_height), m_height - 1) };
+		if (minX > maxX || minY > maxY)
+			return false;
+
+		for (int tileY = minY / KTileSize; tileY <= maxY / KTileSize; tileY++)
+		{
+			for (int tileX = minX / KTileSize; tileX <= maxX / KTileSize; tileX++)
+			{
+				// Everything in the tile is nearer than the box
+				if (m_tileMaxDepth[(size_t)tileY * m_tilesX + tileX] < nearestDepth)
+					continue;
+
+				int tileMinX{ std::max(minX, tileX * KTileSize) };
+				int tileMaxX{ std::min(maxX, tileX * KTileSize + KTileSize - 1) };
+				int tileMinY{ std::max(minY, tileY * KTileSize) };
+				int tileMaxY{ std::min(maxY, tileY * KTileSize + KTileSize - 1) };
+
+				for (int y = tileMinY; y <= tileMaxY; y++)
+				{
+					const float* row{ &m_depth[(size_t)y * m_width] };
+					for (int x = tileMinX; x <= tileMaxX; x++)
+					{
+						if (row[x] >= nearestDepth)
+							return true;
+					}
+				}
+			}
+		}
+
+		return false;
+	}
+}
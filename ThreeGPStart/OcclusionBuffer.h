@@ -0,0 +1,63 @@
+#pragma once
+
+#include "ExternalLibraryHeaders.h"
+#include "Frustum.h"
+
+namespace Helpers
+{
+	// Small CPU depth buffer that occluders such as the terrain are drawn into, so objects hidden
+	// behind them can be skipped before anything is sent to the GPU. Nothing is read back from GL
+	// so it works without a context too.
+	// Rows are split into bands rasterised in parallel on the thread pool, four pixels at a time with SSE.
+	// Each tile keeps its farthest depth so boxes behind a fully covered tile are rejected without
+	// looking at its pixels. Depths are NDC z, 1 at the far plane.
+	class OcclusionBuffer
+	{
+	private:
+		// Screen space triangle ready to rasterise, edges and depth are planes in pixel coordinates
+		struct Triangle
+		{
+			glm::vec3 edgeA, edgeB, edgeC;
+			glm::vec3 depth;
+			int minX, maxX, minY, maxY;
+		};
+
+		int m_width{ 0 };
+		int m_height{ 0 };
+		int m_tilesX{ 0 };
+		int m_tilesY{ 0 };
+
+		std::vector<float> m_depth;
+		std::vector<float> m_tileMaxDepth;
+		glm::mat4 m_viewProjection{ 1.0f };
+
+		// Reused between calls, the triangles overlapping each band of tile rows
+		std::vector<Triangle> m_triangles;
+		std::vector<std::vector<GLuint>> m_bandTriangles;
+		std::vector<glm::vec4> m_clipVertices;
+
+		void RasteriseBand(int band);
+	public:
+		// Pixels per tile side, one band is a row of tiles
+		static const int KTileSize{ 16 };
+
+		// Sizes are rounded up to whole tiles
+		void Resize(int width, int height);
+
+		int Width() const { return m_width; }
+		int Height() const { return m_height; }
+
+		// Empties the buffer and sets the camera for the next occluders and tests
+		void Clear(const glm::mat4& viewProjection);
+
+		// Draws world space triangles that hide whatever is behind them, they must not stick out
+		// beyond the real geometry. Front faces are counter clockwise as with GL.
+		void Rasterise(const std::vector<glm::vec3>& vertices, const std::vector<GLuint>& indices);
+
+		// False if every pixel the box covers already has an occluder in front of the whole box
+		bool IsBoxVisible(const BoundingBox& box) const;
+
+		// For debugging, the buffer's depths with row 0 at the bottom
+		const std::vector<float>& GetDepths() const { return m_depth; }
+	};
+}
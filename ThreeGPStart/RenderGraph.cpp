@@ -0,0 +1,486 @@
+#include "RenderGraph.h"
+
+namespace Helpers
+{
+	static bool IsDepthFormat(GLenum internalFormat)
+	{
+		return internalFormat == GL_DEPTH_COMPONENT16 || internalFormat == GL_DEPTH_COMPONENT24 || internalFormat == GL_DEPTH_COMPONENT32F
+			|| internalFormat == GL_DEPTH24_STENCIL8 || internalFormat == GL_DEPTH32F_STENCIL8;
+	}
+
+	static bool HasStencil(GLenum internalFormat)
+	{
+		return internalFormat == GL_DEPTH24_STENCIL8 || internalFormat == GL_DEPTH32F_STENCIL8;
+	}
+
+	void RenderGraph::PassBuilder::Read(RenderResource resource)
+	{
+		m_graph.m_passes[m_pass].reads.push_back(resource);
+	}
+
+	// Cleared before the first pass to write it unless clearFirst is false
+	void RenderGraph::PassBuilder::Write(RenderResource resource, bool clearFirst)
+	{
+		m_graph.m_passes[m_pass].writes.push_back(resource);
+		m_graph.m_passes[m_pass].clearWrites.push_back(clearFirst);
+	}
+
+	void RenderGraph::PassBuilder::SetSideEffect()
+	{
+		m_graph.m_passes[m_pass].sideEffect = true;
+	}
+
+	RenderGraph::~RenderGraph()
+	{
+		DeleteFramebuffers();
+		for (const PhysicalTexture& texture : m_textures)
+			glDeleteTextures(1, &texture.texture);
+	}
+
+	RenderResource RenderGraph::ImportBackbuffer(const std::string& name)
+	{
+		Resource resource;
+		resource.name = name;
+		resource.imported = true;
+		m_resources.push_back(resource);
+		m_compiled = false;
+		return (RenderResource)m_resources.size() - 1;
+	}
+
+	RenderResource RenderGraph::CreateTexture(const std::string& name, const RenderTextureDesc& desc)
+	{
+		Resource resource;
+		resource.name = name;
+		resource.desc = desc;
+		m_resources.push_back(resource);
+		m_compiled = false;
+		return (RenderResource)m_resources.size() - 1;
+	}
+
+	void RenderGraph::AddPass(const std::string& name, const std::function<void(PassBuilder& builder)>& setup, const ExecuteFunc& execute)
+	{
+		Pass pass;
+		pass.name = name;
+		pass.execute = execute;
+		m_passes.push_back(pass);
+
+		PassBuilder builder(*this, m_passes.size() - 1);
+		setup(builder);
+		m_compiled = false;
+	}
+
+	// Forgets the passes and resources, real textures are kept for the next compile to reuse
+	void RenderGraph::Reset()
+	{
+		DeleteFramebuffers();
+		m_passes.clear();
+		m_resources.clear();
+		m_order.clear();
+		m_compiled = false;
+	}
+
+	bool RenderGraph::Compile(int backbufferWidth, int backbufferHeight)
+	{
+		DeleteFramebuffers();
+		m_order.clear();
+		m_compiled = false;
+		m_backbufferWidth = backbufferWidth;
+		m_backbufferHeight = backbufferHeight;
+
+		for (Resource& resource : m_resources)
+		{
+			if (resource.imported)
+			{
+				resource.width = backbufferWidth;
+				resource.height = backbufferHeight;
+			}
+			else
+			{
+				resource.width = resource.desc.width > 0 ? resource.desc.width : std::max((int)(backbufferWidth * resource.desc.scale), 1);
+				resource.height = resource.desc.height > 0 ? resource.desc.height : std::max((int)(backbufferHeight * resource.desc.scale), 1);
+			}
+			resource.texture = 0;
+		}
+
+		OrderPasses();
+		AllocateTextures();
+		if (!CreateFramebuffers())
+			return false;
+
+		m_compiled = true;
+		return true;
+	}
+
+	// A pass depends on the last earlier pass to write what it reads or writes, and when it writes
+	// something on every pass that read the previous contents, so running in any order that respects
+	// those gives the same result as declaration order
+	void RenderGraph::OrderPasses()
+	{
+		const size_t KNoPass{ SIZE_MAX };
+		std::vector<size_t> lastWriter(m_resources.size(), KNoPass);
+		std::vector<std::vector<size_t>> readersSinceWrite(m_resources.size());
+
+		for (size_t p = 0; p < m_passes.size(); p++)
+		{
+			Pass& pass{ m_passes[p] };
+			pass.dependencies.clear();
+
+			for (RenderResource resource : pass.reads)
+			{
+				if (lastWriter[resource] != KNoPass)
+					pass.dependencies.push_back(lastWriter[resource]);
+			}
+			for (RenderResource resource : pass.writes)
+			{
+				if (lastWriter[resource] != KNoPass)
+					pass.dependencies.push_back(lastWriter[resource]);
+				for (size_t reader : readersSinceWrite[resource])
+				{
+					if (reader != p)
+						pass.dependencies.push_back(reader);
+				}
+			}
+			std::sort(pass.dependencies.begin(), pass.dependencies.end());
+			pass.dependencies.erase(std::unique(pass.dependencies.begin(), pass.dependencies.end()), pass.dependencies.end());
+
+			for (RenderResource resource : pass.reads)
+				readersSinceWrite[resource].push_back(p);
+			for (RenderResource resource : pass.writes)
+			{
+				lastWriter[resource] = p;
+				readersSinceWrite[resource].clear();
+			}
+		}
+
+		std::vector<bool> live;
+		CullPasses(live);
+
+		// Of the passes ready to run, prefer one reading what the last pass wrote so transient
+		// textures are freed sooner and more of them can share, otherwise keep declaration order
+		std::vector<size_t> waitingOn(m_passes.size(), 0);
+		std::vector<bool> scheduled(m_passes.size(), false);
+		for (size_t p = 0; p < m_passes.size(); p++)
+		{
+			for (size_t dependency : m_passes[p].dependencies)
+				waitingOn[p] += live[dependency] ? 1 : 0;
+		}
+
+		size_t numLive{ (size_t)std::count(live.begin(), live.end(), true) };
+		while (m_order.size() < numLive)
+		{
+			size_t chosen{ KNoPass };
+			for (size_t p = 0; p < m_passes.size(); p++)
+			{
+				if (!live[p] || scheduled[p] || waitingOn[p] > 0)
+					continue;
+
+				if (chosen == KNoPass)
+					chosen = p;
+
+				if (!m_order.empty())
+				{
+					const Pass& previous{ m_passes[m_order.back()] };
+					bool readsPrevious{ std::any_of(m_passes[p].reads.begin(), m_passes[p].reads.end(), [&previous](RenderResource resource)
+						{ return std::find(previous.writes.begin(), previous.writes.end(), resource) != previous.writes.end(); }) };
+					if (readsPrevious)
+					{
+						chosen = p;
+						break;
+					}
+				}
+			}
+
+			// Dependencies only ever point back to earlier passes, so something is always ready
+			scheduled[chosen] = true;
+			m_order.push_back(chosen);
+			for (size_t p = 0; p < m_passes.size(); p++)
+			{
+				if (live[p] && !scheduled[p] && std::find(m_passes[p].dependencies.begin(), m_passes[p].dependencies.end(), chosen) != m_passes[p].dependencies.end())
+					waitingOn[p]--;
+			}
+		}
+	}
+
+	// Passes writing the backbuffer or with side effects are kept, then everything they depend on
+	void RenderGraph::CullPasses(std::vector<bool>& live) const
+	{
+		live.assign(m_passes.size(), false);
+		for (size_t p = 0; p < m_passes.size(); p++)
+		{
+			const Pass& pass{ m_passes[p] };
+			live[p] = pass.sideEffect || std::any_of(pass.writes.begin(), pass.writes.end(), [this](RenderResource resource) { return m_resources[resource].imported; });
+		}
+
+		// Dependencies are earlier passes so one backwards walk reaches all of them
+		for (size_t p = m_passes.size(); p-- > 0;)
+		{
+			if (!live[p])
+				continue;
+			for (size_t dependency : m_passes[p].dependencies)
+				live[dependency] = true;
+		}
+	}
+
+	// Each transient resource holds a real texture from the first live pass using it to the last, then
+	// hands it on to a later resource of the same size and format
+	void RenderGraph::AllocateTextures()
+	{
+		const size_t KUnused{ SIZE_MAX };
+		std::vector<size_t> firstUse(m_resources.size(), KUnused);
+		std::vector<size_t> lastUse(m_resources.size(), KUnused);
+		for (size_t position = 0; position < m_order.size(); position++)
+		{
+			const Pass& pass{ m_passes[m_order[position]] };
+			for (const std::vector<RenderResource>* resources : { &pass.reads, &pass.writes })
+			{
+				for (RenderResource resource : *resources)
+				{
+					if (firstUse[resource] == KUnused)
+						firstUse[resource] = position;
+					lastUse[resource] = position;
+				}
+			}
+		}
+
+		for (PhysicalTexture& texture : m_textures)
+			texture.used = false;
+		std::vector<bool> textureKept(m_textures.size(), false);
+		std::vector<size_t> resourceTexture(m_resources.size(), KUnused);
+
+		for (size_t position = 0; position < m_order.size(); position++)
+		{
+			for (size_t r = 0; r < m_resources.size(); r++)
+			{
+				Resource& resource{ m_resources[r] };
+				if (resource.imported || firstUse[r] != position)
+					continue;
+
+				size_t chosen{ KUnused };
+				for (size_t t = 0; t < m_textures.size(); t++)
+				{
+					const PhysicalTexture& texture{ m_textures[t] };
+					if (!texture.used && texture.internalFormat == resource.desc.internalFormat && texture.width == resource.width && texture.height == resource.height)
+					{
+						chosen = t;
+						break;
+					}
+				}
+
+				if (chosen == KUnused)
+				{
+					PhysicalTexture texture;
+					texture.internalFormat = resource.desc.internalFormat;
+					texture.width = resource.width;
+					texture.height = resource.height;
+
+					const bool depth{ IsDepthFormat(texture.internalFormat) };
+					const GLenum format{ (GLenum)(depth ? (HasStencil(texture.internalFormat) ? GL_DEPTH_STENCIL : GL_DEPTH_COMPONENT) : GL_RGBA) };
+					const GLenum type{ (GLenum)(depth ? (HasStencil(texture.internalFormat) ? GL_UNSIGNED_INT_24_8 : GL_FLOAT) : GL_UNSIGNED_BYTE) };
+
+					glGenTextures(1, &texture.texture);
+					glBindTexture(GL_TEXTURE_2D, texture.texture);
+					glTexImage2D(GL_TEXTURE_2D, 0, texture.internalFormat, texture.width, texture.height, 0, format, type, nullptr);
+					glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, depth ? GL_NEAREST : GL_LINEAR);
+					glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, depth ? GL_NEAREST : GL_LINEAR);
+					glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+					glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+					glBindTexture(GL_TEXTURE_2D, 0);
+
+					chosen = m_textures.size();
+					m_textures.push_back(texture);
+					textureKept.push_back(false);
+				}
+
+				m_textures[chosen].used = true;
+				textureKept[chosen] = true;
+				resourceTexture[r] = chosen;
+				resource.texture = m_textures[chosen].texture;
+			}
+
+			// Only after this pass's new resources have theirs, a texture is never shared within a pass
+			for (size_t r = 0; r < m_resources.size(); r++)
+			{
+				if (lastUse[r] == position && resourceTexture[r] != KUnused)
+					m_textures[resourceTexture[r]].used = false;
+			}
+		}
+
+		// Textures from an earlier compile nothing needs now, e.g. after a resize
+		for (size_t t = m_textures.size(); t-- > 0;)
+		{
+			if (textureKept[t])
+				continue;
+			glDeleteTextures(1, &m_textures[t].texture);
+			m_textures.erase(m_textures.begin() + t);
+		}
+	}
+
+	bool RenderGraph::CreateFramebuffers()
+	{
+		std::vector<bool> written(m_resources.size(), false);
+
+		for (size_t p : m_order)
+		{
+			Pass& pass{ m_passes[p] };
+			pass.framebuffer = 0;
+			pass.width = 0;
+			pass.height = 0;
+			pass.clearMask = 0;
+			pass.clearColourAttachments.clear();
+
+			bool writesBackbuffer{ false };
+			bool writesTexture{ false };
+			std::vector<GLenum> drawBuffers;
+
+			for (size_t w = 0; w < pass.writes.size(); w++)
+			{
+				RenderResource r{ pass.writes[w] };
+				const Resource& resource{ m_resources[r] };
+				const bool clear{ pass.clearWrites[w] && !written[r] };
+				written[r] = true;
+
+				if (pass.width == 0)
+				{
+					pass.width = resource.width;
+					pass.height = resource.height;
+				}
+				else if (resource.width != pass.width || resource.height != pass.height)
+				{
+					std::cerr << "ERROR: render pass " << pass.name << " writes " << resource.name << " which is a different size to its other targets" << std::endl;
+					return false;
+				}
+
+				if (resource.imported)
+				{
+					writesBackbuffer = true;
+					if (clear)
+					{
+						pass.clearColourAttachments.push_back(0);
+						pass.clearMask |= GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT;
+					}
+					continue;
+				}
+
+				writesTexture = true;
+				if (IsDepthFormat(resource.desc.internalFormat))
+				{
+					if (clear)
+						pass.clearMask |= GL_DEPTH_BUFFER_BIT | (HasStencil(resource.desc.internalFormat) ? GL_STENCIL_BUFFER_BIT : 0);
+				}
+				else
+				{
+					if (clear)
+						pass.clearColourAttachments.push_back((GLenum)drawBuffers.size());
+					drawBuffers.push_back(GL_COLOR_ATTACHMENT0 + (GLenum)drawBuffers.size());
+				}
+			}
+
+			if (writesBackbuffer && writesTexture)
+			{
+				std::cerr << "ERROR: render pass " << pass.name << " writes both the backbuffer and textures" << std::endl;
+				return false;
+			}
+
+			if (!writesTexture)
+			{
+				// Backbuffer passes, and ones that only read draw nowhere so any size does
+				if (pass.width == 0)
+				{
+					pass.width = m_backbufferWidth;
+					pass.height = m_backbufferHeight;
+				}
+				continue;
+			}
+
+			glGenFramebuffers(1, &pass.framebuffer);
+			glBindFramebuffer(GL_FRAMEBUFFER, pass.framebuffer);
+
+			GLenum colourAttachment{ GL_COLOR_ATTACHMENT0 };
+			for (RenderResource r : pass.writes)
+			{
+				const Resource& resource{ m_resources[r] };
+				GLenum attachment{ colourAttachment };
+				if (IsDepthFormat(resource.desc.internalFormat))
+					attachment = HasStencil(resource.desc.internalFormat) ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT;
+				else
+					colourAttachment++;
+
+				glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, resource.texture, 0);
+			}
+
+			if (drawBuffers.empty())
+			{
+				glDrawBuffer(GL_NONE);
+				glReadBuffer(GL_NONE);
+			}
+			else
+			{
+				glDrawBuffers((GLsizei)drawBuffers.size(), drawBuffers.data());
+			}
+
+			GLenum status{ glCheckFramebufferStatus(GL_FRAMEBUFFER) };
+			glBindFramebuffer(GL_FRAMEBUFFER, 0);
+			if (status != GL_FRAMEBUFFER_COMPLETE)
+			{
+				std::cerr << "ERROR: render pass " << pass.name << " framebuffer is incomplete, status " << status << std::endl;
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	void RenderGraph::DeleteFramebuffers()
+	{
+		for (Pass& pass : m_passes)
+		{
+			if (pass.framebuffer)
+				glDeleteFramebuffers(1, &pass.framebuffer);
+			pass.framebuffer = 0;
+		}
+	}
+
+	// Runs the live passes in order, leaves the default framebuffer bound
+	void RenderGraph::Execute() const
+	{
+		if (!m_compiled)
+			return;
+
+		const GLfloat KClearColour[4]{ 0, 0, 0, 0 };
+
+		for (size_t p : m_order)
+		{
+			const Pass& pass{ m_passes[p] };
+			glBindFramebuffer(GL_FRAMEBUFFER, pass.framebuffer);
+			glViewport(0, 0, pass.width, pass.height);
+
+			if (pass.clearMask || !pass.clearColourAttachments.empty())
+			{
+				// Clears are masked like draws, a previous pass may have left writes off
+				glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+				glDepthMask(GL_TRUE);
+				for (GLenum drawBuffer : pass.clearColourAttachments)
+					glClearBufferfv(GL_COLOR, (GLint)drawBuffer, KClearColour);
+				if (pass.clearMask)
+					glClear(pass.clearMask);
+			}
+
+			pass.execute(*this);
+		}
+
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+	std::vector<std::string> RenderGraph::GetPassOrder() const
+	{
+		std::vector<std::string> names;
+		for (size_t p : m_order)
+			names.push_back(m_passes[p].name);
+		return names;
+	}
+
+	size_t RenderGraph::NumTextures() const
+	{
+		return m_textures.size();
+	}
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include "ExternalLibraryHeaders.h"
+
+#include <functional>
+
+namespace Helpers
+{
+	// Index of a resource in a RenderGraph
+	using RenderResource = GLuint;
+	const RenderResource KNoRenderResource = 0xFFFFFFFF;
+
+	// Size and format of a texture that only lives while the graph runs
+	struct RenderTextureDesc
+	{
+		GLenum internalFormat{ GL_RGBA8 };
+
+		// Fraction of the backbuffer size, unless width and height are set
+		float scale{ 1.0f };
+		int width{ 0 };
+		int height{ 0 };
+	};
+
+	// The frame as a list of passes, each declaring the resources it reads and writes
+	// Compile works out an order from those, culls passes nothing uses the output of and gives each
+	// transient texture a real one only between its first and last use, so textures whose lifetimes
+	// do not overlap share memory. Passes writing transient textures draw into a framebuffer built
+	// once per compile, ones writing the backbuffer draw to the default framebuffer.
+	// Meant to be declared and compiled again only when the passes or the size change, executing
+	// a compiled graph costs no more than binding each pass's framebuffer.
+	class RenderGraph
+	{
+	public:
+		// Handed to a pass's setup function to declare what it uses
+		class PassBuilder
+		{
+		private:
+			RenderGraph& m_graph;
+			size_t m_pass;
+		public:
+			PassBuilder(RenderGraph& graph, size_t pass) : m_graph(graph), m_pass(pass) {}
+
+			void Read(RenderResource resource);
+
+			// Cleared before the first pass to write it unless clearFirst is false for a pass that
+			// covers every pixel
+			void Write(RenderResource resource, bool clearFirst = true);
+
+			// Kept even when nothing reads what it writes, e.g. for reading back or timing
+			void SetSideEffect();
+		};
+
+		using ExecuteFunc = std::function<void(const RenderGraph& graph)>;
+	private:
+		struct Resource
+		{
+			std::string name;
+			RenderTextureDesc desc;
+			bool imported{ false };
+
+			// Set by Compile
+			int width{ 0 };
+			int height{ 0 };
+			GLuint texture{ 0 };
+		};
+
+		struct Pass
+		{
+			std::string name;
+			ExecuteFunc execute;
+			std::vector<RenderResource> reads;
+			std::vector<RenderResource> writes;
+			std::vector<bool> clearWrites;
+			bool sideEffect{ false };
+
+			// Set by Compile, passes that must run first and what to clear before running
+			std::vector<size_t> dependencies;
+			GLuint framebuffer{ 0 };
+			int width{ 0 };
+			int height{ 0 };
+			GLbitfield clearMask{ 0 };
+			std::vector<GLenum> clearColourAttachments;
+		};
+
+		// A real texture, shared in turn by transient resources of the same size and format
+		struct PhysicalTexture
+		{
+			GLuint texture{ 0 };
+			GLenum internalFormat{ 0 };
+			int width{ 0 };
+			int height{ 0 };
+			bool used{ false };
+		};
+
+		std::vector<Resource> m_resources;
+		std::vector<Pass> m_passes;
+		std::vector<PhysicalTexture> m_textures;
+
+		// Live passes in the order Execute runs them
+		std::vector<size_t> m_order;
+		bool m_compiled{ false };
+		int m_backbufferWidth{ 0 };
+		int m_backbufferHeight{ 0 };
+
+		void OrderPasses();
+		void CullPasses(std::vector<bool>& live) const;
+		void AllocateTextures();
+		bool CreateFramebuffers();
+		void DeleteFramebuffers();
+	public:
+		RenderGraph() = default;
+		~RenderGraph();
+
+		RenderGraph(const RenderGraph&) = delete;
+		RenderGraph& operator=(const RenderGraph&) = delete;
+
+		// The default framebuffer's colour and depth together, passes writing it are always kept
+		RenderResource ImportBackbuffer(const std::string& name = "Backbuffer");
+
+		// A texture that only exists for the passes between its first write and last read
+		RenderResource CreateTexture(const std::string& name, const RenderTextureDesc& desc);
+
+		// Passes are declared in the order they would run in, a read sees the last write declared before it
+		void AddPass(const std::string& name, const std::function<void(PassBuilder& builder)>& setup, const ExecuteFunc& execute);
+
+		// Forgets the passes and resources, real textures are kept for the next compile to reuse
+		void Reset();
+
+		// Orders, culls and allocates for a backbuffer of this size. Returns false on error.
+		bool Compile(int backbufferWidth, int backbufferHeight);
+		bool IsCompiled() const { return m_compiled; }
+
+		// Runs the live passes in order, leaves the default framebuffer bound
+		void Execute() const;
+
+		// The real texture behind a transient resource, for a pass's execute function
+		GLuint GetTexture(RenderResource resource) const { return m_resources[resource].texture; }
+
+		// Names of the passes Execute runs, in order, for debugging
+		std::vector<std::string> GetPassOrder() const;
+
+		// Real textures allocated, transient resources sharing one count once
+		size_t NumTextures() const;
+	};
+}
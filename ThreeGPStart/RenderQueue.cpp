@@ -0,0 +1,99 @@
+#include "RenderQueue.h"
+
+namespace Helpers
+{
+	// Builds a key from its fields, depth is 0 at the camera and 1 at the far plane
+	std::uint64_t RenderQueue::MakeKey(RenderPass pass, GLuint program, GLuint material, GLuint VAO, float depth)
+	{
+		std::uint64_t quantisedDepth{ (std::uint64_t)(glm::clamp(depth, 0.0f, 1.0f) * 0xFFFFFF) };
+
+		return ((std::uint64_t)pass & 0xF) << 60 |
+			((std::uint64_t)program & 0xFF) << 52 |
+			((std::uint64_t)material & 0xFFFF) << 36 |
+			((std::uint64_t)VAO & 0xFFF) << 24 |
+			quantisedDepth;
+	}
+
+	// Empties the queue, the memory is kept for the next frame
+	void RenderQueue::Clear()
+	{
+		m_packets.clear();
+		m_entries.clear();
+		m_sorted = false;
+	}
+
+	// Sorts a pass by depth before state, takes effect for packets added after the call
+	void RenderQueue::SetFrontToBack(RenderPass pass, bool frontToBack)
+	{
+		std::uint32_t passBit{ 1u << (std::uint32_t)pass };
+		if (frontToBack)
+			m_frontToBackPasses |= passBit;
+		else
+			m_frontToBackPasses &= ~passBit;
+	}
+
+	void RenderQueue::Add(std::uint64_t key, const DrawPacket& packet)
+	{
+		const std::uint32_t pass{ (std::uint32_t)(key >> 60) };
+
+		// Pass stays on top, the 24 bits of depth swap places with the 36 bits of state below them
+		if (m_frontToBackPasses & (1u << pass))
+			key = (key & 0xF000000000000000ull) | (key & 0xFFFFFF) << 36 | (key >> 24 & 0xFFFFFFFFFull);
+
+		m_entries.push_back({ key, (std::uint32_t)m_packets.size() });
+		m_packets.push_back(packet);
+		m_packets.back().pass = (RenderPass)pass;
+		m_sorted = false;
+	}
+
+	// Adds every packet of another queue, e.g. one filled on another thread
+	void RenderQueue::Append(const RenderQueue& other)
+	{
+		const std::uint32_t firstPacket{ (std::uint32_t)m_packets.size() };
+		m_packets.insert(m_packets.end(), other.m_packets.begin(), other.m_packets.end());
+
+		m_entries.reserve(m_entries.size() + other.m_entries.size());
+		for (const SortEntry& entry : other.m_entries)
+			m_entries.push_back({ entry.key, entry.packet + firstPacket });
+		m_sorted = false;
+	}
+
+	// Least significant digit first radix sort on the keys, 8 bits a pass
+	// Only the small key and index pairs are moved, the packets stay where they were added
+	void RenderQueue::RadixSort()
+	{
+		const size_t count{ m_entries.size() };
+		if (count < 2)
+			return;
+
+		// Every digit's histogram in one read of the keys
+		size_t histograms[8][256]{};
+		for (const SortEntry& entry : m_entries)
+			for (int digit = 0; digit < 8; digit++)
+				histograms[digit][(entry.key >> (digit * 8)) & 0xFF]++;
+
+		m_scratch.resize(count);
+		for (int digit = 0; digit < 8; digit++)
+		{
+			size_t* histogram{ histograms[digit] };
+
+			// Skip digits every key shares, e.g. the pass when only one is in use
+			if (histogram[(m_entries[0].key >> (digit * 8)) & 0xFF] == count)
+				continue;
+
+			// Counts to starting positions
+			size_t offset{ 0 };
+			for (int i = 0; i < 256; i++)
+			{
+				size_t bucketSize{ histogram[i] };
+				histogram[i] = offset;
+				offset += bucketSize;
+			}
+
+			for (const SortEntry& entry : m_entries)
+				m_scratch[histogram[(entry.key >> (digit * 8)) & 0xFF]++] = entry;
+
+			m_entries.swap(m_scratch);
+		}
+	}
+}
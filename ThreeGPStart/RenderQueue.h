@@ -0,0 +1,92 @@
+#pragma once
+
+#include "ExternalLibraryHeaders.h"
+#include "ShaderProgram.h"
+
+#include <cstdint>
+
+namespace Helpers
+{
+	// Passes are drawn in this order, everything in one pass is drawn before the next starts
+	enum class RenderPass : std::uint8_t
+	{
+		Opaque
+	};
+
+	// Everything needed to make one indexed draw, the state it needs is compared with what is
+	// already bound when the queue is submitted so only the changes reach GL
+	struct DrawPacket
+	{
+		const ShaderProgram* program{ nullptr };
+		GLuint VAO{ 0 };
+		GLuint material{ 0 };
+
+		GLenum indexType{ GL_UNSIGNED_INT };
+		GLsizei numIndices{ 0 };
+		size_t firstIndexOffset{ 0 };
+		GLint baseVertex{ 0 };
+
+		// Instances come from the VAO's instance buffer, 0 draws one copy placed by modelXform
+		GLsizei numInstances{ 0 };
+		glm::mat4 modelXform{ 1.0f };
+
+		// Filled in from the key when the packet is added
+		RenderPass pass{ RenderPass::Opaque };
+	};
+
+	// Draw packets collected over a frame and sorted by a 64 bit key so draws sharing state end up together
+	// The key is, from the top bit down: pass (4 bits), program (8), material (16), VAO (12), depth (24).
+	// Ids are truncated to fit, two ids sharing a key value only cost a redundant bind, never a wrong draw.
+	// Passes set to front to back have the depth moved up to just below the pass as their packets are added.
+	class RenderQueue
+	{
+	private:
+		struct SortEntry
+		{
+			std::uint64_t key;
+			std::uint32_t packet;
+		};
+
+		std::vector<DrawPacket> m_packets;
+		std::vector<SortEntry> m_entries;
+		std::vector<SortEntry> m_scratch;
+		bool m_sorted{ false };
+
+		// Bit per RenderPass sorted nearest first rather than by state
+		std::uint32_t m_frontToBackPasses{ 0 };
+
+		// Least significant digit first radix sort on the keys, 8 bits a pass
+		void RadixSort();
+	public:
+		// Builds a key from its fields, depth is 0 at the camera and 1 at the far plane
+		static std::uint64_t MakeKey(RenderPass pass, GLuint program, GLuint material, GLuint VAO, float depth);
+
+		// Empties the queue, the memory is kept for the next frame
+		void Clear();
+
+		// Sorts a pass by depth before state, e.g. so opaque geometry hides as much as possible of what is drawn after it
+		// Takes effect for packets added after the call.
+		void SetFrontToBack(RenderPass pass, bool frontToBack);
+
+		void Add(std::uint64_t key, const DrawPacket& packet);
+
+		// Adds every packet of another queue, e.g. one filled on another thread
+		void Append(const RenderQueue& other);
+
+		size_t Size() const { return m_packets.size(); }
+
+		// Sorts the packets if needed and calls func(packet) for each in key order
+		template <typename Func>
+		void ForEachSorted(Func func)
+		{
+			if (!m_sorted)
+			{
+				RadixSort();
+				m_sorted = true;
+			}
+
+			for (const SortEntry& entry : m_entries)
+				func(m_packets[entry.packet]);
+		}
+	};
+}
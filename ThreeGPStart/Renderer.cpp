@@ -1,169 +1,850 @@
 #include "Renderer.h"
 
+// Cells across and down each terrain chunk when drawing with TerrainRenderMode::VertexIdGrid
+static const int KTerrainChunkCells = 16;
+
+// Projection planes, depth sort keys are scaled by the far plane
+static const float KNearPlane = 1.0f;
+static const float KFarPlane = 20000.0f;
+
+// Uniform buffer binding points, the same for every program
+static const GLuint KPerFrameBinding = 0;
+static const GLuint KMaterialBinding = 1;
+static const GLuint KLightsBinding = 2;
+
+// Texture units, the same for every program
+static const GLint KDiffuseTextureUnit = 0;
+static const GLint KHeightTextureUnit = 1;
+static const GLint KNormalMapTextureUnit = 2;
+static const GLint KSkyTextureUnit = 3;
+static const GLint KLightTextureUnit = 4;
+static const GLint KClusterTextureUnit = 5;
+static const GLint KLightIndexTextureUnit = 6;
+
+// Occlusion buffer size in pixels and the most cells the terrain occluder has along each side
+static const int KOcclusionBufferWidth = 256;
+static const int KOcclusionBufferHeight = 144;
+static const int KTerrainOccluderCells = 64;
+
+// Fewest visible objects worth handing to a job of their own when building the frame's draws
+static const size_t KObjectsPerJob = 32;
 
 // On exit must clean up any OpenGL resources e.g. the program, the buffers
 Renderer::~Renderer()
 {
-	glDeleteProgram(m_program);	
-	
+	glDeleteBuffers(1, &m_perFrameUBO);
+	glDeleteBuffers(1, &m_lightsUBO);
+	glDeleteVertexArrays(1, &m_indirectVAO);
+	for (auto& model : m_instancedModels)
+		glDeleteVertexArrays(1, &model->VAO);
+	glDeleteBuffers(1, &m_materialUBO);
+
+	for (auto& entry : m_terrainIndexTemplates)
+	{
+		glDeleteVertexArrays(1, &entry.second.VAO);
+		glDeleteBuffers(1, &entry.second.EBO);
+	}
+	glDeleteTextures(1, &m_terrainHeightTexture);
+	glDeleteTextures(1, &m_terrainTexture);
+	glDeleteTextures(1, &m_terrainNormalMapTexture);
 }
 
-// Load, compile and link the shaders and create a program object to host them
-bool Renderer::CreateProgram()
+// Links the program and points its uniform blocks and samplers at the renderer's fixed binding points
+// so nothing but the per draw values needs setting while rendering
+bool Renderer::CreateProgram(const std::string& vertexShaderFilename, const std::string& fragmentShaderFilename, Helpers::ShaderProgram& program)
 {
-	// Create a new program (returns a unqiue id)
-	m_program = glCreateProgram();
-
-	// Load and create vertex and fragment shaders
-	GLuint vertex_shader{ Helpers::LoadAndCompileShader(GL_VERTEX_SHADER, "Data/Shaders/vertex_shader.glsl") };
-	GLuint fragment_shader{ Helpers::LoadAndCompileShader(GL_FRAGMENT_SHADER, "Data/Shaders/fragment_shader.glsl") };
-	if (vertex_shader == 0 || fragment_shader == 0)
+	if (!program.Create(vertexShaderFilename, fragmentShaderFilename))
 		return false;
 
-	// Attach the vertex shader to this program (copies it)
-	glAttachShader(m_program, vertex_shader);
+	program.BindUniformBlock("PerFrame", KPerFrameBinding);
+	program.BindUniformBlock("Material", KMaterialBinding);
+	program.BindUniformBlock("Lights", KLightsBinding);
 
-	// The attibute 0 maps to the input stream "vertex_position" in the vertex shader
-	// Not needed if you use (location=0) in the vertex shader itself
-	//glBindAttribLocation(m_program, 0, "vertex_position");
+	program.SetSampler("sampler_tex", KDiffuseTextureUnit);
+	program.SetSampler("height_tex", KHeightTextureUnit);
+	program.SetSampler("normal_map_tex", KNormalMapTextureUnit);
+	program.SetSampler("sky_tex", KSkyTextureUnit);
+	program.SetSampler("light_tex", KLightTextureUnit);
+	program.SetSampler("cluster_tex", KClusterTextureUnit);
+	program.SetSampler("light_index_tex", KLightIndexTextureUnit);
+	glUseProgram(0);
+
+	return !Helpers::CheckForGLError();
+}
 
-	// Attach the fragment shader (copies it)
-	glAttachShader(m_program, fragment_shader);
+// Creates a mip mapped, repeating 2D texture from a loaded image
+GLuint Renderer::CreateTexture(const Helpers::ImageLoader& image) const
+{
+	GLuint textureID;
+	glGenTextures(1, &textureID);
+	glBindTexture(GL_TEXTURE_2D, textureID);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+		GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, image.Width(), image.Height(), 0, GL_RGBA, GL_UNSIGNED_BYTE, image.GetData());
+	glGenerateMipmap(GL_TEXTURE_2D);
 
-	// Done with the originals of these as we have made copies
-	glDeleteShader(vertex_shader);
-	glDeleteShader(fragment_shader);
+	return textureID;
+}
+
+// Returns the index of a new material, its uniforms are uploaded before the next frame is drawn
+GLuint Renderer::CreateMaterial(GLuint textureID, const glm::vec4& diffuseColour)
+{
+	Material material;
+	material.textureID = textureID;
+	material.diffuseColour = diffuseColour;
+	m_materials.push_back(material);
+	m_materialsChanged = true;
+
+	return (GLuint)m_materials.size() - 1;
+}
+
+// Rewrites the whole material buffer, materials are only added while loading so this is rare
+void Renderer::UploadMaterials()
+{
+	if (!m_materialsChanged)
+		return;
+
+	// Each material starts on the alignment glBindBufferRange needs
+	std::vector<GLubyte> data(m_materialStride * m_materials.size());
+	for (size_t i = 0; i < m_materials.size(); i++)
+	{
+		MaterialUniforms uniforms;
+		uniforms.diffuseColour = m_materials[i].diffuseColour;
+		std::memcpy(&data[i * m_materialStride], &uniforms, sizeof(uniforms));
+	}
+
+	glBindBuffer(GL_UNIFORM_BUFFER, m_materialUBO);
+	glBufferData(GL_UNIFORM_BUFFER, data.size(), data.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	m_materialsChanged = false;
+}
 
-	// Link the shaders, checking for errors
-	if (!Helpers::LinkProgramShaders(m_program))
+// Binds the material's texture to unit 0 and its slot of the uniform buffer, unit 0 must be active
+void Renderer::BindMaterial(GLuint material) const
+{
+	glBindTexture(GL_TEXTURE_2D, m_materials[material].textureID);
+	glBindBufferRange(GL_UNIFORM_BUFFER, KMaterialBinding, m_materialUBO, m_materialStride * material, sizeof(MaterialUniforms));
+}
+
+// Copies a loaded mesh into the geometry buffer as interleaved vertices, returns false on error
+bool Renderer::CreateMesh(const Helpers::Mesh& mesh, GLuint material, MyMesh& myMesh)
+{
+	myMesh = MyMesh();
+	myMesh.material = material;
+
+	// Nothing to draw but not an error, the mesh is left invalid and skipped
+	if (mesh.vertices.empty() || mesh.elements.empty())
+		return true;
+
+	myMesh.geometry = m_geometry.Allocate((GLuint)mesh.vertices.size(), (GLuint)mesh.elements.size());
+
+	for (const glm::vec3& vertex : mesh.vertices)
+		myMesh.bounds.Include(vertex);
+
+	GLubyte* vertices{ m_geometry.MapVertices(myMesh.geometry) };
+	if (vertices)
+	{
+		for (size_t i = 0; i < mesh.vertices.size(); i++)
+		{
+			// Normals and uvs depend on the model creator
+			MeshFormat::Write(vertices, i, mesh.vertices[i],
+				i < mesh.normals.size() ? mesh.normals[i] : glm::vec3(0, 1, 0),
+				i < mesh.uvCoords.size() ? mesh.uvCoords[i] : glm::vec2(0));
+		}
+	}
+
+	bool written{ vertices && m_geometry.UnmapVertices() };
+
+	GLuint* elements{ m_geometry.MapIndices(myMesh.geometry) };
+	if (elements)
+		std::copy(mesh.elements.begin(), mesh.elements.end(), elements);
+
+	written = elements && m_geometry.UnmapIndices() && written;
+
+	if (!written)
+	{
+		std::cerr << "Could not write mesh to the geometry buffer" << std::endl;
+		m_geometry.Free(myMesh.geometry);
 		return false;
+	}
 
-	return !Helpers::CheckForGLError();
+	return true;
 }
 
-void Renderer::ModelLoader(const std::string& modelName, const std::string& textureName)
+// Queues a draw of a mesh in the geometry buffer placed by modelXform, its depth is taken from the centre of its bounds
+void Renderer::QueueMesh(Helpers::RenderQueue& queue, const MyMesh& mesh, const glm::mat4& modelXform, const Helpers::ShaderProgram& program,
+	Helpers::RenderPass pass, const glm::vec3& cameraPosition) const
 {
-	Object jeep;
+	Helpers::DrawPacket packet;
+	packet.program = &program;
+	packet.VAO = m_geometry.GetVAO();
+	packet.material = mesh.material;
+	packet.indexType = GL_UNSIGNED_INT;
+	packet.numIndices = mesh.geometry.numIndices;
+	packet.firstIndexOffset = sizeof(GLuint) * mesh.geometry.firstIndex;
+	packet.baseVertex = mesh.geometry.firstVertex;
+	packet.modelXform = modelXform;
+
+	glm::vec3 centre{ modelXform * glm::vec4(mesh.bounds.IsEmpty() ? glm::vec3(0) : mesh.bounds.Centre(), 1.0f) };
+	float depth{ glm::length(centre - cameraPosition) / KFarPlane };
+	queue.Add(Helpers::RenderQueue::MakeKey(pass, program.Id(), mesh.material, packet.VAO, depth), packet);
+}
+
+// Only reads the scene, so the jobs need no locking. Each job covers the same range of objects
+// however the pool schedules it, so the merged queue is in the same order every frame.
+void Renderer::QueueVisibleObjects(const glm::vec3& cameraPosition)
+{
+	Helpers::ThreadPool& pool{ Helpers::ThreadPool::Get() };
+
+	const size_t numObjects{ m_visibleObjects.size() };
+	const size_t numJobs{ std::max<size_t>(std::min((numObjects + KObjectsPerJob - 1) / KObjectsPerJob, (pool.NumThreads() + 1) * 4), 1) };
+	const size_t objectsPerJob{ (numObjects + numJobs - 1) / numJobs };
+	if (m_jobQueues.size() < numJobs)
+		m_jobQueues.resize(numJobs);
+
+	pool.ParallelFor(numJobs, 1, [&](size_t beginJob, size_t endJob)
+	{
+		std::vector<GLuint> visibleMeshes;
+		for (size_t job = beginJob; job < endJob; job++)
+		{
+			Helpers::RenderQueue& queue{ m_jobQueues[job] };
+			queue.Clear();
+			queue.SetFrontToBack(Helpers::RenderPass::Opaque, m_depthOrdering == DepthOrdering::FrontToBack);
+
+			const size_t endObject{ std::min((job + 1) * objectsPerJob, numObjects) };
+			for (size_t i = job * objectsPerJob; i < endObject; i++)
+			{
+				const GLuint objectIndex{ m_visibleObjects[i] };
+				const Object& model{ myObjectVector[objectIndex] };
+				if (!IsUnoccluded(model.bounds))
+					continue;
+
+				visibleMeshes.clear();
+				m_meshBounds.Cull(m_frustum, m_objectFirstMesh[objectIndex], model.myMeshVector.size(), visibleMeshes);
+				for (GLuint meshIndex : visibleMeshes)
+				{
+					const MyMesh& mesh{ model.myMeshVector[meshIndex - m_objectFirstMesh[objectIndex]] };
+					if (mesh.geometry.IsValid() && (visibleMeshes.size() == 1 || IsUnoccluded(MeshWorldBounds(model, mesh))))
+						QueueMesh(queue, mesh, MeshWorldTransform(model, mesh), m_program, Helpers::RenderPass::Opaque, cameraPosition);
+				}
+			}
+		}
+	});
+
+	for (size_t job = 0; job < numJobs; job++)
+		m_renderQueue.Append(m_jobQueues[job]);
+}
+
+// Depth test and writes for drawing a pass, colour pass opaque draws after a pre-pass only shade the surface it left
+void Renderer::SetPassDepthState(Helpers::RenderPass pass, bool depthOnly) const
+{
+	const bool afterPrePass{ !depthOnly && pass == Helpers::RenderPass::Opaque && m_depthOrdering == DepthOrdering::PrePass };
+
+	glColorMask(!depthOnly, !depthOnly, !depthOnly, !depthOnly);
+	glDepthFunc(afterPrePass ? GL_EQUAL : GL_LESS);
+	glDepthMask(!afterPrePass);
+}
+
+// Draws the sorted queue, depth only draws are the pre-pass of the opaque draws
+void Renderer::SubmitRenderQueue(bool depthOnly)
+{
+	glActiveTexture(GL_TEXTURE0);
+
+	if (m_useIndirectDraws)
+		DrawIndirectBatches(depthOnly);
+	else
+		DrawRenderQueue(depthOnly);
+
+	// Back to the defaults for anything drawn outside the queue
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	glDepthFunc(GL_LESS);
+	glDepthMask(GL_TRUE);
+	glBindVertexArray(0);
+}
+
+// Declares the frame's passes, only called again when they or the framebuffer size change
+void Renderer::BuildRenderGraph()
+{
+	m_renderGraph.Reset();
+	const Helpers::RenderResource backbuffer{ m_renderGraph.ImportBackbuffer() };
+
+	// The opaque draws' depth first, so the colour pass only shades the nearest surface
+	if (m_depthOrdering == DepthOrdering::PrePass)
+	{
+		m_renderGraph.AddPass("DepthPrePass", [backbuffer](Helpers::RenderGraph::PassBuilder& builder) { builder.Write(backbuffer); },
+			[this](const Helpers::RenderGraph&) { SubmitRenderQueue(true); });
+	}
+
+	m_renderGraph.AddPass("Opaque", [backbuffer](Helpers::RenderGraph::PassBuilder& builder) { builder.Write(backbuffer); },
+		[this](const Helpers::RenderGraph&)
+	{
+		DrawTerrainChunks();
+		SubmitRenderQueue(false);
+	});
+
+	// Last, so the depth test leaves only the pixels nothing else covered
+	if (m_skybox.IsValid())
+	{
+		m_renderGraph.AddPass("Sky", [backbuffer](Helpers::RenderGraph::PassBuilder& builder)
+		{
+			builder.Read(backbuffer);
+			builder.Write(backbuffer);
+		},
+			[this](const Helpers::RenderGraph&)
+		{
+			m_skyProgram.Use();
+			glUniformMatrix4fv(m_skyProgram.GetUniformLocation("inverse_combined_xform"), 1, GL_FALSE, glm::value_ptr(glm::inverse(m_combinedXform)));
+			m_skybox.Draw(KSkyTextureUnit);
+		});
+	}
+
+	if (!m_renderGraph.Compile(std::max(m_viewportWidth, 1), std::max(m_viewportHeight, 1)))
+		std::cerr << "ERROR: the render graph could not be compiled" << std::endl;
+	m_renderGraphChanged = false;
+}
+
+// Vertex ID chunks set their own per draw uniforms so are drawn directly rather than through the queue
+void Renderer::DrawTerrainChunks()
+{
+	if (m_terrainChunks.empty())
+		return;
+
+	glm::mat4 model_xform = glm::mat4(1);
+	m_terrainProgram.Use();
+	glUniformMatrix4fv(m_terrainProgram.GetUniformLocation("model_xform"), 1, GL_FALSE, glm::value_ptr(model_xform));
+
+	BindMaterial(m_terrainMaterial);
+
+	GLint chunkFirstVertId{ m_terrainProgram.GetUniformLocation("chunk_first_vert") };
+	GLint chunkVertsXId{ m_terrainProgram.GetUniformLocation("chunk_verts_x") };
+
+	// Chunks sharing a template share a VAO so only rebind when it changes
+	GLuint boundVAO{ 0 };
+	for (const TerrainChunk& chunk : m_terrainChunks)
+	{
+		if (!m_frustum.IsBoxVisible(chunk.bounds) || !IsUnoccluded(chunk.bounds))
+			continue;
+
+		glUniform2i(chunkFirstVertId, chunk.firstVertX, chunk.firstVertZ);
+		glUniform1i(chunkVertsXId, chunk.numVertsX);
+
+		if (chunk.indexTemplate->VAO != boundVAO)
+		{
+			boundVAO = chunk.indexTemplate->VAO;
+			glBindVertexArray(boundVAO);
+		}
+		glDrawElements(GL_TRIANGLES, chunk.indexTemplate->numElements, GL_UNSIGNED_SHORT, (void*)0);
+	}
+
+	glBindVertexArray(0);
+}
+
+// Draws the sorted queue one packet at a time, only binding what differs from the previous draw
+// Depth only draws cover just the opaque pass, all with m_depthProgram and no material.
+void Renderer::DrawRenderQueue(bool depthOnly)
+{
+	const Helpers::ShaderProgram* boundProgram{ nullptr };
+	GLuint boundVAO{ 0 };
+	GLuint boundMaterial{ (GLuint)-1 };
+	bool passSet{ false };
+	Helpers::RenderPass boundPass{ Helpers::RenderPass::Opaque };
+	glm::mat4 boundModelXform;
+	bool modelXformSet{ false };
+
+	m_renderQueue.ForEachSorted([&](const Helpers::DrawPacket& packet)
+	{
+		if (depthOnly && packet.pass != Helpers::RenderPass::Opaque)
+			return;
+
+		if (!passSet || packet.pass != boundPass)
+		{
+			boundPass = packet.pass;
+			passSet = true;
+			SetPassDepthState(boundPass, depthOnly);
+		}
+
+		const Helpers::ShaderProgram* program{ depthOnly ? &m_depthProgram : packet.program };
+		if (program != boundProgram)
+		{
+			boundProgram = program;
+			boundProgram->Use();
+		}
+
+		if (packet.VAO != boundVAO)
+		{
+			boundVAO = packet.VAO;
+			glBindVertexArray(boundVAO);
+		}
+
+		if (!depthOnly && packet.material != boundMaterial)
+		{
+			boundMaterial = packet.material;
+			BindMaterial(boundMaterial);
+		}
+
+		if (packet.numInstances > 0)
+		{
+			glDrawElementsInstancedBaseVertex(GL_TRIANGLES, packet.numIndices, packet.indexType, (void*)packet.firstIndexOffset,
+				packet.numInstances, packet.baseVertex);
+
+			// Drawing from an attribute array leaves that attribute's constant value undefined
+			modelXformSet = false;
+			return;
+		}
 
-	Helpers::ModelLoader jeepModel;
-	if (!jeepModel.LoadFromFile(modelName))
+		// Single copies set the instance attributes as constants, they are not per program so survive program changes
+		if (!modelXformSet || packet.modelXform != boundModelXform)
+		{
+			Helpers::InstanceData instance;
+			instance.modelXform = packet.modelXform;
+			Helpers::InstanceBuffer::SetCurrentInstance(instance);
+
+			boundModelXform = packet.modelXform;
+			modelXformSet = true;
+		}
+
+		glDrawElementsBaseVertex(GL_TRIANGLES, packet.numIndices, packet.indexType, (void*)packet.firstIndexOffset, packet.baseVertex);
+	});
+}
+
+// Loads every mesh of a model into the geometry buffer sharing one material, returns false on error
+bool Renderer::LoadModelMeshes(const std::string& modelName, const std::string& textureName, std::vector<MyMesh>& meshes,
+	Helpers::SceneNode parent)
+{
+	Helpers::ModelLoader model;
+	if (!model.LoadFromFile(modelName))
+	{
 		std::cerr << "Could not load model" << std::endl;
+		return false;
+	}
 
-	Helpers::ImageLoader jeepTexture;
-	if (!jeepTexture.Load(textureName))
+	Helpers::ImageLoader texture;
+	if (!texture.Load(textureName))
 		std::cerr << "Could not load model" << std::endl;
 
-	for (const Helpers::Mesh& mesh : jeepModel.GetMeshVector())
-	{
-		MyMesh modelMesh;
-		//create vbo s
-		
-		GLuint normalsVBO;
-		GLuint elementsEBO;
-		GLuint texcoordVBO;
-
-		GLuint positionsVBO;
-		//Generate 1 buffer id, put the resulting identifier in positionsVBO variable.
-		glGenBuffers(1, &positionsVBO);
-
-		//Bind the buffer to the context at the GL_ARRAY_BUFFER binding point (target).
-		//This is the first time the buffer is used so this also createsthe buffer object.
-		glBindBuffer(GL_ARRAY_BUFFER, positionsVBO);
-		
-		//Fill the bound buffer with the vertices, we pass the size in bytes and a pointer to the data.
-		//the last parameter is a hint to open GL that we will not alter the vertices again.
-		glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * mesh.vertices.size(), mesh.vertices.data(), GL_STATIC_DRAW);
-		
-		//Clear binding - not absolutely required but a good idea!
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-		glGenBuffers(1, &normalsVBO);
-		glBindBuffer(GL_ARRAY_BUFFER, normalsVBO);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * mesh.normals.size(), mesh.normals.data(), GL_STATIC_DRAW);
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-		glGenBuffers(1, &elementsEBO);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementsEBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * mesh.elements.size(), mesh.elements.data(), GL_STATIC_DRAW);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-
-		glGenBuffers(1, &texcoordVBO);
-		glBindBuffer(GL_ARRAY_BUFFER, texcoordVBO);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec2) * mesh.uvCoords.size(), mesh.uvCoords.data(), GL_STATIC_DRAW);
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-		modelMesh.numElements = (GLuint)mesh.elements.size();
-
-		/*	Create a Vertex Array Object (VAO) to wrap or 'record' all bindings etc. needed to render
-			As well as the make up of any streamed data
-			Once we bind the VAO subsequent binds etc. are 'recorded' in the VAO.*/
-
-		// Create a unique id for a vertex array object
-		glGenVertexArrays(1, &modelMesh.VAO);
-
-		// Bind it to be current and since first use this also allocates memory for it
-		// Note no target binding point as there is only one type of vao
-		glBindVertexArray(modelMesh.VAO);
-
-		// Bind the vertex buffer to the context (records this action in the VAO)
-		glBindBuffer(GL_ARRAY_BUFFER, positionsVBO);
-
-		// Enable the first attribute in the program (the vertices) to stream to the vertex shader
-		glEnableVertexAttribArray(0);
-
-		// Describe the make up of the vertex stream
-		glVertexAttribPointer(
-			0,                  // attribute 0
-			3,                  // size in bytes of each item in the stream
-			GL_FLOAT,           // type of the item
-			GL_FALSE,           // normalized or not (advanced)
-			0,                  // stride (advanced)
-			(void*)0            // array buffer offset (advanced)
-		);
-
-		glBindBuffer(GL_ARRAY_BUFFER, normalsVBO);
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(
-			1,
-			3,
-			GL_FLOAT,
-			GL_FALSE,
-			0,
-			(void*)0
-		);
-
-		glBindBuffer(GL_ARRAY_BUFFER, texcoordVBO);
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(
-			2,
-			2,
-			GL_FLOAT,
-			GL_FALSE,
-			0,
-			(void*)0
-		);
-
-		glGenTextures(1, &modelMesh.textureID);
-		glBindTexture(GL_TEXTURE_2D, modelMesh.textureID);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
-			GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, jeepTexture.Width(), jeepTexture.Height(), 0, GL_RGBA, GL_UNSIGNED_BYTE, jeepTexture.GetData());
-		glGenerateMipmap(GL_TEXTURE_2D);
+	// Every mesh in the model uses the same texture so only create it once
+	GLuint material{ CreateMaterial(CreateTexture(texture)) };
+
+	std::vector<MyMesh> modelMeshes(model.GetMeshVector().size());
+	for (size_t i = 0; i < modelMeshes.size(); i++)
+	{
+		if (!CreateMesh(model.GetMeshVector()[i], material, modelMeshes[i]))
+		{
+			for (MyMesh& created : modelMeshes)
+			{
+				if (created.geometry.IsValid())
+					m_geometry.Free(created.geometry);
+			}
+			return false;
+		}
+	}
+
+	if (parent == Helpers::KNoSceneNode || !model.GetRootNode())
+		meshes.insert(meshes.end(), modelMeshes.begin(), modelMeshes.end());
+	else
+		AddModelNodes(*model.GetRootNode(), parent, modelMeshes, meshes);
+
+	return true;
+}
+
+// Creates a scene node for a model node and its children, adding a copy of each mesh they place
+// A mesh placed by several nodes shares its geometry between the copies
+void Renderer::AddModelNodes(const Helpers::Node& modelNode, Helpers::SceneNode parent, const std::vector<MyMesh>& modelMeshes, std::vector<MyMesh>& meshes)
+{
+	Helpers::SceneNode node{ m_sceneGraph.CreateNode(modelNode.transform, parent) };
+
+	for (unsigned int meshIndex : modelNode.meshIndices)
+	{
+		if (meshIndex >= modelMeshes.size())
+			continue;
+
+		MyMesh mesh{ modelMeshes[meshIndex] };
+		mesh.node = node;
+		meshes.push_back(mesh);
+	}
+
+	for (const Helpers::Node* child : modelNode.childNodes)
+		AddModelNodes(*child, node, modelMeshes, meshes);
+}
+
+const glm::mat4& Renderer::MeshWorldTransform(const Object& object, const MyMesh& mesh) const
+{
+	return m_sceneGraph.GetWorldTransform(mesh.node != Helpers::KNoSceneNode ? mesh.node : object.node);
+}
+
+// World space box around a mesh of an object
+Helpers::BoundingBox Renderer::MeshWorldBounds(const Object& object, const MyMesh& mesh) const
+{
+	return mesh.bounds.Transformed(MeshWorldTransform(object, mesh));
+}
+
+// Draws the sorted queue as one multi draw per batch of state, so the CPU cost follows the number of batches
+// rather than the number of meshes. Single copies in the geometry buffer have their transform written to the
+// per draw instances and are drawn through m_indirectVAO, instanced models just point at their own instances.
+// Anything else, such as the streaming terrain's own buffers, is drawn directly as before.
+void Renderer::BuildIndirectBatches()
+{
+	const GLuint geometryVAO{ m_geometry.GetVAO() };
+
+	m_indirectDraws.Clear();
+	m_indirectBatches.clear();
 
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementsEBO);
+	m_renderQueue.ForEachSorted([&](const Helpers::DrawPacket& packet)
+	{
+		bool singleCopy{ packet.VAO == geometryVAO && packet.numInstances == 0 };
+		if (!singleCopy && packet.numInstances == 0)
+		{
+			IndirectBatch direct;
+			direct.packet = &packet;
+			direct.VAO = packet.VAO;
+			m_indirectBatches.push_back(direct);
+			return;
+		}
+
+		Helpers::DrawElementsIndirectCommand command;
+		command.count = packet.numIndices;
+		command.firstIndex = (GLuint)(packet.firstIndexOffset / sizeof(GLuint));
+		command.baseVertex = packet.baseVertex;
+
+		if (singleCopy)
+		{
+			Helpers::InstanceData instance;
+			instance.modelXform = packet.modelXform;
+			command.instanceCount = 1;
+			command.baseInstance = m_indirectDraws.AddInstance(instance);
+		}
+		else
+		{
+			command.instanceCount = packet.numInstances;
+		}
+
+		GLuint VAO{ singleCopy ? m_indirectVAO : packet.VAO };
+		bool sameBatch{ !m_indirectBatches.empty() && m_indirectBatches.back().numCommands > 0 &&
+			m_indirectBatches.back().VAO == VAO &&
+			m_indirectBatches.back().packet->pass == packet.pass &&
+			m_indirectBatches.back().packet->program == packet.program &&
+			m_indirectBatches.back().packet->material == packet.material };
+
+		GLsizei commandIndex{ m_indirectDraws.AddCommand(command) };
+		if (!sameBatch)
+		{
+			IndirectBatch batch;
+			batch.packet = &packet;
+			batch.VAO = VAO;
+			batch.firstCommand = commandIndex;
+			m_indirectBatches.push_back(batch);
+		}
+		m_indirectBatches.back().numCommands++;
+	});
+
+	// The instance buffer and the geometry buffer can both be replaced, either way the VAO must follow
+	if (m_indirectDraws.Upload() || m_indirectVAOGeneration != m_geometry.BufferGeneration())
+	{
+		m_geometry.SetupVAO(m_indirectVAO);
+		Helpers::InstanceBuffer::SetupAttributes(m_indirectDraws.GetInstanceBuffer());
 		glBindVertexArray(0);
+		m_indirectVAOGeneration = m_geometry.BufferGeneration();
+	}
+}
 
-		jeep.myMeshVector.push_back(modelMesh);
+// Draws the batches made by BuildIndirectBatches, depth only draws cover just the opaque pass
+void Renderer::DrawIndirectBatches(bool depthOnly)
+{
+	const Helpers::ShaderProgram* boundProgram{ nullptr };
+	GLuint boundVAO{ 0 };
+	GLuint boundMaterial{ (GLuint)-1 };
+	bool passSet{ false };
+	Helpers::RenderPass boundPass{ Helpers::RenderPass::Opaque };
+
+	m_indirectDraws.Bind();
+
+	for (const IndirectBatch& batch : m_indirectBatches)
+	{
+		const Helpers::DrawPacket& packet{ *batch.packet };
+		if (depthOnly && packet.pass != Helpers::RenderPass::Opaque)
+			continue;
+
+		if (!passSet || packet.pass != boundPass)
+		{
+			boundPass = packet.pass;
+			passSet = true;
+			SetPassDepthState(boundPass, depthOnly);
+		}
+
+		const Helpers::ShaderProgram* program{ depthOnly ? &m_depthProgram : packet.program };
+		if (program != boundProgram)
+		{
+			boundProgram = program;
+			boundProgram->Use();
+		}
+
+		if (batch.VAO != boundVAO)
+		{
+			boundVAO = batch.VAO;
+			glBindVertexArray(boundVAO);
+		}
+
+		if (!depthOnly && packet.material != boundMaterial)
+		{
+			boundMaterial = packet.material;
+			BindMaterial(boundMaterial);
+		}
+
+		if (batch.numCommands > 0)
+		{
+			m_indirectDraws.Draw(batch.firstCommand, batch.numCommands);
+			continue;
+		}
+
+		// The constant instance values are undefined after any draw reading them from an array, so always set them
+		Helpers::InstanceData instance;
+		instance.modelXform = packet.modelXform;
+		Helpers::InstanceBuffer::SetCurrentInstance(instance);
+
+		glDrawElementsBaseVertex(GL_TRIANGLES, packet.numIndices, packet.indexType, (void*)packet.firstIndexOffset, packet.baseVertex);
 	}
 
-	myObjectVector.push_back(jeep);
+	Helpers::IndirectDrawBuffer::Unbind();
+}
+
+// Loads a model as a new object placed by xform relative to parent, returns the object's index or -1 on error
+int Renderer::ModelLoader(const std::string& modelName, const std::string& textureName, const glm::mat4& xform, Helpers::SceneNode parent)
+{
+	Object jeep;
+	jeep.node = m_sceneGraph.CreateNode(xform, parent);
+	if (!LoadModelMeshes(modelName, textureName, jeep.myMeshVector, jeep.node))
+		return -1;
+	return (int)AddObject(jeep);
+}
+
+// Adds an object, returning its index. Its bounds are worked out when the scene bounds are next updated.
+size_t Renderer::AddObject(Object object)
+{
+	if (object.node == Helpers::KNoSceneNode)
+		object.node = m_sceneGraph.CreateNode();
+
+	// Moving any node of the object has to refit it
+	size_t objectIndex{ myObjectVector.size() };
+	m_nodeObjects.resize(m_sceneGraph.NumNodes(), -1);
+	m_nodeObjects[object.node] = (int)objectIndex;
+	for (const MyMesh& mesh : object.myMeshVector)
+	{
+		if (mesh.node != Helpers::KNoSceneNode)
+			m_nodeObjects[mesh.node] = (int)objectIndex;
+	}
 
+	myObjectVector.push_back(std::move(object));
+	m_sceneBoundsChanged = true;
+	return objectIndex;
 }
 
-bool Renderer::CreateTerrain(int numCellsX, int numCellsZ, const std::string& textureFilename)
+// Rebuilds the object hierarchy and the batched mesh bounds from myObjectVector
+void Renderer::UpdateSceneBounds()
+{
+	std::vector<Helpers::BoundingBox> objectBounds;
+	m_meshBounds.Clear();
+	m_objectFirstMesh.clear();
+
+	for (Object& object : myObjectVector)
+	{
+		object.bounds = Helpers::BoundingBox();
+		m_objectFirstMesh.push_back(m_meshBounds.Size());
+		for (const MyMesh& mesh : object.myMeshVector)
+		{
+			Helpers::BoundingBox meshBounds{ MeshWorldBounds(object, mesh) };
+			object.bounds.Include(meshBounds);
+			m_meshBounds.Add(meshBounds);
+		}
+		objectBounds.push_back(object.bounds);
+	}
+
+	m_sceneBvh.Build(objectBounds);
+	m_sceneBoundsChanged = false;
+}
+
+// Call after changing an object's mesh bounds or moving its nodes
+void Renderer::RefitObject(size_t objectIndex)
+{
+	// Picked up by the full rebuild if one is pending
+	if (m_sceneBoundsChanged)
+		return;
+
+	Object& object{ myObjectVector[objectIndex] };
+	object.bounds = Helpers::BoundingBox();
+	for (size_t i = 0; i < object.myMeshVector.size(); i++)
+	{
+		Helpers::BoundingBox meshBounds{ MeshWorldBounds(object, object.myMeshVector[i]) };
+		object.bounds.Include(meshBounds);
+		m_meshBounds.Set(m_objectFirstMesh[objectIndex] + i, meshBounds);
+	}
+	m_sceneBvh.RefitItem((GLuint)objectIndex, object.bounds);
+}
+
+// World space box around an inclusive range of terrain vertices
+Helpers::BoundingBox Renderer::TerrainBounds(const Helpers::GridRect& region) const
+{
+	const Helpers::Heightfield& heightfield{ m_terrainHeightfield };
+
+	float minHeight, maxHeight;
+	heightfield.GetHeightRange(region, minHeight, maxHeight);
+
+	glm::vec3 first{ heightfield.GetVertexPosition(region.minX, region.minZ) };
+	glm::vec3 last{ heightfield.GetVertexPosition(region.maxX, region.maxZ) };
+
+	Helpers::BoundingBox bounds;
+	bounds.Include(glm::vec3(first.x, minHeight, first.z));
+	bounds.Include(glm::vec3(last.x, maxHeight, last.z));
+	return bounds;
+}
+
+// Every few cells are merged into one, each coarse vertex taking the lowest height of the cells
+// around it so the coarse surface stays under the real one and never hides something it should not
+void Renderer::BuildTerrainOccluder()
+{
+	const Helpers::Heightfield& heightfield{ m_terrainHeightfield };
+
+	m_terrainOccluderVertices.clear();
+	m_terrainOccluderIndices.clear();
+	m_terrainOccluderChanged = false;
+
+	if (heightfield.NumCellsX() <= 0 || heightfield.NumCellsZ() <= 0)
+		return;
+
+	const int stepX{ (heightfield.NumCellsX() + KTerrainOccluderCells - 1) / KTerrainOccluderCells };
+	const int stepZ{ (heightfield.NumCellsZ() + KTerrainOccluderCells - 1) / KTerrainOccluderCells };
+	const int coarseVertsX{ (heightfield.NumCellsX() + stepX - 1) / stepX + 1 };
+	const int coarseVertsZ{ (heightfield.NumCellsZ() + stepZ - 1) / stepZ + 1 };
+
+	for (int coarseZ = 0; coarseZ < coarseVertsZ; coarseZ++)
+	{
+		for (int coarseX = 0; coarseX < coarseVertsX; coarseX++)
+		{
+			int x{ std::min(coarseX * stepX, heightfield.NumCellsX()) };
+			int z{ std::min(coarseZ * stepZ, heightfield.NumCellsZ()) };
+
+			Helpers::GridRect around;
+			around.minX = std::max(x - stepX, 0);
+			around.minZ = std::max(z - stepZ, 0);
+			around.maxX = std::min(x + stepX, heightfield.NumCellsX());
+			around.maxZ = std::min(z + stepZ, heightfield.NumCellsZ());
+
+			float minHeight, maxHeight;
+			heightfield.GetHeightRange(around, minHeight, maxHeight);
+
+			glm::vec3 position{ heightfield.GetVertexPosition(x, z) };
+			position.y = minHeight;
+			m_terrainOccluderVertices.push_back(position);
+		}
+	}
+
+	// Same winding as the terrain mesh, counter clockwise seen from above
+	for (int z = 0; z < coarseVertsZ - 1; z++)
+	{
+		for (int x = 0; x < coarseVertsX - 1; x++)
+		{
+			GLuint corner{ (GLuint)(z * coarseVertsX + x) };
+			GLuint below{ corner + (GLuint)coarseVertsX };
+			m_terrainOccluderIndices.insert(m_terrainOccluderIndices.end(), { corner, corner + 1, below, corner + 1, below + 1, below });
+		}
+	}
+}
+
+// Loads a model to be drawn as many instances, returns its id or -1 on error
+int Renderer::LoadInstancedModel(const std::string& modelName, const std::string& textureName)
+{
+	std::unique_ptr<InstancedModel> model{ std::make_unique<InstancedModel>() };
+	if (!LoadModelMeshes(modelName, textureName, model->meshes))
+		return -1;
+
+	for (const MyMesh& mesh : model->meshes)
+		model->bounds.Include(mesh.bounds);
+
+	// Set up along with the instance buffer on the first Render
+	glGenVertexArrays(1, &model->VAO);
+
+	m_instancedModels.push_back(std::move(model));
+	return (int)m_instancedModels.size() - 1;
+}
+
+Helpers::InstanceHandle Renderer::AddInstance(int model, const glm::mat4& modelXform, const glm::vec4& tint)
+{
+	Helpers::InstanceData instance;
+	instance.modelXform = modelXform;
+	instance.tint = tint;
+	m_instancedModels[model]->instanceBoundsChanged = true;
+	return m_instancedModels[model]->instances.Add(instance);
+}
+
+void Renderer::UpdateInstance(int model, Helpers::InstanceHandle instance, const glm::mat4& modelXform, const glm::vec4& tint)
+{
+	Helpers::InstanceData data;
+	data.modelXform = modelXform;
+	data.tint = tint;
+	m_instancedModels[model]->instanceBoundsChanged = true;
+	m_instancedModels[model]->instances.Update(instance, data);
+}
+
+void Renderer::RemoveInstance(int model, Helpers::InstanceHandle instance)
+{
+	m_instancedModels[model]->instanceBoundsChanged = true;
+	m_instancedModels[model]->instances.Remove(instance);
+}
+
+// Uploads changed instances, sets up the VAOs that need it and queues a draw per mesh
+void Renderer::QueueInstancedModels(const glm::vec3& cameraPosition)
+{
+	for (auto& model : m_instancedModels)
+	{
+		bool bufferRecreated{ model->instances.Upload() };
+
+		// Growing either the geometry or the instances replaces a buffer the VAO points at
+		if (bufferRecreated || model->bufferGeneration != m_geometry.BufferGeneration())
+		{
+			m_geometry.SetupVAO(model->VAO);
+			model->instances.SetupAttributes();
+			glBindVertexArray(0);
+			model->bufferGeneration = m_geometry.BufferGeneration();
+		}
+
+		if (model->instances.Count() == 0)
+			continue;
+
+		if (model->instanceBoundsChanged)
+		{
+			model->instanceBounds = Helpers::BoundingBox();
+			for (const Helpers::InstanceData& instance : model->instances.Instances())
+				model->instanceBounds.Include(model->bounds.Transformed(instance.modelXform));
+			model->instanceBoundsChanged = false;
+		}
+
+		// One draw covers every instance, so it sorts by the nearest point of the box around them all
+		const glm::vec3 nearest{ glm::clamp(cameraPosition, model->instanceBounds.min, model->instanceBounds.max) };
+		const float depth{ model->instanceBounds.IsEmpty() ? 0.0f : glm::length(nearest - cameraPosition) / KFarPlane };
+
+		for (const MyMesh& mesh : model->meshes)
+		{
+			if (!mesh.geometry.IsValid())
+				continue;
+
+			Helpers::DrawPacket packet;
+			packet.program = &m_program;
+			packet.VAO = model->VAO;
+			packet.material = mesh.material;
+			packet.numIndices = mesh.geometry.numIndices;
+			packet.firstIndexOffset = sizeof(GLuint) * mesh.geometry.firstIndex;
+			packet.baseVertex = mesh.geometry.firstVertex;
+			packet.numInstances = model->instances.Count();
+
+			m_renderQueue.Add(Helpers::RenderQueue::MakeKey(Helpers::RenderPass::Opaque, m_program.Id(), mesh.material, packet.VAO, depth), packet);
+		}
+	}
+}
+
+bool Renderer::CreateTerrain(int numCellsX, int numCellsZ, const std::string& textureFilename, const std::string& heightmapFilename)
 {
 	Object terrain;
 	terrain.texName = textureFilename;
@@ -176,355 +857,434 @@ bool Renderer::CreateTerrain(int numCellsX, int numCellsZ, const std::string& te
 	if (!terrainTexture.Load(textureFilename))
 		std::cerr << "Could not load model" << std::endl;
 
-	GLbyte* terrainData = terrainTexture.GetData();
+	// Keep the heights on the CPU as well so the terrain can be queried (ray casts, line of sight etc.)
+	if (!m_terrainHeightfield.LoadFromImage(heightmapFilename, numCellsX, numCellsZ, terrainScale))
+		std::cerr << "Could not load height map" << std::endl;
 
-	//Generate verticies
-	std::vector < glm::vec3 > terrainVertices;
+	m_terrainRaycaster.Build(m_terrainHeightfield);
+	m_terrainOccluderChanged = true;
 
-	glm::vec3 start((numCellsX * terrainScale) / 2, 0 , (numCellsZ * terrainScale) / 2);
-	   	  
-	//Texture Coordinates
-	std::vector <glm::vec2> uvCoords;
+	if (m_useTerrainNormalMap && !CreateTerrainNormalMap(heightmapFilename))
+		return false;
 
-	Helpers::ImageLoader heightMap;
-	if (!heightMap.Load("Data\\Terrain\\curvy.gif"))
-		std::cerr << "Could not load height map" << std::endl;
+	if (m_terrainRenderMode == TerrainRenderMode::VertexIdGrid)
+		return CreateTerrainChunks(KTerrainChunkCells, terrainTexture);
+
+	// Vertices and indices are written straight into the mapped geometry buffer, nothing is built on the heap first
+	m_terrainGeometry = m_geometry.Allocate(numVertX * numVertZ, numCellsX * numCellsZ * 6);
+	terrainMesh.geometry = m_terrainGeometry;
 
-	unsigned char* texels = (unsigned char*)heightMap.GetData();
+	if (!WriteTerrainRows(0, numVertZ))
+		return false;
 
-	for (int z{ 0 }; z < numCellsZ + 1; ++z)
+	GLuint* terrainElements{ m_geometry.MapIndices(m_terrainGeometry) };
+	if (!terrainElements)
 	{
-	for (int x{ 0 }; x < numCellsX + 1; ++x)
+		std::cerr << "Could not map terrain index buffer" << std::endl;
+		return false;
+	}
+
+	//Indicies generation
+	for (int z{ 0 }; z < numCellsZ; ++z)
 	{
-		
-			glm::vec3 pos{ start };
+		for (int x{ 0 }; x < numCellsX; ++x)
+		{
+			int startVertIndex = z * numVertX + x;
+			if (m_terrainHeightfield.IsDiamondCell(x, z))
+			{
+				*terrainElements++ = startVertIndex;
+				*terrainElements++ = startVertIndex + 1;
+				*terrainElements++ = startVertIndex + numVertX;
 
-			pos.x = (x * terrainScale - start.x);
-			pos.z = start.z - (z * terrainScale );
+				*terrainElements++ = startVertIndex + 1;
+				*terrainElements++ = startVertIndex + numVertX + 1;
+				*terrainElements++ = startVertIndex + numVertX;
+			}
+			else
+			{
+				*terrainElements++ = startVertIndex + 1;
+				*terrainElements++ = startVertIndex + numVertX + 1;
+				*terrainElements++ = startVertIndex;
 
-			float u = (float)x / (numVertX - 1);
-			float v = (float)z / (numVertZ - 1);
+				*terrainElements++ = startVertIndex + numVertX + 1;
+				*terrainElements++ = startVertIndex + numVertX;
+				*terrainElements++ = startVertIndex;
+			}
+		}
+	}
 
-			int heightMapX = (int)(u * (heightMap.Width() - 1));
-			int heightMapY = (int)(v * (heightMap.Height() - 1));
+	m_geometry.UnmapIndices();
 
-			int offset = (heightMapX + heightMapY * heightMap.Width()) * 4;
-			pos.y = texels[offset];
+	terrainMesh.material = CreateMaterial(CreateTexture(terrainTexture));
 
-			terrainVertices.push_back(pos);
-			uvCoords.push_back(glm::vec2(u, v));
-		}
+	Helpers::GridRect all;
+	all.maxX = numCellsX;
+	all.maxZ = numCellsZ;
+
+	// Lit from the normal map so it needs its own program
+	if (m_terrainNormalMapTexture)
+	{
+		m_terrainMesh = terrainMesh;
+		m_terrainMesh.bounds = TerrainBounds(all);
+		return CreateProgram("Data/Shaders/vertex_shader.glsl", "Data/Shaders/terrain_fragment_shader.glsl", m_terrainMeshProgram);
 	}
+	
+	terrainMesh.bounds = TerrainBounds(all);
+	terrain.myMeshVector.push_back(terrainMesh);
+	m_terrainObject = (int)myObjectVector.size();
+	AddObject(terrain);
 
-	//Indicies generation
-	std::vector <GLint> terrainElements;
+	return true;
+}
+
+// Bakes the normal map from the full resolution heightmap, spread across the thread pool
+bool Renderer::CreateTerrainNormalMap(const std::string& heightmapFilename)
+{
+	if (!m_terrainNormalMap.Create(m_terrainHeightfield, heightmapFilename, m_terrainNormalMapDetail, m_terrainNormalMapCurvature))
+	{
+		std::cerr << "Could not bake terrain normal map" << std::endl;
+		return false;
+	}
 
-	bool DiamondPattern = true;
+	glGenTextures(1, &m_terrainNormalMapTexture);
+	glBindTexture(GL_TEXTURE_2D, m_terrainNormalMapTexture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-	for (int z{ 0 }; z < numCellsX; ++z)
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, m_terrainNormalMap.Width(), m_terrainNormalMap.Height(), 0, GL_RGBA, GL_UNSIGNED_BYTE,
+		m_terrainNormalMap.GetTexels().data());
+	glGenerateMipmap(GL_TEXTURE_2D);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	return !Helpers::CheckForGLError();
+}
+
+// Returns the index buffer for a chunk of the given size, building it the first time that size is seen
+// The diamond pattern is a simple alternation so every chunk whose first cell has the same
+// pattern can share the same indices
+const TerrainIndexTemplate& Renderer::GetTerrainIndexTemplate(int firstCellX, int firstCellZ, int numCellsX, int numCellsZ)
+{
+	bool firstIsDiamond{ m_terrainHeightfield.IsDiamondCell(firstCellX, firstCellZ) };
+	auto key{ std::make_tuple(numCellsX, numCellsZ, firstIsDiamond) };
+
+	auto found{ m_terrainIndexTemplates.find(key) };
+	if (found != m_terrainIndexTemplates.end())
+		return found->second;
+
+	// Chunk local vertex numbers, the vertex shader turns these back into grid positions
+	int numVertX = numCellsX + 1;
+	assert((numCellsX + 1) * (numCellsZ + 1) <= 65536);
+
+	std::vector<GLushort> elements;
+	elements.reserve((size_t)numCellsX * numCellsZ * 6);
+
+	auto addElement = [&elements](int index) { elements.push_back((GLushort)index); };
+
+	for (int z{ 0 }; z < numCellsZ; ++z)
 	{
-		for (int x{ 0 }; x < numCellsZ; ++x)
+		for (int x{ 0 }; x < numCellsX; ++x)
 		{
 			int startVertIndex = z * numVertX + x;
-			if (DiamondPattern)
+			if (m_terrainHeightfield.IsDiamondCell(firstCellX + x, firstCellZ + z))
 			{
-				terrainElements.push_back(startVertIndex);
-				terrainElements.push_back(startVertIndex + 1);
-				terrainElements.push_back(startVertIndex + numVertX);
+				addElement(startVertIndex);
+				addElement(startVertIndex + 1);
+				addElement(startVertIndex + numVertX);
 
-				terrainElements.push_back(startVertIndex + 1);
-				terrainElements.push_back(startVertIndex + numVertX + 1);
-				terrainElements.push_back(startVertIndex + numVertX);
+				addElement(startVertIndex + 1);
+				addElement(startVertIndex + numVertX + 1);
+				addElement(startVertIndex + numVertX);
 			}
 			else
 			{
-				terrainElements.push_back(startVertIndex + 1);
-				terrainElements.push_back(startVertIndex + numVertX + 1);
-				terrainElements.push_back(startVertIndex);
+				addElement(startVertIndex + 1);
+				addElement(startVertIndex + numVertX + 1);
+				addElement(startVertIndex);
 
-				terrainElements.push_back(startVertIndex + numVertX + 1);
-				terrainElements.push_back(startVertIndex + numVertX);
-				terrainElements.push_back(startVertIndex);
+				addElement(startVertIndex + numVertX + 1);
+				addElement(startVertIndex + numVertX);
+				addElement(startVertIndex);
 			}
-			DiamondPattern = !DiamondPattern;
 		}
-		if ((numCellsX * numCellsZ) % 2 == 0)
-			DiamondPattern = !DiamondPattern;
 	}
 
-	//Normals
+	TerrainIndexTemplate& indexTemplate{ m_terrainIndexTemplates[key] };
+	indexTemplate.numElements = (unsigned int)elements.size();
 
-	//this makes sure the amount of normals is equal to the amount of verticies
-	std::vector <glm::vec3> terrainNormals(terrainVertices.size());
-	std::fill(terrainNormals.begin(), terrainNormals.end(), glm::vec3(0, 0, 0));
+	// No vertex attributes are enabled, the VAO only records the element buffer
+	glGenVertexArrays(1, &indexTemplate.VAO);
+	glBindVertexArray(indexTemplate.VAO);
 
-	//initialises the normals to 0
-	for (size_t index{ 0 }; index < terrainElements.size(); index += 3)
-	{
-		int index1 = terrainElements[index + 0];
-		int index2 = terrainElements[index + 1];
-		int index3 = terrainElements[index + 2];
+	glGenBuffers(1, &indexTemplate.EBO);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexTemplate.EBO);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLushort) * elements.size(), elements.data(), GL_STATIC_DRAW);
 
-		assert(index1 >= 0 && index1 < terrainVertices.size());
-		assert(index2 >= 0 && index2 < terrainVertices.size());
-		assert(index3 >= 0 && index3 < terrainVertices.size());
-
-		glm::vec3 v0 = terrainVertices[index1];
-		glm::vec3 v1 = terrainVertices[index2];
-		glm::vec3 v2 = terrainVertices[index3];
-
-		glm::vec3 edge1 = v1 - v0;
-		glm::vec3 edge2 = v2 - v0;
+	glBindVertexArray(0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
-		glm::vec3 normal = glm::normalize(glm::cross(edge1, edge2));
+	return indexTemplate;
+}
 
-		terrainNormals[index1] += normal;
-		terrainNormals[index2] += normal;
-		terrainNormals[index3] += normal;
+// Splits the terrain into chunks that are drawn from gl_VertexID and a height texture
+// The only per vertex memory is one float in the height texture
+bool Renderer::CreateTerrainChunks(int chunkCells, const Helpers::ImageLoader& terrainTexture)
+{
+	const char* fragmentShader{ m_terrainNormalMapTexture ? "Data/Shaders/terrain_fragment_shader.glsl" : "Data/Shaders/fragment_shader.glsl" };
+	if (!m_terrainProgram.IsValid() &&
+		!CreateProgram("Data/Shaders/terrain_vertex_shader.glsl", fragmentShader, m_terrainProgram))
+		return false;
 
+	const Helpers::Heightfield& heightfield{ m_terrainHeightfield };
+
+	// One texel per grid vertex, fetched unfiltered in the vertex shader
+	glGenTextures(1, &m_terrainHeightTexture);
+	glBindTexture(GL_TEXTURE_2D, m_terrainHeightTexture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, heightfield.NumVertsX(), heightfield.NumVertsZ(), 0, GL_RED, GL_FLOAT,
+		heightfield.GetHeights().data());
+
+	m_terrainTexture = CreateTexture(terrainTexture);
+	m_terrainMaterial = CreateMaterial(m_terrainTexture);
+
+	// Layout of the whole grid never changes, the chunks only need to say where they start
+	glm::vec3 origin{ heightfield.Origin() };
+	glUseProgram(m_terrainProgram.Id());
+	glUniform3f(m_terrainProgram.GetUniformLocation("terrain_origin"), origin.x, origin.y, origin.z);
+	glUniform1f(m_terrainProgram.GetUniformLocation("cell_size"), heightfield.CellSize());
+	glUniform2i(m_terrainProgram.GetUniformLocation("num_cells"), heightfield.NumCellsX(), heightfield.NumCellsZ());
+	glUseProgram(0);
+
+	m_terrainChunks.clear();
+	for (int z{ 0 }; z < heightfield.NumCellsZ(); z += chunkCells)
+	{
+		for (int x{ 0 }; x < heightfield.NumCellsX(); x += chunkCells)
+		{
+			// Edge chunks may be smaller if the terrain is not a whole number of chunks
+			int numCellsX{ std::min(chunkCells, heightfield.NumCellsX() - x) };
+			int numCellsZ{ std::min(chunkCells, heightfield.NumCellsZ() - z) };
+
+			TerrainChunk chunk;
+			chunk.firstVertX = x;
+			chunk.firstVertZ = z;
+			chunk.numVertsX = numCellsX + 1;
+			chunk.indexTemplate = &GetTerrainIndexTemplate(x, z, numCellsX, numCellsZ);
+
+			chunk.vertices.minX = x;
+			chunk.vertices.minZ = z;
+			chunk.vertices.maxX = x + numCellsX;
+			chunk.vertices.maxZ = z + numCellsZ;
+			chunk.bounds = TerrainBounds(chunk.vertices);
+			m_terrainChunks.push_back(chunk);
+		}
 	}
 
-	for (glm::vec3& n : terrainNormals)
-		n = glm::normalize(n);
-
-	GLuint positionsVBO;
-	
-	//Generate 1 buffer id, put the resulting identifier in positionsVBO variable.
-	glGenBuffers(1, &positionsVBO);
-
-	//Bind the buffer to the context at the GL_ARRAY_BUFFER binding point (target).
-	//This is the first time the buffer is used so this also createsthe buffer object.
-	glBindBuffer(GL_ARRAY_BUFFER, positionsVBO);
-	
-	//Fill the bound buffer with the vertices, we pass the size in bytes and a pointer to the data.
-	//the last parameter is a hint to open GL that we will not alter the vertices again.
-	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * terrainVertices.size(), terrainVertices.data(), GL_STATIC_DRAW);
-	
-	//Clear binding - not absolutely required but a good idea!
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	return !Helpers::CheckForGLError();
+}
 
-	GLuint normalsVBO;
-	glGenBuffers(1, &normalsVBO);
-	glBindBuffer(GL_ARRAY_BUFFER, normalsVBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * terrainNormals.size(), terrainNormals.data(), GL_STATIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+// Faces in GL order: +x (right), -x (left), +y (top), -y (bottom), +z (front), -z (back). Returns false on error.
+bool Renderer::LoadSkybox(const std::vector<std::string>& faceFilenames)
+{
+	m_renderGraphChanged = true;
+	if (!m_skyProgram.IsValid() &&
+		!CreateProgram("Data/Shaders/sky_vertex_shader.glsl", "Data/Shaders/sky_fragment_shader.glsl", m_skyProgram))
+		return false;
 
-	GLuint elementsEBO;
-	
-	glGenBuffers(1, &elementsEBO);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementsEBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * terrainElements.size(), terrainElements.data(), GL_STATIC_DRAW);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	return m_skybox.Load(faceFilenames);
+}
 
-	GLuint texcoordVBO;
-	glGenBuffers(1, &texcoordVBO);
-	glBindBuffer(GL_ARRAY_BUFFER, texcoordVBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec2) * uvCoords.size(), uvCoords.data(), GL_STATIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-	terrainMesh.numElements = (GLuint)terrainElements.size();
-
-	//create vao s
-	// Create a unique id for a vertex array object
-	glGenVertexArrays(1, &terrainMesh.VAO);
-
-	// Bind it to be current and since first use this also allocates memory for it
-	// Note no target binding point as there is only one type of vao
-	glBindVertexArray(terrainMesh.VAO);
-
-
-
-	// Enable the first attribute in the program (the vertices) to stream to the vertex shader
-	glEnableVertexAttribArray(0);
-	// Bind the vertex buffer to the context (records this action in the VAO)
-	glBindBuffer(GL_ARRAY_BUFFER, positionsVBO);
-	// Describe the make up of the vertex stream
-	glVertexAttribPointer(
-		0,                  // attribute 0
-		3,                  // size in bytes of each item in the stream
-		GL_FLOAT,           // type of the item
-		GL_FALSE,           // normalized or not (advanced)
-		0,                  // stride (advanced)
-		(void*)0            // array buffer offset (advanced)
-	);
-
-
-	glEnableVertexAttribArray(1);	glBindBuffer(GL_ARRAY_BUFFER, normalsVBO);
-	glVertexAttribPointer(
-		1,
-		3,
-		GL_FLOAT,
-		GL_FALSE,
-		0,
-		(void*)0
-	);
-
-
-	glEnableVertexAttribArray(2);	glBindBuffer(GL_ARRAY_BUFFER, texcoordVBO);
-	glVertexAttribPointer(
-		2,
-		2,
-		GL_FLOAT,
-		GL_FALSE,
-		0,
-		(void*)0
-	);
+// Maps whole rows of the mesh terrain's vertices and writes them straight into the buffer
+// Whole rows are one contiguous range, so the old contents can be discarded without a readback
+bool Renderer::WriteTerrainRows(int firstRow, int numRows)
+{
+	const Helpers::Heightfield& heightfield{ m_terrainHeightfield };
+	const int numVertX{ heightfield.NumVertsX() };
 
-	// Clear VAO binding
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementsEBO);
-	glBindVertexArray(0);
+	GLubyte* vertices{ m_geometry.MapVertices(m_terrainGeometry, firstRow * numVertX, numRows * numVertX) };
+	if (!vertices)
+	{
+		std::cerr << "Could not map terrain vertex buffer" << std::endl;
+		return false;
+	}
 
-	glGenTextures(1, &terrainMesh.textureID);
-	glBindTexture(GL_TEXTURE_2D, terrainMesh.textureID);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
-		GL_LINEAR_MIPMAP_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, terrainTexture.Width(), terrainTexture.Height(), 0, GL_RGBA, GL_UNSIGNED_BYTE, terrainTexture.GetData());
-	glGenerateMipmap(GL_TEXTURE_2D);
-	
-	
-	terrain.myMeshVector.push_back(terrainMesh);
-	myObjectVector.push_back(terrain);
+	// Big terrains and big brushes touch a lot of vertices so share the rows out across the cores
+	Helpers::ThreadPool::Get().ParallelFor(numRows, 16, [&](size_t begin, size_t end)
+	{
+		for (size_t row = begin; row < end; row++)
+		{
+			int z{ firstRow + (int)row };
+			for (int x = 0; x < numVertX; x++)
+			{
+				MeshFormat::Write(vertices, row * numVertX + x,
+					heightfield.GetVertexPosition(x, z), heightfield.ComputeNormal(x, z), heightfield.GetVertexUV(x, z));
+			}
+		}
+	});
 
-	return true;
+	return m_geometry.UnmapVertices();
 }
 
-void Renderer::SkyboxLoader(const std::string& Name, const std::string& textureName)
+// Only the region touched since the last call is refreshed. Vertex normals depend on the
+// neighbouring heights so that region is grown by one vertex before they are recalculated.
+// The mesh terrain is refreshed a whole row at a time as its vertices are interleaved.
+void Renderer::ApplyTerrainEdits()
 {
+	Helpers::GridRect region;
+	if (!m_terrainHeightfield.TakeDirtyRegion(region))
+		return;
 
-	Object Skybox;
+	const Helpers::Heightfield& heightfield{ m_terrainHeightfield };
 
-	Helpers::ModelLoader skyboxLoader;
-	if(!skyboxLoader.LoadFromFile(Name))
-		std::cerr << "Could not load model" << std::endl;
+	m_terrainRaycaster.UpdateRegion(region.minX, region.minZ, region.maxX, region.maxZ);
+	m_terrainOccluderChanged = true;
 
-	Helpers::ImageLoader SkyBoxTexture;
-	if (!SkyBoxTexture.Load(textureName))
-		std::cerr << "Could not load model" << std::endl;
+	// Grow the boxes around the terrain to cover the new heights, they never shrink so stay correct without a full rescan
+	Helpers::BoundingBox editBounds{ TerrainBounds(region) };
+	if (m_terrainObject >= 0)
+	{
+		myObjectVector[m_terrainObject].myMeshVector[0].bounds.Include(editBounds);
+		RefitObject(m_terrainObject);
+	}
+	if (m_terrainMesh.geometry.IsValid())
+		m_terrainMesh.bounds.Include(editBounds);
 
-	for (const Helpers::Mesh& mesh : skyboxLoader.GetMeshVector())
-	{
-		MyMesh modelMesh;
-		//create vbo s
-
-		GLuint normalsVBO;
-		GLuint elementsEBO;
-		GLuint texcoordVBO;
-
-		GLuint positionsVBO;
-		//Generate 1 buffer id, put the resulting identifier in positionsVBO variable.
-		glGenBuffers(1, &positionsVBO);
-
-		//Bind the buffer to the context at the GL_ARRAY_BUFFER binding point (target).
-		//This is the first time the buffer is used so this also createsthe buffer object.
-		glBindBuffer(GL_ARRAY_BUFFER, positionsVBO);
-
-		//Fill the bound buffer with the vertices, we pass the size in bytes and a pointer to the data.
-		//the last parameter is a hint to open GL that we will not alter the vertices again.
-		glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * mesh.vertices.size(), mesh.vertices.data(), GL_STATIC_DRAW);
-
-		//Clear binding - not absolutely required but a good idea!
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-		glGenBuffers(1, &normalsVBO);
-		glBindBuffer(GL_ARRAY_BUFFER, normalsVBO);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * mesh.normals.size(), mesh.normals.data(), GL_STATIC_DRAW);
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-		glGenBuffers(1, &elementsEBO);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementsEBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * mesh.elements.size(), mesh.elements.data(), GL_STATIC_DRAW);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-
-		glGenBuffers(1, &texcoordVBO);
-		glBindBuffer(GL_ARRAY_BUFFER, texcoordVBO);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec2) * mesh.uvCoords.size(), mesh.uvCoords.data(), GL_STATIC_DRAW);
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-		modelMesh.numElements = (GLuint)mesh.elements.size();
-
-		/*	Create a Vertex Array Object (VAO) to wrap or 'record' all bindings etc. needed to render
-			As well as the make up of any streamed data
-			Once we bind the VAO subsequent binds etc. are 'recorded' in the VAO.*/
-
-			// Create a unique id for a vertex array object
-		glGenVertexArrays(1, &modelMesh.VAO);
-
-		// Bind it to be current and since first use this also allocates memory for it
-		// Note no target binding point as there is only one type of vao
-		glBindVertexArray(modelMesh.VAO);
-
-		// Bind the vertex buffer to the context (records this action in the VAO)
-		glBindBuffer(GL_ARRAY_BUFFER, positionsVBO);
-
-		// Enable the first attribute in the program (the vertices) to stream to the vertex shader
-		glEnableVertexAttribArray(0);
-
-		// Describe the make up of the vertex stream
-		glVertexAttribPointer(
-			0,                  // attribute 0
-			3,                  // size in bytes of each item in the stream
-			GL_FLOAT,           // type of the item
-			GL_FALSE,           // normalized or not (advanced)
-			0,                  // stride (advanced)
-			(void*)0            // array buffer offset (advanced)
-		);
-
-		glBindBuffer(GL_ARRAY_BUFFER, normalsVBO);
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(
-			1,
-			3,
-			GL_FLOAT,
-			GL_FALSE,
-			0,
-			(void*)0
-		);
-
-		glBindBuffer(GL_ARRAY_BUFFER, texcoordVBO);
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(
-			2,
-			2,
-			GL_FLOAT,
-			GL_FALSE,
-			0,
-			(void*)0
-		);
-
-		glGenTextures(1, &modelMesh.textureID);
-		glBindTexture(GL_TEXTURE_2D, modelMesh.textureID);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
-			GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, SkyBoxTexture.Width(), SkyBoxTexture.Height(), 0, GL_RGBA, GL_UNSIGNED_BYTE, SkyBoxTexture.GetData());
-		glGenerateMipmap(GL_TEXTURE_2D);
+	// Chunks are small so are simply recalculated
+	for (TerrainChunk& chunk : m_terrainChunks)
+	{
+		if (chunk.vertices.maxX >= region.minX && chunk.vertices.minX <= region.maxX &&
+			chunk.vertices.maxZ >= region.minZ && chunk.vertices.minZ <= region.maxZ)
+			chunk.bounds = TerrainBounds(chunk.vertices);
+	}
 
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementsEBO);
-		glBindVertexArray(0);
+	// Vertex ID chunks read the heights straight from the texture, so just replace the changed texels
+	if (m_terrainHeightTexture)
+	{
+		glBindTexture(GL_TEXTURE_2D, m_terrainHeightTexture);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, heightfield.NumVertsX());
+		glPixelStorei(GL_UNPACK_SKIP_PIXELS, region.minX);
+		glPixelStorei(GL_UNPACK_SKIP_ROWS, region.minZ);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, region.minX, region.minZ, region.maxX - region.minX + 1, region.maxZ - region.minZ + 1,
+			GL_RED, GL_FLOAT, heightfield.GetHeights().data());
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+		glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+		glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+	}
 
-		Skybox.myMeshVector.push_back(modelMesh);
+	// Rebake the lighting detail under the edit, only the changed texels are sent
+	if (m_terrainNormalMapTexture)
+	{
+		Helpers::GridRect texels{ m_terrainNormalMap.Update(heightfield, region) };
+
+		glBindTexture(GL_TEXTURE_2D, m_terrainNormalMapTexture);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, m_terrainNormalMap.Width());
+		glPixelStorei(GL_UNPACK_SKIP_PIXELS, texels.minX);
+		glPixelStorei(GL_UNPACK_SKIP_ROWS, texels.minZ);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, texels.minX, texels.minZ, texels.maxX - texels.minX + 1, texels.maxZ - texels.minZ + 1,
+			GL_RGBA, GL_UNSIGNED_BYTE, m_terrainNormalMap.GetTexels().data());
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+		glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+		glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+		glGenerateMipmap(GL_TEXTURE_2D);
+		glBindTexture(GL_TEXTURE_2D, 0);
 	}
 
-	myObjectVector.push_back(Skybox);
+	// Normals depend on the neighbours so the rows either side change too
+	if (m_terrainGeometry.IsValid())
+	{
+		int firstRow{ std::max(region.minZ - 1, 0) };
+		int lastRow{ std::min(region.maxZ + 1, heightfield.NumCellsZ()) };
+		WriteTerrainRows(firstRow, lastRow - firstRow + 1);
+	}
 }
 
 // Load / create geometry into OpenGL buffers	
 bool Renderer::InitialiseGeometry()
 {
 	// Load and compile shaders into m_program
-	if (!CreateProgram())
+	if (!CreateProgram("Data/Shaders/vertex_shader.glsl", "Data/Shaders/fragment_shader.glsl", m_program))
+		return false;
+
+	if (!CreateProgram("Data/Shaders/depth_vertex_shader.glsl", "Data/Shaders/depth_fragment_shader.glsl", m_depthProgram))
 		return false;
 
+	// Starts with room for a few typical models and grows as needed
+	m_geometry.Initialise(1 << 16, 1 << 18);
+
+	// Camera data for every program, bound once here and rewritten each frame
+	glGenBuffers(1, &m_perFrameUBO);
+	glBindBuffer(GL_UNIFORM_BUFFER, m_perFrameUBO);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(PerFrameUniforms), nullptr, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, KPerFrameBinding, m_perFrameUBO);
+
+	// The same for the light clusters
+	glGenBuffers(1, &m_lightsUBO);
+	glBindBuffer(GL_UNIFORM_BUFFER, m_lightsUBO);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(Helpers::LightGridUniforms), nullptr, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, KLightsBinding, m_lightsUBO);
+	m_lightGrid.Initialise();
+
+	GLint alignment{ 0 };
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	alignment = std::max(alignment, 1);
+	m_materialStride = (sizeof(MaterialUniforms) + alignment - 1) / alignment * alignment;
+	glGenBuffers(1, &m_materialUBO);
+
+	// Material 0 is plain white for anything that binds its own texture
+	CreateMaterial(0);
+
+	// Newer contexts can submit whole batches of draws at once, 3.3 draws them one at a time
+	m_useIndirectDraws = Helpers::IndirectDrawBuffer::IsSupported();
+	if (m_useIndirectDraws)
+		glGenVertexArrays(1, &m_indirectVAO);
+
 	ModelLoader("Data\\Models\\Jeep\\jeep.obj", "Data\\Models\\Jeep\\jeep_Army.jpg");
 
-	CreateTerrain(32,32, "Data\\Terrain\\grass11.bmp");
+	if (m_useProceduralTerrain)
+	{
+		m_streamingTerrain = std::make_unique<StreamingTerrain>();
+
+		if (!m_tiledTerrainFilename.empty())
+		{
+			m_tiledHeightfield = std::make_shared<Helpers::TiledHeightfield>();
+			if (!m_tiledHeightfield->Open(m_tiledTerrainFilename))
+			{
+				if (m_tiledTerrainSourceImage.empty() ||
+					!Helpers::TiledHeightfield::ConvertFromImage(m_tiledTerrainSourceImage, m_tiledTerrainFilename, 100.0f) ||
+					!m_tiledHeightfield->Open(m_tiledTerrainFilename))
+				{
+					std::cerr << "Could not load tiled terrain: " << m_tiledTerrainFilename << std::endl;
+					return false;
+				}
+			}
+
+			m_proceduralTerrainSettings.cellSize = m_tiledHeightfield->CellSize();
+
+			std::shared_ptr<Helpers::TiledHeightfield> heightfield{ m_tiledHeightfield };
+			m_streamingTerrain->SetHeightSource([heightfield](float x, float z, float step, int count, int level, float* heights)
+			{
+				heightfield->SampleRow(x, z, step, count, level, heights);
+			});
+		}
 
-	SkyboxLoader("Data\\Sky\\Mars\\skybox.x", "Data\\Sky\\Mars\\");
+		if (!m_streamingTerrain->Initialise(m_proceduralTerrainSettings, "Data\\Terrain\\grass11.bmp"))
+			return false;
+
+		m_streamingTerrainMaterial = CreateMaterial(m_streamingTerrain->GetTextureID());
+	}
+	else
+	{
+		CreateTerrain(32, 32, "Data\\Terrain\\grass11.bmp");
+	}
+
+	// Not fatal, the scene is just drawn against the clear colour
+	LoadSkybox({ "Data\\Sky\\Mars\\Mar_R.dds", "Data\\Sky\\Mars\\Mar_L.dds", "Data\\Sky\\Mars\\Mar_U.dds",
+		"Data\\Sky\\Mars\\Mar_D.dds", "Data\\Sky\\Mars\\Mar_F.dds", "Data\\Sky\\Mars\\Mar_B.dds" });
 	
 	// Good idea to check for an error now:	
 	Helpers::CheckForGLError();
@@ -535,9 +1295,26 @@ bool Renderer::InitialiseGeometry()
 	return true;
 }
 
+// Call when the framebuffer changes size, sets the viewport and projection used by every following frame
+void Renderer::SetViewportSize(int width, int height)
+{
+	if (width <= 0 || height <= 0)
+		return;
+
+	// Passes set their own viewport, the graph is compiled again for the new size
+	m_viewportWidth = width;
+	m_viewportHeight = height;
+	m_renderGraphChanged = true;
+
+	const float aspect_ratio = width / (float)height;
+	m_projectionXform = glm::perspective(glm::radians(45.0f), aspect_ratio, KNearPlane, KFarPlane);
+}
+
 // Render the scene. Passed the delta time since last called.
 void Renderer::Render(const Helpers::Camera& camera, float deltaTime)
 {		
+	ApplyTerrainEdits();
+
 	// Configure pipeline settings
 	glEnable(GL_DEPTH_TEST);
 	glEnable(GL_CULL_FACE);
@@ -545,45 +1322,137 @@ void Renderer::Render(const Helpers::Camera& camera, float deltaTime)
 	// Uncomment to render in wireframe (can be useful when debugging)
 	//glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 
-	// Clear buffers from previous frame
-	glClearColor(0.0f, 0.0f, 0.0f, 0.f);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	// Compute camera view matrix and combine with the projection, which is only recalculated on resize, for passing to shader
+	glm::mat4 view_xform = glm::lookAt(camera.GetPosition(), camera.GetPosition() + camera.GetLookVector(), camera.GetUpVector());
+	glm::mat4 combined_xform = m_projectionXform * view_xform;
+
+	// One upload shared by every program through the PerFrame block
+	PerFrameUniforms perFrame;
+	perFrame.combinedXform = combined_xform;
+	perFrame.cameraPosition = glm::vec4(camera.GetPosition(), 1.0f);
+	glBindBuffer(GL_UNIFORM_BUFFER, m_perFrameUBO);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(perFrame), &perFrame);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	// Lights are binned into clusters on a worker while the draws are collected. The pool's queue may
+	// hold slow background jobs such as terrain chunks, so whichever of the worker and this thread gets
+	// to it first does the binning and a frame never waits for the queue. A job left queued after this
+	// thread took it only touches the shared state.
+	struct LightBinning
+	{
+		std::atomic<bool> claimed{ false };
+		std::promise<void> done;
+	};
+	std::shared_ptr<LightBinning> lightBinning{ std::make_shared<LightBinning>() };
+	std::future<void> lightsBinned{ lightBinning->done.get_future() };
+	auto binLights = [this, view_xform]
+	{
+		m_lightGrid.Build(m_lights, view_xform, m_projectionXform, KNearPlane, KFarPlane, m_viewportWidth, m_viewportHeight, m_ambientLight);
+	};
+	Helpers::ThreadPool::Get().Submit([lightBinning, binLights]
+	{
+		if (lightBinning->claimed.exchange(true))
+			return;
+		binLights();
+		lightBinning->done.set_value();
+	});
 
-	// Compute viewport and projection matrix
-	GLint viewportSize[4];
-	glGetIntegerv(GL_VIEWPORT, viewportSize);
-	const float aspect_ratio = viewportSize[2] / (float)viewportSize[3];
-	glm::mat4 projection_xform = glm::perspective(glm::radians(45.0f), aspect_ratio, 1.0f, 20000.0f);
+	UploadMaterials();
 
-	// Compute camera view matrix and combine with projection matrix for passing to shader
-	glm::mat4 view_xform = glm::lookAt(camera.GetPosition(), camera.GetPosition() + camera.GetLookVector(), camera.GetUpVector());
-	glm::mat4 combined_xform = projection_xform * view_xform;
+	// Textures every terrain draw shares, on units nothing else uses so they are bound once a frame
+	if (m_terrainNormalMapTexture)
+	{
+		glActiveTexture(GL_TEXTURE0 + KNormalMapTextureUnit);
+		glBindTexture(GL_TEXTURE_2D, m_terrainNormalMapTexture);
+	}
+	if (m_terrainHeightTexture)
+	{
+		glActiveTexture(GL_TEXTURE0 + KHeightTextureUnit);
+		glBindTexture(GL_TEXTURE_2D, m_terrainHeightTexture);
+	}
+	glActiveTexture(GL_TEXTURE0);
 
-	// Use our program. Doing this enables the shaders we attached previously.
-	glUseProgram(m_program);
+	// Collect the frame's draws, the queue orders them by state rather than by when they were added
+	m_renderQueue.Clear();
+	m_renderQueue.SetFrontToBack(Helpers::RenderPass::Opaque, m_depthOrdering == DepthOrdering::FrontToBack);
 
-	// Send the combined matrix to the shader in a uniform
-	GLuint combined_xform_id = glGetUniformLocation(m_program, "combined_xform");
-	glUniformMatrix4fv(combined_xform_id, 1, GL_FALSE, glm::value_ptr(combined_xform));
+	const glm::vec3 cameraPosition{ camera.GetPosition() };
 
-	glm::mat4 model_xform = glm::mat4(1);
-	
-// Send the model matrix to the shader in a uniform
-	GLuint model_xform_id = glGetUniformLocation(m_program, "model_xform");
-	glUniformMatrix4fv(model_xform_id, 1, GL_FALSE, glm::value_ptr(model_xform));
+	// Only what is inside the view volume goes in the queue, objects are tested first then the meshes of those that pass
+	m_frustum.Extract(combined_xform);
 
-	for (Object &model: myObjectVector)
+	// Only the objects whose nodes moved since the last frame have their bounds refitted
+	m_movedObjects.clear();
+	for (Helpers::SceneNode node : m_sceneGraph.Update())
 	{
-		for (int i{ 0 }; i < model.myMeshVector.size(); ++i)
-		{	glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, model.myMeshVector[i].textureID);
-			glUniform1i(glGetUniformLocation(m_program, "sampler_tex"), 0);
+		if (node < m_nodeObjects.size() && m_nodeObjects[node] >= 0)
+			m_movedObjects.push_back((GLuint)m_nodeObjects[node]);
+	}
+	std::sort(m_movedObjects.begin(), m_movedObjects.end());
+	m_movedObjects.erase(std::unique(m_movedObjects.begin(), m_movedObjects.end()), m_movedObjects.end());
+	for (GLuint objectIndex : m_movedObjects)
+		RefitObject(objectIndex);
+
+	if (m_sceneBoundsChanged)
+		UpdateSceneBounds();
+	m_sceneBvh.UpdateRebuild();
+
+	// Then whatever the terrain hides, with everything drawn when there is no occluder to test against
+	if (m_terrainOccluderChanged)
+		BuildTerrainOccluder();
+	m_occlusionBufferReady = m_useOcclusionCulling && !m_terrainOccluderIndices.empty();
+	if (m_occlusionBufferReady)
+	{
+		if (m_occlusionBuffer.Width() == 0)
+			m_occlusionBuffer.Resize(KOcclusionBufferWidth, KOcclusionBufferHeight);
+		m_occlusionBuffer.Clear(combined_xform);
+		m_occlusionBuffer.Rasterise(m_terrainOccluderVertices, m_terrainOccluderIndices);
+	}
+
+	m_visibleObjects.clear();
+	m_sceneBvh.QueryFrustum(m_frustum, m_visibleObjects);
+	QueueVisibleObjects(cameraPosition);
 
-			// Bind our VAO and render
-			glBindVertexArray(model.myMeshVector[i].VAO);
-			glDrawElements(GL_TRIANGLES, model.myMeshVector[i].numElements, GL_UNSIGNED_INT, (void*)0);
+	QueueInstancedModels(cameraPosition);
+
+	// Lit from the normal map so drawn with its own program
+	if (m_terrainMesh.geometry.IsValid() && m_frustum.IsBoxVisible(m_terrainMesh.bounds))
+		QueueMesh(m_renderQueue, m_terrainMesh, glm::mat4(1), m_terrainMeshProgram, Helpers::RenderPass::Opaque, cameraPosition);
+
+	// Chunks are positioned with their own model_xform
+	if (m_streamingTerrain)
+	{
+		// Keep the full detail tiles under the nearby chunks mapped and let the rest go, further chunks
+		// read the coarser levels
+		if (m_tiledHeightfield)
+		{
+			const float chunkWorldSize{ m_proceduralTerrainSettings.chunkCells * m_proceduralTerrainSettings.cellSize };
+			const int fullDetailRadius{ std::max(m_proceduralTerrainSettings.fullDetailRadiusChunks, 1) };
+			m_tiledHeightfield->UpdateResidency(cameraPosition, (fullDetailRadius + 2) * chunkWorldSize);
 		}
+
+		m_streamingTerrain->Update(cameraPosition);
+		m_streamingTerrain->Queue(m_renderQueue, m_program, m_streamingTerrainMaterial, m_frustum, cameraPosition, KFarPlane);
 	}
-		// Always a good idea, when debugging at least, to check for GL errors
-		Helpers::CheckForGLError();
+
+	if (!lightBinning->claimed.exchange(true))
+		binLights();
+	else
+		lightsBinned.wait();
+	m_lightGrid.Upload();
+	m_lightGrid.Bind(KLightTextureUnit, KClusterTextureUnit, KLightIndexTextureUnit);
+	glBindBuffer(GL_UNIFORM_BUFFER, m_lightsUBO);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(Helpers::LightGridUniforms), &m_lightGrid.GetUniforms());
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	// Batches are built from the sorted queue once and drawn by every pass that needs them
+	if (m_useIndirectDraws)
+		BuildIndirectBatches();
+
+	m_combinedXform = combined_xform;
+	if (m_renderGraphChanged)
+		BuildRenderGraph();
+	m_renderGraph.Execute();
+
+	// No glGetError here, it stalls on the driver every frame. Debug builds report errors through EnableGLDebugOutput.
 }
@@ -6,18 +6,146 @@
 #include "Mesh.h"
 #include "Camera.h"
 #include "ImageLoader.h"
+#include "Heightfield.h"
+#include "TerrainRaycaster.h"
+#include "ThreadPool.h"
+#include "StreamingTerrain.h"
+#include "TiledHeightfield.h"
+#include "TerrainNormalMap.h"
+#include "GeometryBuffer.h"
+#include "ShaderProgram.h"
+#include "RenderQueue.h"
+#include "InstanceBuffer.h"
+#include "IndirectDrawBuffer.h"
+#include "Frustum.h"
+#include "Bvh.h"
+#include "OcclusionBuffer.h"
+#include "SceneGraph.h"
+#include "Skybox.h"
+#include "RenderGraph.h"
+#include "LightGrid.h"
 
+#include <tuple>
+#include <future>
+#include <atomic>
+#include <algorithm>
+
+// Layout of every vertex in the shared geometry buffer, 20 bytes a vertex
+using MeshFormat = Helpers::VertexFormat<Helpers::Position3f, Helpers::NormalPacked10, Helpers::UvHalf2>;
+
+// Matches the PerFrame uniform block in the vertex shaders, std140 layout
+struct PerFrameUniforms
+{
+	glm::mat4 combinedXform;
+	glm::vec4 cameraPosition;
+};
+
+// Matches the Material uniform block in the fragment shaders, std140 layout
+struct MaterialUniforms
+{
+	glm::vec4 diffuseColour;
+};
+
+// Texture plus the values that go in its slot of the material uniform buffer
+struct Material
+{
+	GLuint textureID{ 0 };
+	glm::vec4 diffuseColour{ 1.0f };
+};
+
+// A mesh is just its range of the shared geometry buffer, its material and its bounds
+// The bounds are in the space of its scene node, or of its object's node if it has none.
 struct MyMesh
 {
-	GLuint VAO;
-	unsigned int numElements;
-	GLuint textureID;
+	Helpers::GeometryAllocation geometry;
+	GLuint material{ 0 };
+	Helpers::BoundingBox bounds;
+	Helpers::SceneNode node{ Helpers::KNoSceneNode };
 };
 
 struct Object
 {
 	std::string texName;
 	std::vector<MyMesh> myMeshVector;
+
+	// Places the object, created by AddObject if not already set
+	Helpers::SceneNode node{ Helpers::KNoSceneNode };
+
+	// World space box around every mesh, tested before any of them
+	Helpers::BoundingBox bounds;
+};
+
+// A model drawn many times with one instanced draw per mesh
+// Its VAO reads the shared geometry buffer plus the per instance attributes from its instance buffer.
+struct InstancedModel
+{
+	std::vector<MyMesh> meshes;
+	Helpers::InstanceBuffer instances;
+	GLuint VAO{ 0 };
+
+	// Around every mesh of one copy, and around every instance once placed
+	// The instance box is worked out again before the next draw whenever an instance changes
+	Helpers::BoundingBox bounds;
+	Helpers::BoundingBox instanceBounds;
+	bool instanceBoundsChanged{ false };
+
+	// Geometry buffer generation the VAO was set up for
+	unsigned int bufferGeneration{ 0 };
+};
+
+// A run of sorted draws sharing a program, VAO and material, submitted as one multi draw
+// A batch with no commands is a draw that cannot go through the indirect path and is made directly.
+struct IndirectBatch
+{
+	const Helpers::DrawPacket* packet{ nullptr };
+	GLuint VAO{ 0 };
+	GLsizei firstCommand{ 0 };
+	GLsizei numCommands{ 0 };
+};
+
+// How the terrain is drawn, chosen before InitialiseGeometry
+enum class TerrainRenderMode
+{
+	// One mesh with its own positions, normals, uvs and index buffer
+	Mesh,
+
+	// Tiles that share one index buffer per tile size and carry no vertex streams at all
+	// Positions are rebuilt from gl_VertexID and the heights read from a texture
+	VertexIdGrid
+};
+
+// How opaque draws are ordered to cut down on shading pixels that are later drawn over
+enum class DepthOrdering
+{
+	// Sorted to share state, cheapest on the CPU and the driver
+	ByState,
+
+	// Sorted nearest first so the depth test rejects more of what is behind, at the cost of more state changes
+	FrontToBack,
+
+	// Depth drawn first with a position only program, then shaded with GL_EQUAL so each pixel is shaded once
+	PrePass
+};
+
+// Index buffer shared by every terrain chunk of the same size, along with the VAO that records it
+struct TerrainIndexTemplate
+{
+	GLuint VAO{ 0 };
+	GLuint EBO{ 0 };
+	unsigned int numElements{ 0 };
+};
+
+// A tile of the terrain drawn using a shared index template
+struct TerrainChunk
+{
+	int firstVertX{ 0 };
+	int firstVertZ{ 0 };
+	int numVertsX{ 0 };
+	const TerrainIndexTemplate* indexTemplate{ nullptr };
+
+	// Grid vertices covered and the box around them
+	Helpers::GridRect vertices;
+	Helpers::BoundingBox bounds;
 };
 
 class Renderer
@@ -25,25 +153,318 @@ class Renderer
 private:
 
 	std::vector<Object> myObjectVector;
+
+	// Placement of every object, with the object owning each node or -1 for nodes only used for grouping
+	Helpers::SceneGraph m_sceneGraph;
+	std::vector<int> m_nodeObjects;
+	std::vector<GLuint> m_movedObjects;
+
+	// Objects are found through a hierarchy of their bounds, their meshes are then tested in batches
+	// Each object's meshes are a contiguous run of m_meshBounds starting at m_objectFirstMesh.
+	// Both are rebuilt when objects are added, moving an object only refits.
+	Helpers::Frustum m_frustum;
+	Helpers::Bvh m_sceneBvh;
+	Helpers::BoundsSoA m_meshBounds;
+	std::vector<size_t> m_objectFirstMesh;
+	bool m_sceneBoundsChanged{ false };
+	std::vector<GLuint> m_visibleObjects;
+
+	// Draws of the visible objects are built on the thread pool, each job filling its own queue
+	// from a fixed range of m_visibleObjects. They are appended to m_renderQueue in job order.
+	std::vector<Helpers::RenderQueue> m_jobQueues;
+
+	// Low resolution CPU depth buffer of the terrain, objects wholly behind hills are left out of the queue
+	bool m_useOcclusionCulling{ true };
+	Helpers::OcclusionBuffer m_occlusionBuffer;
+
+	// Coarse copy of the heightfield that never rises above it, rebuilt after edits
+	std::vector<glm::vec3> m_terrainOccluderVertices;
+	std::vector<GLuint> m_terrainOccluderIndices;
+	bool m_terrainOccluderChanged{ false };
+
+	// Set once the occlusion buffer holds this frame's terrain
+	bool m_occlusionBufferReady{ false };
+
+	// Indexed by the ids returned from LoadInstancedModel
+	std::vector<std::unique_ptr<InstancedModel>> m_instancedModels;
+
+	// Vertices and indices of every static mesh, drawn with one VAO bind
+	Helpers::GeometryBuffer<MeshFormat> m_geometry;
 	// Program object - to host shaders
-	GLuint m_program{ 0 };
+	Helpers::ShaderProgram m_program;
+
+	// Positions only, lays down the depth of the opaque draws before they are shaded
+	Helpers::ShaderProgram m_depthProgram;
+	DepthOrdering m_depthOrdering{ DepthOrdering::ByState };
+
+	// Cube map sky drawn after the queue, at the far plane
+	Helpers::Skybox m_skybox;
+	Helpers::ShaderProgram m_skyProgram;
+
+	// The frame's GPU passes, declared and compiled again only when they or the framebuffer size change
+	Helpers::RenderGraph m_renderGraph;
+	bool m_renderGraphChanged{ true };
+	int m_viewportWidth{ 0 };
+	int m_viewportHeight{ 0 };
+
+	// This frame's camera, for passes drawing outside the render queue
+	glm::mat4 m_combinedXform{ 1.0f };
+
+	// Program used by the vertex ID terrain chunks
+	Helpers::ShaderProgram m_terrainProgram;
+
+	// Program used by the mesh terrain when it is lit from the baked normal map
+	Helpers::ShaderProgram m_terrainMeshProgram;
+
+	// Camera data written once a frame and bound once for every program
+	GLuint m_perFrameUBO{ 0 };
+
+	// Point lights and the clusters they are binned into each frame, with the cluster layout in m_lightsUBO
+	std::vector<Helpers::PointLight> m_lights;
+	Helpers::LightGrid m_lightGrid;
+	GLuint m_lightsUBO{ 0 };
+	glm::vec3 m_ambientLight{ 1.0f };
+
+	// Only recalculated when the framebuffer is resized
+	glm::mat4 m_projectionXform{ 1.0f };
+
+	// Every material's uniforms, each at its own aligned offset so a draw just binds a range
+	std::vector<Material> m_materials;
+	GLuint m_materialUBO{ 0 };
+	GLsizeiptr m_materialStride{ 0 };
+	bool m_materialsChanged{ false };
 
-	bool CreateProgram();
+	// Draws for the frame, sorted so draws sharing a program, material and VAO go together
+	Helpers::RenderQueue m_renderQueue;
+
+	// Multi draw indirect submission, used when the context supports it
+	bool m_useIndirectDraws{ false };
+	Helpers::IndirectDrawBuffer m_indirectDraws;
+	std::vector<IndirectBatch> m_indirectBatches;
+
+	// Reads the geometry buffer plus the per draw instances, stands in for the geometry VAO for single copies
+	GLuint m_indirectVAO{ 0 };
+	unsigned int m_indirectVAOGeneration{ 0 };
+
+	// CPU copy of the terrain heights and the acceleration structure used to query them
+	Helpers::Heightfield m_terrainHeightfield;
+	Helpers::TerrainRaycaster m_terrainRaycaster;
+
+	TerrainRenderMode m_terrainRenderMode{ TerrainRenderMode::Mesh };
+
+	// Mesh mode terrain's part of the geometry buffer, kept so edits can update it in place
+	Helpers::GeometryAllocation m_terrainGeometry;
+
+	// Index of the mesh terrain in myObjectVector so edits can update its bounds, -1 if it is not there
+	int m_terrainObject{ -1 };
+
+	// Vertex ID terrain, the heights live in a single channel float texture
+	GLuint m_terrainHeightTexture{ 0 };
+	GLuint m_terrainTexture{ 0 };
+	GLuint m_terrainMaterial{ 0 };
+	std::vector<TerrainChunk> m_terrainChunks;
+
+	// Lighting detail baked from the full resolution heightmap so the mesh itself can be coarse
+	bool m_useTerrainNormalMap{ false };
+	int m_terrainNormalMapDetail{ 16 };
+	bool m_terrainNormalMapCurvature{ false };
+	Helpers::TerrainNormalMap m_terrainNormalMap;
+	GLuint m_terrainNormalMapTexture{ 0 };
+
+	// Normal mapped mesh terrain, drawn with m_terrainMeshProgram rather than with the other objects
+	MyMesh m_terrainMesh;
+
+	// Noise based terrain streamed in around the camera, replaces the heightmap terrain when enabled
+	bool m_useProceduralTerrain{ false };
+	ProceduralTerrainSettings m_proceduralTerrainSettings;
+	std::unique_ptr<StreamingTerrain> m_streamingTerrain;
+	GLuint m_streamingTerrainMaterial{ 0 };
+
+	// Streams the procedural terrain's heights from a tiled file on disk instead of the noise
+	std::string m_tiledTerrainFilename;
+	std::string m_tiledTerrainSourceImage;
+	std::shared_ptr<Helpers::TiledHeightfield> m_tiledHeightfield;
+
+	// Keyed by chunk cells across, cells down and whether the first cell is a diamond one
+	std::map<std::tuple<int, int, bool>, TerrainIndexTemplate> m_terrainIndexTemplates;
+
+	// Links the program and points its uniform blocks and samplers at the renderer's fixed binding points
+	bool CreateProgram(const std::string& vertexShaderFilename, const std::string& fragmentShaderFilename, Helpers::ShaderProgram& program);
+
+	GLuint CreateTexture(const Helpers::ImageLoader& image) const;
+
+	// Returns the index of a new material, its uniforms are uploaded before the next frame is drawn
+	GLuint CreateMaterial(GLuint textureID, const glm::vec4& diffuseColour = glm::vec4(1.0f));
+	void UploadMaterials();
+	void BindMaterial(GLuint material) const;
+
+	// Copies a loaded mesh into the geometry buffer as interleaved vertices, returns false on error
+	bool CreateMesh(const Helpers::Mesh& mesh, GLuint material, MyMesh& myMesh);
+
+	// Loads every mesh of a model into the geometry buffer sharing one material, returns false on error
+	// With a parent node the model's node hierarchy is added below it and each mesh placed by its node,
+	// otherwise the meshes are returned in file order with the node transforms ignored.
+	bool LoadModelMeshes(const std::string& modelName, const std::string& textureName, std::vector<MyMesh>& meshes,
+		Helpers::SceneNode parent = Helpers::KNoSceneNode);
+
+	// Creates a scene node for a model node and its children, adding a copy of each mesh they place
+	void AddModelNodes(const Helpers::Node& modelNode, Helpers::SceneNode parent, const std::vector<MyMesh>& modelMeshes, std::vector<MyMesh>& meshes);
+
+	// World space box around a mesh of an object
+	Helpers::BoundingBox MeshWorldBounds(const Object& object, const MyMesh& mesh) const;
+	const glm::mat4& MeshWorldTransform(const Object& object, const MyMesh& mesh) const;
+
+	// Adds an object, returning its index. Its bounds are worked out when the scene bounds are next updated.
+	size_t AddObject(Object object);
+
+	// Rebuilds the object hierarchy and the batched mesh bounds from myObjectVector
+	void UpdateSceneBounds();
+
+	// Call after changing an object's mesh bounds or moving its nodes
+	void RefitObject(size_t objectIndex);
+
+	// World space box around an inclusive range of terrain vertices
+	Helpers::BoundingBox TerrainBounds(const Helpers::GridRect& region) const;
+
+	// Fills m_terrainOccluderVertices and m_terrainOccluderIndices from the heightfield
+	void BuildTerrainOccluder();
+
+	// Uploads changed instances, sets up the VAOs that need it and queues a draw per mesh
+	void QueueInstancedModels(const glm::vec3& cameraPosition);
+
+	// False if the occlusion buffer shows the box is wholly behind the terrain
+	bool IsUnoccluded(const Helpers::BoundingBox& bounds) const { return !m_occlusionBufferReady || m_occlusionBuffer.IsBoxVisible(bounds); }
+
+	// Culls the meshes of m_visibleObjects and queues their draws, spread across the thread pool
+	void QueueVisibleObjects(const glm::vec3& cameraPosition);
+
+	// Adds a draw of a mesh in the geometry buffer placed by modelXform to queue, safe to call from several threads with different queues
+	void QueueMesh(Helpers::RenderQueue& queue, const MyMesh& mesh, const glm::mat4& modelXform, const Helpers::ShaderProgram& program,
+		Helpers::RenderPass pass, const glm::vec3& cameraPosition) const;
+
+	// Draws the sorted queue, depth only draws are the pre-pass of the opaque draws
+	void SubmitRenderQueue(bool depthOnly);
+
+	// Declares the frame's passes in m_renderGraph and compiles it
+	void BuildRenderGraph();
+
+	// Vertex ID chunks set their own per draw uniforms so are drawn directly rather than through the queue
+	void DrawTerrainChunks();
+
+	// Depth test and writes for the draws of a pass
+	void SetPassDepthState(Helpers::RenderPass pass, bool depthOnly) const;
+
+	// Draws the sorted queue one packet at a time, only binding what differs from the previous draw
+	void DrawRenderQueue(bool depthOnly);
+
+	// Multi draw indirect submission used by SubmitRenderQueue when supported, one multi draw per batch of state
+	// The batches are built once and drawn for each pass over the queue.
+	void BuildIndirectBatches();
+	void DrawIndirectBatches(bool depthOnly);
+
+	bool CreateTerrainChunks(int chunkCells, const Helpers::ImageLoader& terrainTexture);
+
+	bool CreateTerrainNormalMap(const std::string& heightmapFilename);
+
+	// Maps whole rows of the mesh terrain's vertices and writes them straight into the buffer
+	bool WriteTerrainRows(int firstRow, int numRows);
+
+	// Pushes any heightfield edits made since the last frame to the query structures and the GPU
+	void ApplyTerrainEdits();
+	const TerrainIndexTemplate& GetTerrainIndexTemplate(int firstCellX, int firstCellZ, int numCellsX, int numCellsZ);
 
 public:
 	Renderer()=default;
 	~Renderer();
 
-	void ModelLoader(const std::string& modelName, const std::string& textureName);
+	// Must be called before InitialiseGeometry to have any effect
+	void SetTerrainRenderMode(TerrainRenderMode mode) { m_terrainRenderMode = mode; }
+
+	// Light the terrain from a normal map baked at detailPerCell texels per mesh cell, optionally with
+	// curvature for crease darkening. Must be called before InitialiseGeometry.
+	void EnableTerrainNormalMap(int detailPerCell = 16, bool bakeCurvature = false)
+	{
+		m_useTerrainNormalMap = true;
+		m_terrainNormalMapDetail = detailPerCell;
+		m_terrainNormalMapCurvature = bakeCurvature;
+	}
+
+	// Use endless noise generated terrain instead of the heightmap, must be called before InitialiseGeometry
+	void EnableProceduralTerrain(const ProceduralTerrainSettings& settings)
+	{
+		m_useProceduralTerrain = true;
+		m_proceduralTerrainSettings = settings;
+	}
+
+	// Streams terrain from a tiled heightfield file, converting sourceImageFilename to it first if the
+	// file does not exist yet. The file's cell size overrides the one in settings. Call before InitialiseGeometry.
+	void EnableTiledTerrain(const std::string& tiledFilename, const std::string& sourceImageFilename,
+		const ProceduralTerrainSettings& settings)
+	{
+		EnableProceduralTerrain(settings);
+		m_tiledTerrainFilename = tiledFilename;
+		m_tiledTerrainSourceImage = sourceImageFilename;
+	}
+
+	// Loads a model as a new object placed by xform relative to parent, returns the object's index or -1 on error
+	int ModelLoader(const std::string& modelName, const std::string& textureName, const glm::mat4& xform = glm::mat4(1),
+		Helpers::SceneNode parent = Helpers::KNoSceneNode);
 
-	bool CreateTerrain(int numCellsX, int numCellsZ, const std::string& textureFilename);
+	// Moves an object by replacing its node's local transform, the move is picked up by the next Render
+	void SetObjectTransform(size_t objectIndex, const glm::mat4& xform) { m_sceneGraph.SetLocalTransform(myObjectVector[objectIndex].node, xform); }
 
-	void SkyboxLoader(const std::string& Name, const std::string& textureName);
+	// The node an object is placed by, other objects can be loaded below it to move along with it
+	Helpers::SceneNode GetObjectNode(size_t objectIndex) const { return myObjectVector[objectIndex].node; }
+
+	// Every object's nodes along with any extra ones for grouping, local transforms set through this are picked up by the next Render
+	Helpers::SceneGraph& GetSceneGraph() { return m_sceneGraph; }
+
+	// Loads a model to be drawn as many instances, returns its id or -1 on error. Call after InitialiseGeometry.
+	int LoadInstancedModel(const std::string& modelName, const std::string& textureName);
+
+	// Instances of a model loaded with LoadInstancedModel, changes are sent to the GPU on the next Render
+	Helpers::InstanceHandle AddInstance(int model, const glm::mat4& modelXform, const glm::vec4& tint = glm::vec4(1.0f));
+	void UpdateInstance(int model, Helpers::InstanceHandle instance, const glm::mat4& modelXform, const glm::vec4& tint = glm::vec4(1.0f));
+	void RemoveInstance(int model, Helpers::InstanceHandle instance);
+
+	bool CreateTerrain(int numCellsX, int numCellsZ, const std::string& textureFilename,
+		const std::string& heightmapFilename = "Data\\Terrain\\curvy.gif");
+
+	// Replaces the sky with a cube map, faces in GL order: +x (right), -x (left), +y (top), -y (bottom), +z (front), -z (back)
+	// Returns false on error, the scene is then drawn against the clear colour.
+	bool LoadSkybox(const std::vector<std::string>& faceFilenames);
+
+	// Can be changed at any time, takes effect from the next Render
+	void SetDepthOrdering(DepthOrdering ordering) { m_depthOrdering = ordering; m_renderGraphChanged = true; }
+
+	// Call when the framebuffer changes size, sets the viewport and projection used by every following frame
+	// A zero size, e.g. when minimised, keeps the previous projection.
+	void SetViewportSize(int width, int height);
 
 	// Create and / or load geometry, this is like 'level load'
 	bool InitialiseGeometry();
 
 	// Render the scene
 	void Render(const Helpers::Camera& camera, float deltaTime);
+
+	// Terrain heights, edits made through this (Raise, Flatten, Stamp etc.) are uploaded on the next Render
+	Helpers::Heightfield& GetTerrainHeightfield() { return m_terrainHeightfield; }
+
+	// Ray, segment and line of sight queries against the terrain (picking, projectiles etc.)
+	const Helpers::TerrainRaycaster& GetTerrainRaycaster() const { return m_terrainRaycaster; }
+
+	// Skip objects hidden behind the terrain, on by default
+	void SetOcclusionCulling(bool enabled) { m_useOcclusionCulling = enabled; }
+
+	// Point lights, binned into clusters each frame so a pixel only pays for the lights near it
+	size_t AddLight(const Helpers::PointLight& light) { m_lights.push_back(light); return m_lights.size() - 1; }
+	void SetLight(size_t lightIndex, const Helpers::PointLight& light) { m_lights[lightIndex] = light; }
+	void ClearLights() { m_lights.clear(); }
+
+	// Light every surface gets on top of the point lights, white leaves unlit surfaces at their texture colour
+	void SetAmbientLight(const glm::vec3& colour) { m_ambientLight = colour; }
+
+	// Radius and ray queries against object bounds, the items are indices of the loaded objects
+	const Helpers::Bvh& GetSceneBvh() const { return m_sceneBvh; }
 };
 
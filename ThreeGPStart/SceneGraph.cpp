@@ -0,0 +1,51 @@
+#include "SceneGraph.h"
+
+namespace Helpers
+{
+	// Adds a node, parent must already exist or be KNoSceneNode for a root
+	SceneNode SceneGraph::CreateNode(const glm::mat4& localTransform, SceneNode parent)
+	{
+		SceneNode node{ (SceneNode)m_parents.size() };
+
+		m_localTransforms.push_back(localTransform);
+		m_worldTransforms.push_back(localTransform);
+		m_parents.push_back(parent < node ? parent : KNoSceneNode);
+		m_dirty.push_back(1);
+		m_changed.push_back(0);
+
+		m_firstDirty = std::min(m_firstDirty, (size_t)node);
+		return node;
+	}
+
+	void SceneGraph::SetLocalTransform(SceneNode node, const glm::mat4& localTransform)
+	{
+		m_localTransforms[node] = localTransform;
+		m_dirty[node] = 1;
+		m_firstDirty = std::min(m_firstDirty, (size_t)node);
+	}
+
+	// Parents come first, so a node is recalculated when it was flagged or its parent has just been
+	const std::vector<SceneNode>& SceneGraph::Update()
+	{
+		// Flags from the last call, cleared here rather than by walking every node
+		for (SceneNode node : m_changedNodes)
+			m_changed[node] = 0;
+		m_changedNodes.clear();
+
+		for (size_t i = m_firstDirty; i < m_parents.size(); i++)
+		{
+			SceneNode parent{ m_parents[i] };
+			bool parentChanged{ parent != KNoSceneNode && m_changed[parent] };
+			if (!m_dirty[i] && !parentChanged)
+				continue;
+
+			m_worldTransforms[i] = parent == KNoSceneNode ? m_localTransforms[i] : m_worldTransforms[parent] * m_localTransforms[i];
+			m_dirty[i] = 0;
+			m_changed[i] = 1;
+			m_changedNodes.push_back((SceneNode)i);
+		}
+
+		m_firstDirty = SIZE_MAX;
+		return m_changedNodes;
+	}
+}
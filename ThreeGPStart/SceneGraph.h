@@ -0,0 +1,51 @@
+#pragma once
+
+#include "ExternalLibraryHeaders.h"
+
+#include <cstdint>
+#include <algorithm>
+
+namespace Helpers
+{
+	// Index of a node in a SceneGraph
+	using SceneNode = GLuint;
+	const SceneNode KNoSceneNode = 0xFFFFFFFF;
+
+	// Hierarchy of transforms, each node placed relative to its parent
+	// A node must be created after its parent, so walking the nodes in order always reaches a parent
+	// before its children and one pass brings every world transform up to date.
+	// Setting a local transform only flags the node, Update then recalculates it and everything below
+	// it and nothing else. World transforms are kept in one contiguous array ready to upload.
+	class SceneGraph
+	{
+	private:
+		std::vector<glm::mat4> m_localTransforms;
+		std::vector<glm::mat4> m_worldTransforms;
+		std::vector<SceneNode> m_parents;
+
+		// Local transform set since the last Update, and world transform recalculated by the last Update
+		std::vector<uint8_t> m_dirty;
+		std::vector<uint8_t> m_changed;
+		std::vector<SceneNode> m_changedNodes;
+
+		// Nodes before this have nothing to recalculate
+		size_t m_firstDirty{ SIZE_MAX };
+	public:
+		// Adds a node, parent must already exist or be KNoSceneNode for a root
+		SceneNode CreateNode(const glm::mat4& localTransform = glm::mat4(1), SceneNode parent = KNoSceneNode);
+
+		void SetLocalTransform(SceneNode node, const glm::mat4& localTransform);
+		const glm::mat4& GetLocalTransform(SceneNode node) const { return m_localTransforms[node]; }
+
+		// As of the last Update
+		const glm::mat4& GetWorldTransform(SceneNode node) const { return m_worldTransforms[node]; }
+		const std::vector<glm::mat4>& GetWorldTransforms() const { return m_worldTransforms; }
+
+		SceneNode GetParent(SceneNode node) const { return m_parents[node]; }
+		size_t NumNodes() const { return m_parents.size(); }
+
+		// Recalculates the world transforms of flagged nodes and their descendants
+		// Returns the nodes whose world transform changed, valid until the next call
+		const std::vector<SceneNode>& Update();
+	};
+}
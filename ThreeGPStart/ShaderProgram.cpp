@@ -0,0 +1,111 @@
+#include "ShaderProgram.h"
+
+namespace Helpers
+{
+	ShaderProgram::~ShaderProgram()
+	{
+		glDeleteProgram(m_program);
+	}
+
+	// Load, compile and link the shaders and create a program object to host them
+	bool ShaderProgram::Create(const std::string& vertexShaderFilename, const std::string& fragmentShaderFilename)
+	{
+		glDeleteProgram(m_program);
+		m_uniformLocations.clear();
+
+		// Create a new program (returns a unqiue id)
+		m_program = glCreateProgram();
+
+		// Load and create vertex and fragment shaders
+		GLuint vertex_shader{ LoadAndCompileShader(GL_VERTEX_SHADER, vertexShaderFilename) };
+		GLuint fragment_shader{ LoadAndCompileShader(GL_FRAGMENT_SHADER, fragmentShaderFilename) };
+		if (vertex_shader == 0 || fragment_shader == 0)
+		{
+			glDeleteShader(vertex_shader);
+			glDeleteShader(fragment_shader);
+			glDeleteProgram(m_program);
+			m_program = 0;
+			return false;
+		}
+
+		// Attach the shaders to this program (copies them)
+		glAttachShader(m_program, vertex_shader);
+		glAttachShader(m_program, fragment_shader);
+
+		// Done with the originals of these as we have made copies
+		glDeleteShader(vertex_shader);
+		glDeleteShader(fragment_shader);
+
+		// Link the shaders, checking for errors
+		if (!LinkProgramShaders(m_program))
+		{
+			glDeleteProgram(m_program);
+			m_program = 0;
+			return false;
+		}
+
+		ReflectUniforms();
+
+		return !CheckForGLError();
+	}
+
+	// Reads back every active uniform outside a uniform block
+	void ShaderProgram::ReflectUniforms()
+	{
+		GLint numUniforms{ 0 };
+		glGetProgramiv(m_program, GL_ACTIVE_UNIFORMS, &numUniforms);
+
+		GLint maxNameLength{ 0 };
+		glGetProgramiv(m_program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+		std::vector<GLchar> name((size_t)std::max(maxNameLength, 1));
+
+		for (GLuint i = 0; i < (GLuint)numUniforms; i++)
+		{
+			// Members of uniform blocks have no location
+			GLint blockIndex{ -1 };
+			glGetActiveUniformsiv(m_program, 1, &i, GL_UNIFORM_BLOCK_INDEX, &blockIndex);
+			if (blockIndex != -1)
+				continue;
+
+			GLsizei length{ 0 };
+			GLint size{ 0 };
+			GLenum type{ 0 };
+			glGetActiveUniform(m_program, i, (GLsizei)name.size(), &length, &size, &type, name.data());
+
+			std::string uniformName(name.data(), length);
+			GLint location{ glGetUniformLocation(m_program, uniformName.c_str()) };
+			m_uniformLocations[uniformName] = location;
+
+			// Arrays are reported as name[0] but are usually looked up by the plain name
+			size_t bracket{ uniformName.find('[') };
+			if (bracket != std::string::npos)
+				m_uniformLocations[uniformName.substr(0, bracket)] = location;
+		}
+	}
+
+	// Cached location, -1 if the program has no such active uniform
+	GLint ShaderProgram::GetUniformLocation(const std::string& name) const
+	{
+		auto found{ m_uniformLocations.find(name) };
+		return found != m_uniformLocations.end() ? found->second : -1;
+	}
+
+	// Points a uniform block at a binding point, does nothing if the program does not use the block
+	void ShaderProgram::BindUniformBlock(const std::string& blockName, GLuint bindingPoint) const
+	{
+		GLuint blockIndex{ glGetUniformBlockIndex(m_program, blockName.c_str()) };
+		if (blockIndex != GL_INVALID_INDEX)
+			glUniformBlockBinding(m_program, blockIndex, bindingPoint);
+	}
+
+	// Sampler uniforms never change so are set once here, leaves the program in use
+	void ShaderProgram::SetSampler(const std::string& name, GLint textureUnit) const
+	{
+		GLint location{ GetUniformLocation(name) };
+		if (location == -1)
+			return;
+
+		glUseProgram(m_program);
+		glUniform1i(location, textureUnit);
+	}
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "ExternalLibraryHeaders.h"
+#include "Helper.h"
+
+#include <unordered_map>
+
+namespace Helpers
+{
+	// A linked program along with the locations of all its active uniforms
+	// The locations are read back once after linking so drawing never has to ask the driver by name
+	class ShaderProgram
+	{
+	private:
+		GLuint m_program{ 0 };
+		std::unordered_map<std::string, GLint> m_uniformLocations;
+
+		// Reads back every active uniform outside a uniform block
+		void ReflectUniforms();
+	public:
+		ShaderProgram() = default;
+		~ShaderProgram();
+
+		ShaderProgram(const ShaderProgram&) = delete;
+		ShaderProgram& operator=(const ShaderProgram&) = delete;
+
+		// Load, compile and link the shaders. Returns false on error.
+		bool Create(const std::string& vertexShaderFilename, const std::string& fragmentShaderFilename);
+
+		bool IsValid() const { return m_program != 0; }
+		GLuint Id() const { return m_program; }
+		void Use() const { glUseProgram(m_program); }
+
+		// Cached location, -1 if the program has no such active uniform
+		GLint GetUniformLocation(const std::string& name) const;
+
+		// Points a uniform block at a binding point, does nothing if the program does not use the block
+		void BindUniformBlock(const std::string& blockName, GLuint bindingPoint) const;
+
+		// Sampler uniforms never change so are set once here, leaves the program in use
+		void SetSampler(const std::string& name, GLint textureUnit) const;
+	};
+}
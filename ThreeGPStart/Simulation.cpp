@@ -1,6 +1,33 @@
 #include "Simulation.h"
 #include "Renderer.h"
 
+#include <thread>
+#include <chrono>
+
+// The simulation always advances by this much, however fast frames are drawn
+static const double KSimulationStep = 1.0 / 60.0;
+
+// Most steps run for one frame, past this the simulation falls behind real time rather than
+// taking ever longer to catch up
+static const int KMaxStepsPerFrame = 5;
+
+// For render thread frames with no new snapshot, nothing has been placed since the last
+static const std::vector<std::pair<size_t, glm::mat4>> KNoObjectTransforms;
+
+// Sets an object's entry in a list of placements, adding one if it has none
+static void SetPlacement(std::vector<std::pair<size_t, glm::mat4>>& placements, size_t objectIndex, const glm::mat4& xform)
+{
+	for (auto& placement : placements)
+	{
+		if (placement.first == objectIndex)
+		{
+			placement.second = xform;
+			return;
+		}
+	}
+	placements.push_back(std::make_pair(objectIndex, xform));
+}
+
 // Initialise this as well as the renderer, returns false on error
 bool Simulation::Initialise()
 {
@@ -8,10 +35,47 @@ bool Simulation::Initialise()
 	m_camera = std::make_shared<Helpers::Camera>();
 	m_camera->Initialise(glm::vec3(0, 200, 900), glm::vec3(0)); // Jeep
 	//m_camera->Initialise(glm::vec3(-13.82f, 5.0f, 1.886f), glm::vec3(0.25f, 1.5f, 0), 30.0f,0.8f); // Aqua pig
+	m_previousCamera = *m_camera;
 
 	// Set up renderer
 	m_renderer = std::make_shared<Renderer>();
-	return m_renderer->InitialiseGeometry();
+	//m_renderer->EnableProceduralTerrain(ProceduralTerrainSettings()); // Endless noise terrain instead of the heightmap
+	//m_renderer->EnableTiledTerrain("Data\\Terrain\\curvy.thf", "Data\\Terrain\\curvy.gif", ProceduralTerrainSettings()); // Terrain paged in from a tiled file
+	//m_renderer->EnableTerrainNormalMap(16, true); // Light the terrain from a baked normal map, lets the mesh be coarser
+	if (!m_renderer->InitialiseGeometry())
+		return false;
+
+	// Many copies of a model, drawn with one instanced draw per mesh
+	//int jeep{ m_renderer->LoadInstancedModel("Data\\Models\\Jeep\\jeep.obj", "Data\\Models\\Jeep\\jeep_Army.jpg") };
+	//for (int i = 0; i < 1000; i++)
+	//	m_renderer->AddInstance(jeep, glm::translate(glm::mat4(1), glm::vec3((i % 40) * 600.0f, 0, (i / 40) * -600.0f)));
+
+	// Objects placed through the scene graph, the second follows the first wherever it is moved with SetObjectTransform
+	//int leader{ m_renderer->ModelLoader("Data\\Models\\Jeep\\jeep.obj", "Data\\Models\\Jeep\\jeep_Army.jpg", glm::translate(glm::mat4(1), glm::vec3(600, 0, 0))) };
+	//m_renderer->ModelLoader("Data\\Models\\Jeep\\jeep.obj", "Data\\Models\\Jeep\\jeep_Army.jpg", glm::translate(glm::mat4(1), glm::vec3(0, 0, 600)), m_renderer->GetObjectNode(leader));
+
+	// Hundreds of coloured point lights scattered over the terrain, each pixel only pays for the few near it
+	//for (int i = 0; i < 400; i++)
+	//{
+	//	Helpers::PointLight light;
+	//	light.position = glm::vec3((i % 20) * 200.0f - 2000.0f, 40.0f, (i / 20) * 200.0f - 2000.0f);
+	//	light.radius = 150.0f;
+	//	light.colour = glm::vec3((i % 3) == 0, (i % 3) == 1, (i % 3) == 2);
+	//	m_renderer->AddLight(light);
+	//}
+	//m_renderer->SetAmbientLight(glm::vec3(0.3f));
+
+	// Loading may have taken a while, none of it should be simulated
+	m_lastTime = glfwGetTime();
+
+	return true;
+}
+
+// Call when the window's framebuffer changes size, including once at the start
+// Only recorded here, the thread with the GL context applies it before its next frame
+void Simulation::OnFramebufferResize(int width, int height)
+{
+	m_framebufferSize.store((uint64_t)(uint32_t)width << 32 | (uint32_t)height);
 }
 
 // Handle any user input. Return false if program should close.
@@ -42,17 +106,197 @@ bool Simulation::Update(GLFWwindow* window)
 	if (!HandleInput(window))
 		return false;
 
+	double frameStart{ m_lastTime };
+	Simulate(window);
+
+	// Draw part way between the last two steps by how far real time has got into the next one
+	Helpers::Camera renderCamera;
+	renderCamera.Interpolate(m_previousCamera, *m_camera, (float)(m_accumulator / KSimulationStep));
+
+	// Render the scene, objects not placed since the last frame are left alone so the scene graph has nothing to redo
+	RenderFrame(renderCamera, (float)(m_lastTime - frameStart), m_objectTransforms);
+	m_objectTransforms.clear();
+
+	return true;
+}
+
+// Runs as many fixed steps as real time has moved on by, returns how many ran
+int Simulation::Simulate(GLFWwindow* window)
+{
 	// Calculate delta time since last called
-	// We pass the delta time to the camera and renderer
-	float timeNow = (float)glfwGetTime();
-	float deltaTime{ timeNow - m_lastTime };
+	double timeNow = glfwGetTime();
+	double deltaTime{ timeNow - m_lastTime };
 	m_lastTime = timeNow;
 
-	// The camera needs updating to handle user input internally
-	m_camera->Update(window, deltaTime);
+	// Simulate in fixed steps until caught up with real time
+	m_accumulator += deltaTime;
+	int steps{ 0 };
+	while (m_accumulator >= KSimulationStep && steps < KMaxStepsPerFrame)
+	{
+		m_previousCamera = *m_camera;
+		Step(window, (float)KSimulationStep);
+		m_accumulator -= KSimulationStep;
+		steps++;
+	}
+
+	// Too far behind, e.g. after a stall, so drop the backlog instead of spending the next frames on it
+	if (m_accumulator >= KSimulationStep)
+		m_accumulator = 0;
+
+	return steps;
+}
+
+// Applies any resize and object moves then draws
+void Simulation::RenderFrame(const Helpers::Camera& camera, float deltaTime, const std::vector<std::pair<size_t, glm::mat4>>& objectTransforms)
+{
+	uint64_t framebufferSize{ m_framebufferSize.load() };
+	if (framebufferSize != m_appliedFramebufferSize)
+	{
+		m_renderer->SetViewportSize((int)(framebufferSize >> 32), (int)(framebufferSize & 0xFFFFFFFF));
+		m_appliedFramebufferSize = framebufferSize;
+	}
+
+	for (const auto& placement : objectTransforms)
+		m_renderer->SetObjectTransform(placement.first, placement.second);
+
+	m_renderer->Render(camera, deltaTime);
+}
+
+// Instead of Initialise and Update, runs the whole program with the GL context on a render thread
+bool Simulation::RunWithRenderThread(GLFWwindow* window)
+{
+	// A context can only be current on one thread at a time
+	glfwMakeContextCurrent(nullptr);
+
+	m_stopRendering = false;
+	std::promise<bool> initialised;
+	std::future<bool> initialisedResult{ initialised.get_future() };
+	std::thread renderThread([this, window, &initialised] { RenderThread(window, initialised); });
+
+	// Loading happens on the render thread, keep the window responding meanwhile
+	while (initialisedResult.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+		glfwWaitEventsTimeout(0.05);
+
+	if (!initialisedResult.get())
+	{
+		renderThread.join();
+		glfwMakeContextCurrent(window);
+		return false;
+	}
+
+	// The render thread can start on the position the camera starts at
+	m_lastTime = glfwGetTime();
+	FrameSnapshot& first{ m_snapshots.Back() };
+	first.previousCamera = *m_camera;
+	first.camera = *m_camera;
+	first.publishTime = m_lastTime;
+	m_snapshots.Publish();
 
-	// Render the scene
-	m_renderer->Render(*m_camera, deltaTime);
+	while (!glfwWindowShouldClose(window))
+	{
+		if (!HandleInput(window))
+			break;
 
+		if (Simulate(window) > 0)
+		{
+			// Each snapshot is a full copy, the render thread never sees a step half written
+			FrameSnapshot& snapshot{ m_snapshots.Back() };
+			snapshot.previousCamera = m_previousCamera;
+			snapshot.camera = *m_camera;
+			snapshot.publishTime = m_lastTime - m_accumulator;
+
+			// Only the placements since the last snapshot the render thread took, with any it skipped
+			snapshot.objectTransforms = m_untakenObjectTransforms;
+			for (const auto& placement : m_objectTransforms)
+				SetPlacement(snapshot.objectTransforms, placement.first, placement.second);
+
+			// Once the previous snapshot was taken only this one's new placements can still be missed,
+			// otherwise that one was dropped and this carries everything
+			if (m_snapshots.Publish())
+			{
+				m_untakenObjectTransforms.swap(m_objectTransforms);
+			}
+			else
+			{
+				for (const auto& placement : m_objectTransforms)
+					SetPlacement(m_untakenObjectTransforms, placement.first, placement.second);
+			}
+			m_objectTransforms.clear();
+		}
+
+		// Nothing to simulate until the next step is due, but input still wakes this straight away
+		glfwWaitEventsTimeout(std::max(KSimulationStep - (glfwGetTime() - m_lastTime) - m_accumulator, 0.0));
+	}
+
+	m_stopRendering = true;
+	renderThread.join();
+
+	// Back to how it was before, ready for the window to be destroyed
+	glfwMakeContextCurrent(window);
 	return true;
 }
+
+// Body of the render thread, owns the GL context from Initialise until the renderer is destroyed
+void Simulation::RenderThread(GLFWwindow* window, std::promise<bool>& initialised)
+{
+	glfwMakeContextCurrent(window);
+
+	bool ok{ Initialise() };
+	initialised.set_value(ok);
+	if (!ok)
+	{
+		m_renderer.reset();
+		glfwMakeContextCurrent(nullptr);
+		return;
+	}
+
+	// Wait for the main thread's first snapshot
+	while (!m_snapshots.Acquire())
+	{
+		if (m_stopRendering)
+			break;
+		std::this_thread::yield();
+	}
+
+	double lastFrameTime{ glfwGetTime() };
+	while (!m_stopRendering)
+	{
+		bool newSnapshot{ m_snapshots.Acquire() };
+		const FrameSnapshot& snapshot{ m_snapshots.Front() };
+
+		double timeNow{ glfwGetTime() };
+		float deltaTime{ (float)(timeNow - lastFrameTime) };
+		lastFrameTime = timeNow;
+
+		// Real time since the latest step was published, drawing lags the simulation by one step as
+		// in the single threaded loop. Held at the latest step if the simulation falls behind.
+		float blend{ (float)std::min((timeNow - snapshot.publishTime) / KSimulationStep, 1.0) };
+		Helpers::Camera renderCamera;
+		renderCamera.Interpolate(snapshot.previousCamera, snapshot.camera, blend);
+
+		RenderFrame(renderCamera, deltaTime, newSnapshot ? snapshot.objectTransforms : KNoObjectTransforms);
+
+		glfwSwapBuffers(window);
+	}
+
+	// GL objects have to be deleted while the context is current
+	m_renderer.reset();
+	glfwMakeContextCurrent(nullptr);
+}
+
+// Advances everything simulated by one fixed step
+void Simulation::Step(GLFWwindow* window, float stepSecs)
+{
+	// The camera needs updating to handle user input internally
+	m_camera->Update(window, stepSecs);
+
+	// Move objects with PlaceObject rather than through the renderer, with a render thread the
+	// renderer belongs to that thread
+	//PlaceObject(0, glm::rotate(glm::mat4(1), (float)glfwGetTime(), glm::vec3(0, 1, 0)));
+}
+
+// Call from Step to move an object, applied to the renderer after the step
+void Simulation::PlaceObject(size_t objectIndex, const glm::mat4& xform)
+{
+	SetPlacement(m_objectTransforms, objectIndex, xform);
+}
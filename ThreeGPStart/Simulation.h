@@ -2,10 +2,31 @@
 
 #include "ExternalLibraryHeaders.h"
 #include "Camera.h"
+#include "TripleBuffer.h"
+
+#include <atomic>
+#include <cstdint>
+#include <future>
 
 class Renderer;
 struct GLFWwindow;
 
+// Everything the render thread needs to draw a frame, copied whole when published so it never
+// changes while being drawn
+struct FrameSnapshot
+{
+	// The last two steps, drawn part way between them as in the single threaded loop
+	Helpers::Camera previousCamera;
+	Helpers::Camera camera;
+
+	// glfwGetTime when camera was published, how far real time has got past it decides the blend
+	double publishTime{ 0 };
+
+	// Objects placed since the last snapshot the render thread took, as object index and transform,
+	// so placements in a skipped snapshot are carried into the next
+	std::vector<std::pair<size_t, glm::mat4>> objectTransforms;
+};
+
 // Simulation class to handle input, updating of the simulation and calling the renderer
 class Simulation
 {
@@ -17,15 +38,59 @@ private:
 	std::shared_ptr<Renderer> m_renderer;
 
 	// Remember last update time so we can calculate delta time
-	float m_lastTime{ 0 };
+	double m_lastTime{ 0 };
+
+	// Real time not yet simulated, always less than a step once Update has caught up
+	double m_accumulator{ 0 };
+
+	// Camera as of the step before the latest, frames are drawn part way between the two
+	Helpers::Camera m_previousCamera;
+
+	// Objects placed by Step since the last frame or snapshot, only these are handed to the renderer
+	std::vector<std::pair<size_t, glm::mat4>> m_objectTransforms;
+
+	// Placements in the last published snapshot, which the render thread may not have taken yet
+	std::vector<std::pair<size_t, glm::mat4>> m_untakenObjectTransforms;
+
+	// Latest framebuffer size packed as width << 32 | height, written by the resize callback and
+	// picked up by whichever thread renders
+	std::atomic<uint64_t> m_framebufferSize{ 0 };
+	uint64_t m_appliedFramebufferSize{ 0 };
+
+	// Render thread mode, snapshots go from the main thread to the render thread
+	Helpers::TripleBuffer<FrameSnapshot> m_snapshots;
+	std::atomic<bool> m_stopRendering{ false };
 
 	// Handle any user input. Return false if program should close.
 	bool HandleInput(GLFWwindow* window);
+
+	// Advances everything simulated by one fixed step
+	void Step(GLFWwindow* window, float stepSecs);
+
+	// Call from Step to move an object, applied to the renderer after the step
+	void PlaceObject(size_t objectIndex, const glm::mat4& xform);
+
+	// Runs as many fixed steps as real time has moved on by, returns how many ran
+	int Simulate(GLFWwindow* window);
+
+	// Applies any resize and object moves then draws
+	void RenderFrame(const Helpers::Camera& camera, float deltaTime, const std::vector<std::pair<size_t, glm::mat4>>& objectTransforms);
+
+	// Body of the render thread, owns the GL context from Initialise until the renderer is destroyed
+	void RenderThread(GLFWwindow* window, std::promise<bool>& initialised);
 public:
 	// Initialise this as well as the renderer, returns false on error
 	bool Initialise();	
 
+	// Call when the window's framebuffer changes size, including once at the start
+	void OnFramebufferResize(int width, int height);
+
 	// Update the simulation (and render) returns false if program should clse
 	bool Update(GLFWwindow* window);
+
+	// Instead of Initialise and Update, runs the whole program with the GL context moved to a
+	// render thread while input and the simulation stay on the calling (main) thread, so the next
+	// steps are simulated while the last are drawn. Returns false if initialisation failed.
+	bool RunWithRenderThread(GLFWwindow* window);
 };
 
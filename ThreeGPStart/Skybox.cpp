@@ -0,0 +1,104 @@
+#include "Skybox.h"
+#include "ImageLoader.h"
+#include "Helper.h"
+#include "ThreadPool.h"
+
+namespace Helpers
+{
+	Skybox::~Skybox()
+	{
+		glDeleteTextures(1, &m_cubemap);
+		glDeleteVertexArrays(1, &m_VAO);
+	}
+
+	// Faces in GL order, decoded in parallel on the thread pool and uploaded here
+	bool Skybox::Load(const std::vector<std::string>& faceFilenames)
+	{
+		if (faceFilenames.size() != 6)
+		{
+			std::cerr << "A skybox needs six faces" << std::endl;
+			return false;
+		}
+
+		// Decoding is most of the cost and needs no GL, so only the upload waits for the main thread
+		ImageLoader faces[6];
+		bool loaded[6]{};
+		ThreadPool::Get().ParallelFor(6, 1, [&](size_t begin, size_t end)
+		{
+			for (size_t face = begin; face < end; face++)
+			{
+				loaded[face] = faces[face].Load(faceFilenames[face]);
+				if (!loaded[face])
+					continue;
+
+				// Images load bottom row first but cube map faces start from the top row
+				const size_t rowBytes{ (size_t)faces[face].Width() * 4 };
+				GLbyte* data{ faces[face].GetData() };
+				for (int row = 0; row < faces[face].Height() / 2; row++)
+					std::swap_ranges(data + row * rowBytes, data + (row + 1) * rowBytes, data + (faces[face].Height() - 1 - row) * rowBytes);
+			}
+		});
+
+		for (int face = 0; face < 6; face++)
+		{
+			if (!loaded[face])
+			{
+				std::cerr << "Could not load skybox face " << faceFilenames[face] << std::endl;
+				return false;
+			}
+		}
+
+		// Cube map faces must all be square and the same size
+		const int faceSize{ faces[0].Width() };
+		for (int face = 0; face < 6; face++)
+		{
+			if (faces[face].Width() != faceSize || faces[face].Height() != faceSize)
+			{
+				std::cerr << "Skybox face " << faceFilenames[face] << " is " << faces[face].Width() << "x" << faces[face].Height()
+					<< ", all faces must be square and " << faceSize << "x" << faceSize << std::endl;
+				return false;
+			}
+		}
+
+		glDeleteTextures(1, &m_cubemap);
+		glGenTextures(1, &m_cubemap);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, m_cubemap);
+		for (int face = 0; face < 6; face++)
+		{
+			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_RGBA, faces[face].Width(), faces[face].Height(), 0,
+				GL_RGBA, GL_UNSIGNED_BYTE, faces[face].GetData());
+		}
+
+		// Clamped so the seams between faces do not pick up texels from the opposite edge
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+		if (!m_VAO)
+			glGenVertexArrays(1, &m_VAO);
+
+		return !CheckForGLError();
+	}
+
+	// Draws with whatever program is in use, the cube map is bound on textureUnit
+	void Skybox::Draw(GLint textureUnit) const
+	{
+		glActiveTexture(GL_TEXTURE0 + textureUnit);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, m_cubemap);
+
+		// The triangle sits exactly on the far plane, so it passes wherever the depth buffer was left cleared
+		glDepthFunc(GL_LEQUAL);
+		glDepthMask(GL_FALSE);
+
+		glBindVertexArray(m_VAO);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+		glBindVertexArray(0);
+
+		glDepthFunc(GL_LESS);
+		glDepthMask(GL_TRUE);
+		glActiveTexture(GL_TEXTURE0);
+	}
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "ExternalLibraryHeaders.h"
+
+namespace Helpers
+{
+	// Sky drawn from a cube map as one full screen triangle at the far plane
+	// Drawn after everything else with a GL_LEQUAL depth test, so only pixels nothing else covered are shaded.
+	// The program reconstructs each pixel's view direction, see sky_vertex_shader.glsl.
+	class Skybox
+	{
+	private:
+		GLuint m_cubemap{ 0 };
+
+		// Empty, the triangle's corners come from gl_VertexID
+		GLuint m_VAO{ 0 };
+	public:
+		Skybox() = default;
+		~Skybox();
+
+		Skybox(const Skybox&) = delete;
+		Skybox& operator=(const Skybox&) = delete;
+
+		// Faces in GL order: +x (right), -x (left), +y (top), -y (bottom), +z (front), -z (back)
+		// They are decoded in parallel on the thread pool and uploaded here. Returns false on error.
+		bool Load(const std::vector<std::string>& faceFilenames);
+
+		bool IsValid() const { return m_cubemap != 0; }
+
+		// Draws with whatever program is in use, the cube map is bound on textureUnit
+		void Draw(GLint textureUnit) const;
+	};
+}
@@ -0,0 +1,438 @@
+#include "StreamingTerrain.h"
+#include "ImageLoader.h"
+
+#include <algorithm>
+
+// Waits for any chunks still being generated as they write back into this object
+StreamingTerrain::~StreamingTerrain()
+{
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_allJobsDone.wait(lock, [this] { return m_jobsInFlight == 0; });
+	}
+
+	for (Slot& slot : m_slots)
+	{
+		glDeleteVertexArrays(1, &slot.VAO);
+		glDeleteBuffers(1, &slot.VBO);
+	}
+	glDeleteBuffers(1, &m_EBO);
+	glDeleteTextures(1, &m_textureID);
+}
+
+// Creates the GPU buffer pool, the texture is a tiling ground texture. Returns false on error.
+bool StreamingTerrain::Initialise(const ProceduralTerrainSettings& settings, const std::string& textureFilename)
+{
+	m_settings = settings;
+	m_noise = Helpers::Noise(settings.seed);
+
+	if (m_settings.chunkCells % 2 != 0 || NumVertsPerSide() * NumVertsPerSide() > 65536)
+	{
+		std::cerr << "Procedural terrain chunk size must be even and small enough for 16 bit indices" << std::endl;
+		return false;
+	}
+
+	// Nearest chunks are generated first so the area around the camera fills in quickest
+	const int radius{ m_settings.viewRadiusChunks };
+	for (int z = -radius; z <= radius; z++)
+		for (int x = -radius; x <= radius; x++)
+			m_loadOrder.push_back(glm::ivec2(x, z));
+
+	std::sort(m_loadOrder.begin(), m_loadOrder.end(),
+		[](const glm::ivec2& a, const glm::ivec2& b) { return a.x * a.x + a.y * a.y < b.x * b.x + b.y * b.y; });
+
+	// Chunks are only dropped one chunk beyond the view radius so moving back and forth over a
+	// boundary does not regenerate them, the pool has to cover that wider area
+	const int poolSide{ 2 * (radius + 1) + 1 };
+	const int numSlots{ poolSide * poolSide };
+
+	// Same index pattern for every chunk, alternating the diagonal like the heightmap terrain
+	// The grid runs along +z here so the winding is reversed to keep the triangles facing up
+	std::vector<GLushort> elements;
+	const int numVertX{ NumVertsPerSide() };
+	auto addElement = [&elements](int index) { elements.push_back((GLushort)index); };
+	for (int z = 0; z < m_settings.chunkCells; z++)
+	{
+		for (int x = 0; x < m_settings.chunkCells; x++)
+		{
+			int startVertIndex = z * numVertX + x;
+			if ((x + z) % 2 == 0)
+			{
+				addElement(startVertIndex);
+				addElement(startVertIndex + numVertX);
+				addElement(startVertIndex + 1);
+
+				addElement(startVertIndex + 1);
+				addElement(startVertIndex + numVertX);
+				addElement(startVertIndex + numVertX + 1);
+			}
+			else
+			{
+				addElement(startVertIndex);
+				addElement(startVertIndex + numVertX + 1);
+				addElement(startVertIndex + 1);
+
+				addElement(startVertIndex);
+				addElement(startVertIndex + numVertX);
+				addElement(startVertIndex + numVertX + 1);
+			}
+		}
+	}
+	m_numElements = (unsigned int)elements.size();
+
+	glGenBuffers(1, &m_EBO);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_EBO);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLushort) * elements.size(), elements.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	// The ring of buffers is allocated once up front and only ever overwritten
+	const GLsizeiptr chunkBytes{ (GLsizeiptr)Format::Stride() * NumVertsPerSide() * NumVertsPerSide() };
+	m_slots.resize(numSlots);
+	for (int i = 0; i < numSlots; i++)
+	{
+		Slot& slot{ m_slots[i] };
+
+		glGenBuffers(1, &slot.VBO);
+		glBindBuffer(GL_ARRAY_BUFFER, slot.VBO);
+		glBufferData(GL_ARRAY_BUFFER, chunkBytes, nullptr, GL_DYNAMIC_DRAW);
+
+		glGenVertexArrays(1, &slot.VAO);
+		glBindVertexArray(slot.VAO);
+
+		Format::SetupAttributes();
+
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_EBO);
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		m_freeSlots.push_back(i);
+	}
+
+	Helpers::ImageLoader texture;
+	if (!texture.Load(textureFilename))
+	{
+		std::cerr << "Could not load procedural terrain texture" << std::endl;
+		return false;
+	}
+
+	glGenTextures(1, &m_textureID);
+	glBindTexture(GL_TEXTURE_2D, m_textureID);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, texture.Width(), texture.Height(), 0, GL_RGBA, GL_UNSIGNED_BYTE, texture.GetData());
+	glGenerateMipmap(GL_TEXTURE_2D);
+
+	return !Helpers::CheckForGLError();
+}
+
+// Terrain height at a world x/z, straight from the source so it works whether or not the chunk is loaded
+float StreamingTerrain::GetHeight(float worldX, float worldZ) const
+{
+	float height;
+	GetHeights(worldX, worldZ, 0.0f, 1, 0, &height);
+	return height;
+}
+
+// Heights of count points along +x, from the height source in one call or from the noise
+// The noise has only the one level
+void StreamingTerrain::GetHeights(float worldX, float worldZ, float step, int count, int level, float* heights) const
+{
+	if (m_heightSource)
+	{
+		m_heightSource(worldX, worldZ, step, count, level, heights);
+		return;
+	}
+
+	for (int i = 0; i < count; i++)
+		heights[i] = NoiseHeight(worldX + i * step, worldZ);
+}
+
+// Terrain height from the noise settings
+float StreamingTerrain::NoiseHeight(float worldX, float worldZ) const
+{
+	float x{ worldX / m_settings.featureSize };
+	float z{ worldZ / m_settings.featureSize };
+
+	if (m_settings.ridged)
+		return m_noise.Ridged(x, z, m_settings.octaves) * m_settings.heightScale;
+
+	return (m_noise.Fbm(x, z, m_settings.octaves) * 0.5f + 0.5f) * m_settings.heightScale;
+}
+
+// 0 near the camera's chunk, one more each time the distance doubles past fullDetailRadiusChunks
+// Always 0 for the noise, which has no coarser levels
+int StreamingTerrain::DetailLevel(const glm::ivec2& coord, const glm::ivec2& centre) const
+{
+	if (!m_heightSource)
+		return 0;
+
+	const glm::ivec2 offset{ glm::abs(coord - centre) };
+	const int distance{ std::max(offset.x, offset.y) };
+
+	int level{ 0 };
+	for (int reach = std::max(m_settings.fullDetailRadiusChunks, 1); distance > reach; reach *= 2)
+		level++;
+	return level;
+}
+
+StreamingTerrain::ChunkLevels StreamingTerrain::DetailLevels(const glm::ivec2& coord, const glm::ivec2& centre) const
+{
+	ChunkLevels levels;
+	for (int z = -1; z <= 1; z++)
+		for (int x = -1; x <= 1; x++)
+			levels[(z + 1) * 3 + x + 1] = DetailLevel(coord + glm::ivec2(x, z), centre);
+	return levels;
+}
+
+// Runs on a worker thread so must only read settings and the height source, which never change after Initialise
+void StreamingTerrain::GenerateChunk(const glm::ivec2& coord, const ChunkLevels& levels, std::vector<GLubyte>& vertices,
+	float& minHeight, float& maxHeight) const
+{
+	const int numVerts{ NumVertsPerSide() };
+	const float cellSize{ m_settings.cellSize };
+	const glm::vec2 chunkOrigin{ coord.x * ChunkWorldSize(), coord.y * ChunkWorldSize() };
+
+	// Heights with a one vertex border so normals on the chunk edge match the neighbouring chunk
+	const int borderedSide{ numVerts + 2 };
+	std::vector<float> heights((size_t)borderedSide * borderedSide);
+
+	// Chunks either side of a vertex on one axis, -1 to 1. Edge vertices are shared so they take the
+	// coarsest level of the chunks touching them, then neighbours at different levels still meet.
+	auto touching = [numVerts](int vertex, int& first, int& last)
+	{
+		first = vertex <= 0 ? -1 : (vertex >= numVerts ? 1 : 0);
+		last = vertex >= numVerts - 1 ? 1 : (vertex < 0 ? -1 : 0);
+	};
+
+	std::vector<int> rowLevels(borderedSide);
+	for (int z = 0; z < borderedSide; z++)
+	{
+		int firstZ, lastZ;
+		touching(z - 1, firstZ, lastZ);
+		for (int x = 0; x < borderedSide; x++)
+		{
+			int firstX, lastX;
+			touching(x - 1, firstX, lastX);
+
+			int level{ 0 };
+			for (int chunkZ = firstZ; chunkZ <= lastZ; chunkZ++)
+				for (int chunkX = firstX; chunkX <= lastX; chunkX++)
+					level = std::max(level, levels[(chunkZ + 1) * 3 + chunkX + 1]);
+			rowLevels[x] = level;
+		}
+
+		// One call for each run of the row at the same level
+		int start{ 0 };
+		while (start < borderedSide)
+		{
+			int end{ start + 1 };
+			while (end < borderedSide && rowLevels[end] == rowLevels[start])
+				end++;
+
+			GetHeights(chunkOrigin.x + (start - 1) * cellSize, chunkOrigin.y + (z - 1) * cellSize, cellSize, end - start,
+				rowLevels[start], &heights[(size_t)z * borderedSide + start]);
+			start = end;
+		}
+	}
+
+	auto heightAt = [&heights, borderedSide](int x, int z) { return heights[(size_t)(z + 1) * borderedSide + (x + 1)]; };
+
+	minHeight = FLT_MAX;
+	maxHeight = -FLT_MAX;
+
+	vertices.resize(Format::Stride() * numVerts * numVerts);
+	for (int z = 0; z < numVerts; z++)
+	{
+		for (int x = 0; x < numVerts; x++)
+		{
+			minHeight = std::min(minHeight, heightAt(x, z));
+			maxHeight = std::max(maxHeight, heightAt(x, z));
+
+			// Positions are relative to the chunk so they keep their precision far from the world origin
+			glm::vec3 position{ x * cellSize, heightAt(x, z), z * cellSize };
+
+			float dhdx{ (heightAt(x + 1, z) - heightAt(x - 1, z)) / (2.0f * cellSize) };
+			float dhdz{ (heightAt(x, z + 1) - heightAt(x, z - 1)) / (2.0f * cellSize) };
+			glm::vec3 normal{ glm::normalize(glm::vec3(-dhdx, 1.0f, -dhdz)) };
+
+			glm::vec2 uv{ (chunkOrigin + glm::vec2(x * cellSize, z * cellSize)) / m_settings.textureRepeat };
+
+			Format::Write(vertices.data(), (size_t)z * numVerts + x, position, normal, uv);
+		}
+	}
+}
+
+// Takes a free slot and queues the chunk for generation, does nothing if the pool is exhausted
+void StreamingTerrain::RequestChunk(const glm::ivec2& coord, const ChunkLevels& levels)
+{
+	if (m_freeSlots.empty())
+		return;
+
+	Chunk& chunk{ m_chunks[Key(coord)] };
+	chunk.coord = coord;
+	chunk.slot = m_freeSlots.back();
+	chunk.ready = false;
+	m_freeSlots.pop_back();
+
+	QueueGeneration(chunk, levels);
+}
+
+// Generates the chunk into its slot on the thread pool, a chunk already drawn keeps its old
+// vertices until the new ones are uploaded and any earlier job for it is ignored
+void StreamingTerrain::QueueGeneration(Chunk& chunk, const ChunkLevels& levels)
+{
+	Slot& slot{ m_slots[chunk.slot] };
+	slot.generation++;
+	chunk.generation = slot.generation;
+	chunk.levels = levels;
+
+	// Reuse a vertex buffer from a previous chunk where possible to avoid allocating
+	std::vector<GLubyte> vertices;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!m_spareVertexBuffers.empty())
+		{
+			vertices = std::move(m_spareVertexBuffers.back());
+			m_spareVertexBuffers.pop_back();
+		}
+		m_jobsInFlight++;
+	}
+
+	const glm::ivec2 coord{ chunk.coord };
+	const int slotIndex{ chunk.slot };
+	const unsigned int generation{ slot.generation };
+	auto job = [this, coord, levels, slotIndex, generation, vertices]() mutable
+	{
+		float minHeight, maxHeight;
+		GenerateChunk(coord, levels, vertices, minHeight, maxHeight);
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_finished.push_back(GeneratedChunk{ coord, slotIndex, generation, std::move(vertices), minHeight, maxHeight });
+		if (--m_jobsInFlight == 0)
+			m_allJobsDone.notify_all();
+	};
+	Helpers::ThreadPool::Get().Submit(std::move(job));
+}
+
+// Returns the chunk's slot to the pool, a job still running for it will be ignored when it finishes
+void StreamingTerrain::ReleaseChunk(std::unordered_map<long long, Chunk>::iterator it)
+{
+	m_freeSlots.push_back(it->second.slot);
+	m_chunks.erase(it);
+}
+
+// Copies a limited number of finished chunks into their GPU buffers
+void StreamingTerrain::UploadFinishedChunks()
+{
+	// The chunk a result is for, or none if it went out of range or its slot has since been reused
+	auto findChunk = [this](const GeneratedChunk& generated)
+	{
+		auto found{ m_chunks.find(Key(generated.coord)) };
+		if (found != m_chunks.end() && (found->second.slot != generated.slot || found->second.generation != generated.generation))
+			found = m_chunks.end();
+		return found;
+	};
+
+	// Stale results are dropped before counting so they do not use up the frame's uploads
+	std::vector<GeneratedChunk> toUpload;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		const size_t maxUploads{ (size_t)std::max(m_settings.maxUploadsPerFrame, 1) };
+		size_t kept{ 0 };
+		for (size_t i = 0; i < m_finished.size(); i++)
+		{
+			GeneratedChunk& generated{ m_finished[i] };
+			if (findChunk(generated) == m_chunks.end())
+				m_spareVertexBuffers.push_back(std::move(generated.vertices));
+			else if (toUpload.size() < maxUploads)
+				toUpload.push_back(std::move(generated));
+			else if (kept++ != i)
+				m_finished[kept - 1] = std::move(generated);
+		}
+		m_finished.resize(kept);
+	}
+
+	for (GeneratedChunk& generated : toUpload)
+	{
+		auto found{ findChunk(generated) };
+		glBindBuffer(GL_ARRAY_BUFFER, m_slots[generated.slot].VBO);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, generated.vertices.size(), generated.vertices.data());
+		found->second.ready = true;
+		found->second.minHeight = generated.minHeight;
+		found->second.maxHeight = generated.maxHeight;
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for (GeneratedChunk& generated : toUpload)
+		m_spareVertexBuffers.push_back(std::move(generated.vertices));
+}
+
+// Recycles chunks that are now out of range and queues generation of the ones that came into range
+void StreamingTerrain::Update(const glm::vec3& cameraPosition)
+{
+	glm::ivec2 centre{ (int)std::floor(cameraPosition.x / ChunkWorldSize()), (int)std::floor(cameraPosition.z / ChunkWorldSize()) };
+	const int keepRadius{ m_settings.viewRadiusChunks + 1 };
+
+	for (auto it = m_chunks.begin(); it != m_chunks.end();)
+	{
+		glm::ivec2 offset{ it->second.coord - centre };
+		if (std::abs(offset.x) > keepRadius || std::abs(offset.y) > keepRadius)
+		{
+			auto toRelease{ it++ };
+			ReleaseChunk(toRelease);
+		}
+		else
+		{
+			// Moved nearer or further, or a neighbour did, so its heights or shared edges are out of date
+			ChunkLevels levels{ DetailLevels(it->second.coord, centre) };
+			if (levels != it->second.levels)
+				QueueGeneration(it->second, levels);
+			++it;
+		}
+	}
+
+	for (const glm::ivec2& offset : m_loadOrder)
+	{
+		glm::ivec2 coord{ centre + offset };
+		if (m_chunks.find(Key(coord)) == m_chunks.end())
+			RequestChunk(coord, DetailLevels(coord, centre));
+	}
+
+	UploadFinishedChunks();
+}
+
+// Adds a draw for every loaded chunk, each positioned with its own model transform
+void StreamingTerrain::Queue(Helpers::RenderQueue& queue, const Helpers::ShaderProgram& program, GLuint material,
+	const Helpers::Frustum& frustum, const glm::vec3& cameraPosition, float farPlane) const
+{
+	Helpers::DrawPacket packet;
+	packet.program = &program;
+	packet.material = material;
+	packet.indexType = GL_UNSIGNED_SHORT;
+	packet.numIndices = m_numElements;
+
+	const float halfChunk{ 0.5f * ChunkWorldSize() };
+	for (const auto& entry : m_chunks)
+	{
+		const Chunk& chunk{ entry.second };
+		if (!chunk.ready)
+			continue;
+
+		glm::vec3 corner{ chunk.coord.x * ChunkWorldSize(), 0, chunk.coord.y * ChunkWorldSize() };
+
+		Helpers::BoundingBox bounds;
+		bounds.Include(corner + glm::vec3(0, chunk.minHeight, 0));
+		bounds.Include(corner + glm::vec3(ChunkWorldSize(), chunk.maxHeight, ChunkWorldSize()));
+		if (!frustum.IsBoxVisible(bounds))
+			continue;
+
+		packet.VAO = m_slots[chunk.slot].VAO;
+		packet.modelXform = glm::translate(glm::mat4(1), corner);
+
+		float depth{ glm::distance(cameraPosition, corner + glm::vec3(halfChunk, 0, halfChunk)) / farPlane };
+		queue.Add(Helpers::RenderQueue::MakeKey(Helpers::RenderPass::Opaque, program.Id(), material, packet.VAO, depth), packet);
+	}
+}
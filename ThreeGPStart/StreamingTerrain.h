@@ -0,0 +1,175 @@
+#pragma once
+
+#include "ExternalLibraryHeaders.h"
+#include "Helper.h"
+#include "Noise.h"
+#include "ThreadPool.h"
+#include "VertexFormat.h"
+#include "RenderQueue.h"
+#include "Frustum.h"
+
+#include <unordered_map>
+#include <cstdint>
+#include <atomic>
+#include <array>
+
+// Settings for the procedural terrain, all distances are in world units
+struct ProceduralTerrainSettings
+{
+	unsigned int seed{ 1234 };
+
+	// Cells along each side of a chunk, must be even so the diamond pattern lines up across chunks
+	int chunkCells{ 32 };
+	float cellSize{ 50.0f };
+
+	// Chunks either side of the camera's chunk that are kept loaded
+	int viewRadiusChunks{ 6 };
+
+	// With a height source that has coarser levels, chunks up to this far from the camera's chunk
+	// take full detail heights and each doubling of the distance past it one level coarser. At least 1.
+	int fullDetailRadiusChunks{ 2 };
+
+	// Noise, featureSize is the wavelength of the lowest octave
+	float heightScale{ 900.0f };
+	float featureSize{ 4000.0f };
+	int octaves{ 6 };
+	bool ridged{ false };
+
+	// World units per repeat of the ground texture
+	float textureRepeat{ 800.0f };
+
+	// Most finished chunks copied to the GPU per frame, keeps the cost of a frame bounded
+	int maxUploadsPerFrame{ 4 };
+};
+
+// Terrain generated from noise in chunks around the camera
+// Chunks are built on the thread pool and copied into a fixed ring of GPU buffers, so memory
+// stays constant however far the camera travels and chunks that fall out of range are recycled.
+class StreamingTerrain
+{
+private:
+	// Interleaved vertex, matches the attribute layout used by vertex_shader.glsl
+	// Uvs stay full precision as they keep growing across the world
+	using Format = Helpers::VertexFormat<Helpers::Position3f, Helpers::NormalPacked10, Helpers::Uv2f>;
+
+	// One pooled GPU buffer and the VAO describing it
+	struct Slot
+	{
+		GLuint VAO{ 0 };
+		GLuint VBO{ 0 };
+
+		// Bumped every time the slot is handed to a new chunk so late results for the old one are ignored
+		unsigned int generation{ 0 };
+	};
+
+	// Detail level of a chunk and its eight neighbours, offset (x, z) at (z + 1) * 3 + x + 1
+	using ChunkLevels = std::array<int, 9>;
+
+	struct Chunk
+	{
+		glm::ivec2 coord{ 0 };
+		int slot{ -1 };
+		unsigned int generation{ 0 };
+		bool ready{ false };
+
+		// Levels it was last generated with, it is generated again when they change
+		ChunkLevels levels{};
+
+		// Height range of the chunk's vertices, for culling
+		float minHeight{ 0 };
+		float maxHeight{ 0 };
+	};
+
+	// Finished on a worker thread, waiting for the GL thread to upload it
+	struct GeneratedChunk
+	{
+		glm::ivec2 coord;
+		int slot;
+		unsigned int generation;
+		std::vector<GLubyte> vertices;
+		float minHeight;
+		float maxHeight;
+	};
+
+	ProceduralTerrainSettings m_settings;
+	Helpers::Noise m_noise;
+
+	// Replaces the noise when set, called from worker threads
+	std::function<void(float, float, float, int, int, float*)> m_heightSource;
+
+	std::vector<Slot> m_slots;
+	std::vector<int> m_freeSlots;
+
+	// Shared by every chunk, they are all the same size
+	GLuint m_EBO{ 0 };
+	unsigned int m_numElements{ 0 };
+
+	GLuint m_textureID{ 0 };
+
+	std::unordered_map<long long, Chunk> m_chunks;
+
+	// Chunk offsets within the view radius sorted nearest first
+	std::vector<glm::ivec2> m_loadOrder;
+
+	// Shared with the worker threads
+	std::mutex m_mutex;
+	std::vector<GeneratedChunk> m_finished;
+	std::vector<std::vector<GLubyte>> m_spareVertexBuffers;
+	std::condition_variable m_allJobsDone;
+	int m_jobsInFlight{ 0 };
+
+	// Shifted unsigned as shifting a negative signed value is undefined
+	static long long Key(const glm::ivec2& coord) { return (long long)(((uint64_t)(uint32_t)coord.x << 32) | (uint32_t)coord.y); }
+
+	float ChunkWorldSize() const { return m_settings.chunkCells * m_settings.cellSize; }
+	int NumVertsPerSide() const { return m_settings.chunkCells + 1; }
+
+	// Terrain height from the noise settings
+	float NoiseHeight(float worldX, float worldZ) const;
+
+	// Heights of count points from worldX, worldZ spaced step apart along +x at a detail level
+	void GetHeights(float worldX, float worldZ, float step, int count, int level, float* heights) const;
+
+	// 0 near the camera's chunk, one more each time the distance doubles past fullDetailRadiusChunks
+	int DetailLevel(const glm::ivec2& coord, const glm::ivec2& centre) const;
+	ChunkLevels DetailLevels(const glm::ivec2& coord, const glm::ivec2& centre) const;
+
+	// Runs on a worker thread
+	// Also returns the lowest and highest heights generated
+	void GenerateChunk(const glm::ivec2& coord, const ChunkLevels& levels, std::vector<GLubyte>& vertices,
+		float& minHeight, float& maxHeight) const;
+
+	void RequestChunk(const glm::ivec2& coord, const ChunkLevels& levels);
+	void QueueGeneration(Chunk& chunk, const ChunkLevels& levels);
+	void ReleaseChunk(std::unordered_map<long long, Chunk>::iterator it);
+	void UploadFinishedChunks();
+public:
+	StreamingTerrain() = default;
+	~StreamingTerrain();
+
+	StreamingTerrain(const StreamingTerrain&) = delete;
+	StreamingTerrain& operator=(const StreamingTerrain&) = delete;
+
+	// Takes heights from the function instead of the noise, e.g. a tiled heightfield on disk
+	// Called with a world x/z, a spacing, a count and a detail level it fills in that many heights
+	// along +x, a row at a time so the source can look up its data once per row. Level 0 is full
+	// detail, each level after it may be half the resolution of the one before, so distant chunks
+	// read far less data. Must be safe to call from worker threads. Set before Initialise.
+	void SetHeightSource(std::function<void(float, float, float, int, int, float*)> heightSource) { m_heightSource = std::move(heightSource); }
+
+	// Creates the GPU buffer pool, the texture is a tiling ground texture. Returns false on error.
+	bool Initialise(const ProceduralTerrainSettings& settings, const std::string& textureFilename);
+
+	// Terrain height at a world x/z, straight from the source so it works whether or not the chunk is loaded
+	float GetHeight(float worldX, float worldZ) const;
+
+	// Recycles chunks that are now out of range and queues generation of the ones that came into range
+	void Update(const glm::vec3& cameraPosition);
+
+	// The tiling ground texture, for the material the chunks are drawn with
+	GLuint GetTextureID() const { return m_textureID; }
+
+	// Adds a draw for every loaded chunk inside the frustum, each positioned with its own model transform
+	void Queue(Helpers::RenderQueue& queue, const Helpers::ShaderProgram& program, GLuint material,
+		const Helpers::Frustum& frustum, const glm::vec3& cameraPosition, float farPlane) const;
+};
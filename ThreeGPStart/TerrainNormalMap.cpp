@@ -0,0 +1,134 @@
+#include "TerrainNormalMap.h"
+
+namespace Helpers
+{
+	// World units the curvature is scaled by before it is stored, so a crease with a Laplacian of
+	// 1 / KCurvatureLength reaches the end of the range. Matches the default 16 texels per 100 unit cell.
+	static const float KCurvatureLength = 6.25f;
+
+	// Loads the heightmap at detailPerCell texels per mesh cell and bakes the whole map
+	bool TerrainNormalMap::Create(const Heightfield& coarse, const std::string& heightmapFilename, int detailPerCell, bool bakeCurvature)
+	{
+		m_detailPerCell = std::max(detailPerCell, 1);
+		m_bakeCurvature = bakeCurvature;
+
+		// Same extents as the mesh, just more vertices
+		if (!m_detail.LoadFromImage(heightmapFilename, coarse.NumCellsX() * m_detailPerCell, coarse.NumCellsZ() * m_detailPerCell,
+			coarse.CellSize() / m_detailPerCell))
+			return false;
+
+		m_bakedCoarseHeights = coarse.GetHeights();
+		m_texels.resize((size_t)Width() * Height() * 4);
+
+		GridRect all;
+		all.maxX = m_detail.NumCellsX();
+		all.maxZ = m_detail.NumCellsZ();
+		BakeRegion(coarse, all);
+
+		return true;
+	}
+
+	// Detail height plus the change made to the mesh heights since the bake, interpolated to the texel
+	float TerrainNormalMap::EditedHeight(const Heightfield& coarse, int x, int z) const
+	{
+		int coarseX{ std::min(x / m_detailPerCell, coarse.NumCellsX() - 1) };
+		int coarseZ{ std::min(z / m_detailPerCell, coarse.NumCellsZ() - 1) };
+		float fx{ (float)(x - coarseX * m_detailPerCell) / m_detailPerCell };
+		float fz{ (float)(z - coarseZ * m_detailPerCell) / m_detailPerCell };
+
+		auto delta = [&](int cx, int cz)
+		{
+			return coarse.GetHeight(cx, cz) - m_bakedCoarseHeights[(size_t)cz * coarse.NumVertsX() + cx];
+		};
+
+		float d00{ delta(coarseX, coarseZ) };
+		float d10{ delta(coarseX + 1, coarseZ) };
+		float d01{ delta(coarseX, coarseZ + 1) };
+		float d11{ delta(coarseX + 1, coarseZ + 1) };
+
+		return m_detail.GetHeight(x, z) + glm::mix(glm::mix(d00, d10, fx), glm::mix(d01, d11, fx), fz);
+	}
+
+	// Recomputes the texels in an inclusive range of detail vertices, split across the thread pool
+	void TerrainNormalMap::BakeRegion(const Heightfield& coarse, const GridRect& region)
+	{
+		// Heights for the region plus a one texel border for the differences, each worked out once
+		GridRect bordered;
+		bordered.minX = std::max(region.minX - 1, 0);
+		bordered.minZ = std::max(region.minZ - 1, 0);
+		bordered.maxX = std::min(region.maxX + 1, m_detail.NumCellsX());
+		bordered.maxZ = std::min(region.maxZ + 1, m_detail.NumCellsZ());
+
+		const int borderedWidth{ bordered.maxX - bordered.minX + 1 };
+		const int borderedDepth{ bordered.maxZ - bordered.minZ + 1 };
+		std::vector<float> heights((size_t)borderedWidth * borderedDepth);
+
+		ThreadPool& pool{ ThreadPool::Get() };
+		pool.ParallelFor(borderedDepth, 8, [&](size_t begin, size_t end)
+		{
+			for (size_t row = begin; row < end; row++)
+				for (int i = 0; i < borderedWidth; i++)
+					heights[row * borderedWidth + i] = EditedHeight(coarse, bordered.minX + i, bordered.minZ + (int)row);
+		});
+
+		auto heightAt = [&](int x, int z)
+		{
+			return heights[(size_t)(z - bordered.minZ) * borderedWidth + (x - bordered.minX)];
+		};
+
+		const float cellSize{ m_detail.CellSize() };
+		pool.ParallelFor(region.maxZ - region.minZ + 1, 8, [&](size_t begin, size_t end)
+		{
+			for (size_t row = begin; row < end; row++)
+			{
+				int z{ region.minZ + (int)row };
+				int z0{ std::max(z - 1, bordered.minZ) };
+				int z1{ std::min(z + 1, bordered.maxZ) };
+
+				for (int x = region.minX; x <= region.maxX; x++)
+				{
+					int x0{ std::max(x - 1, bordered.minX) };
+					int x1{ std::min(x + 1, bordered.maxX) };
+
+					// One sided at the edges of the terrain
+					float dhdx{ (heightAt(x1, z) - heightAt(x0, z)) / ((x1 - x0) * cellSize) };
+					float dhdGridZ{ (heightAt(x, z1) - heightAt(x, z0)) / ((z1 - z0) * cellSize) };
+
+					// Grid z runs along world -z
+					glm::vec3 normal{ glm::normalize(glm::vec3(-dhdx, 1.0f, dhdGridZ)) };
+
+					float curvature{ 0.5f };
+					if (m_bakeCurvature)
+					{
+						// Over the squared spacing so the same terrain bakes the same curvature at any detail
+						float laplacian{ (heightAt(x0, z) + heightAt(x1, z) + heightAt(x, z0) + heightAt(x, z1) - 4.0f * heightAt(x, z)) / (cellSize * cellSize) };
+						curvature = glm::clamp(0.5f + 0.5f * laplacian * KCurvatureLength, 0.0f, 1.0f);
+					}
+
+					GLubyte* texel{ &m_texels[((size_t)z * Width() + x) * 4] };
+					texel[0] = (GLubyte)std::lround((normal.x * 0.5f + 0.5f) * 255.0f);
+					texel[1] = (GLubyte)std::lround((normal.y * 0.5f + 0.5f) * 255.0f);
+					texel[2] = (GLubyte)std::lround((normal.z * 0.5f + 0.5f) * 255.0f);
+					texel[3] = (GLubyte)std::lround(curvature * 255.0f);
+				}
+			}
+		});
+	}
+
+	// Rebakes the texels affected by an edit to the mesh heights
+	GridRect TerrainNormalMap::Update(const Heightfield& coarse, const GridRect& coarseRegion)
+	{
+		GridRect region;
+		if (coarseRegion.IsEmpty() || m_texels.empty())
+			return region;
+
+		// A changed mesh vertex moves the heights across every cell touching it, and the normals one texel further
+		region.minX = std::max((coarseRegion.minX - 1) * m_detailPerCell - 1, 0);
+		region.minZ = std::max((coarseRegion.minZ - 1) * m_detailPerCell - 1, 0);
+		region.maxX = std::min((coarseRegion.maxX + 1) * m_detailPerCell + 1, m_detail.NumCellsX());
+		region.maxZ = std::min((coarseRegion.maxZ + 1) * m_detailPerCell + 1, m_detail.NumCellsZ());
+
+		BakeRegion(coarse, region);
+		return region;
+	}
+}
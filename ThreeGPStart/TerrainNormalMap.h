@@ -0,0 +1,45 @@
+#pragma once
+
+#include "ExternalLibraryHeaders.h"
+#include "Heightfield.h"
+#include "ThreadPool.h"
+
+namespace Helpers
+{
+	// RGBA8 texture of terrain normals baked from the heightmap at a higher resolution than the mesh
+	// so lighting detail no longer depends on how many vertices the terrain has.
+	// RGB is the world space normal scaled to 0-1. A is the curvature when baked (0.5 flat, above is
+	// concave, below is convex) and 0.5 otherwise. Slope is not stored as it is just 1 - normal.y.
+	// Texel (x,z) sits over the same point as detail grid vertex (x,z), so uvs 0-1 cover the terrain.
+	class TerrainNormalMap
+	{
+	private:
+		// Heights at the texel resolution as loaded, edits to the mesh heightfield are added on top
+		Heightfield m_detail;
+
+		// Mesh heights at the time of the bake, edits are applied as the difference from these
+		std::vector<float> m_bakedCoarseHeights;
+
+		int m_detailPerCell{ 1 };
+		bool m_bakeCurvature{ false };
+
+		std::vector<GLubyte> m_texels;
+
+		// Detail height plus the change made to the mesh heights since the bake, interpolated to the texel
+		float EditedHeight(const Heightfield& coarse, int x, int z) const;
+
+		// Recomputes the texels in an inclusive range of detail vertices, split across the thread pool
+		void BakeRegion(const Heightfield& coarse, const GridRect& region);
+	public:
+		// Loads the heightmap at detailPerCell texels per mesh cell and bakes the whole map
+		// Returns false on error
+		bool Create(const Heightfield& coarse, const std::string& heightmapFilename, int detailPerCell, bool bakeCurvature);
+
+		int Width() const { return m_detail.NumVertsX(); }
+		int Height() const { return m_detail.NumVertsZ(); }
+		const std::vector<GLubyte>& GetTexels() const { return m_texels; }
+
+		// Rebakes the texels affected by an edit to the mesh heights. Returns the texels that changed.
+		GridRect Update(const Heightfield& coarse, const GridRect& coarseRegion);
+	};
+}
@@ -0,0 +1,339 @@
+#include "TerrainRaycaster.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+namespace Helpers
+{
+	// Slack added to node bounds so rays grazing a flat area are not lost to rounding
+	static const float KBoundsEpsilon = 0.001f;
+
+	// Deepest pyramid supported, enough for a grid of 2^31 cells across
+	static const int KMaxLevels = 32;
+
+	// Slab test of a ray against an axis aligned box. Division by a zero direction gives an infinity
+	// which the comparisons below cope with. On a hit tEnter is where the ray enters the box.
+	static bool RayIntersectsBox(const glm::vec3& origin, const glm::vec3& invDirection,
+		const glm::vec3& boxMin, const glm::vec3& boxMax, float maxT, float& tEnter)
+	{
+		float t0{ 0 };
+		float t1{ maxT };
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float tNear{ (boxMin[axis] - origin[axis]) * invDirection[axis] };
+			float tFar{ (boxMax[axis] - origin[axis]) * invDirection[axis] };
+			if (tNear > tFar)
+				std::swap(tNear, tFar);
+
+			t0 = std::max(t0, tNear);
+			t1 = std::min(t1, tFar);
+			if (t0 > t1)
+				return false;
+		}
+
+		tEnter = t0;
+		return true;
+	}
+
+	// Moller-Trumbore ray / triangle test, both sides count as a hit
+	static bool RayIntersectsTriangle(const glm::vec3& origin, const glm::vec3& direction,
+		const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2, float maxT, float& t)
+	{
+		glm::vec3 edge1{ v1 - v0 };
+		glm::vec3 edge2{ v2 - v0 };
+		glm::vec3 p{ glm::cross(direction, edge2) };
+		float det{ glm::dot(edge1, p) };
+		if (std::abs(det) < 1e-12f)
+			return false;
+
+		float invDet{ 1.0f / det };
+		glm::vec3 s{ origin - v0 };
+		float u{ glm::dot(s, p) * invDet };
+		if (u < 0.0f || u > 1.0f)
+			return false;
+
+		glm::vec3 q{ glm::cross(s, edge1) };
+		float v{ glm::dot(direction, q) * invDet };
+		if (v < 0.0f || u + v > 1.0f)
+			return false;
+
+		float hitT{ glm::dot(edge2, q) * invDet };
+		if (hitT < 0.0f || hitT > maxT)
+			return false;
+
+		t = hitT;
+		return true;
+	}
+
+	// Builds the pyramid, the heightfield must outlive this
+	void TerrainRaycaster::Build(const Heightfield& heightfield)
+	{
+		m_heightfield = &heightfield;
+		m_levels.clear();
+
+		Level level;
+		level.width = heightfield.NumCellsX();
+		level.depth = heightfield.NumCellsZ();
+		if (level.width <= 0 || level.depth <= 0)
+		{
+			m_heightfield = nullptr;
+			return;
+		}
+
+		for (;;)
+		{
+			level.nodes.resize((size_t)level.width * level.depth);
+			m_levels.push_back(level);
+			if (level.width == 1 && level.depth == 1)
+				break;
+
+			level.width = (level.width + 1) / 2;
+			level.depth = (level.depth + 1) / 2;
+		}
+
+		assert(m_levels.size() <= KMaxLevels);
+
+		UpdateRegion(0, 0, heightfield.NumCellsX(), heightfield.NumCellsZ());
+	}
+
+	// Recalculates an inclusive range of nodes from the heights (level 0) or the level below
+	void TerrainRaycaster::RebuildLevel(size_t levelIndex, int minX, int minZ, int maxX, int maxZ)
+	{
+		Level& level{ m_levels[levelIndex] };
+
+		for (int z = minZ; z <= maxZ; z++)
+		{
+			for (int x = minX; x <= maxX; x++)
+			{
+				MinMax result{ FLT_MAX, -FLT_MAX };
+
+				if (levelIndex == 0)
+				{
+					for (int corner = 0; corner < 4; corner++)
+					{
+						float h{ m_heightfield->GetHeight(x + (corner & 1), z + (corner >> 1)) };
+						result.minHeight = std::min(result.minHeight, h);
+						result.maxHeight = std::max(result.maxHeight, h);
+					}
+				}
+				else
+				{
+					const Level& below{ m_levels[levelIndex - 1] };
+					for (int childZ = z * 2; childZ < std::min(z * 2 + 2, below.depth); childZ++)
+					{
+						for (int childX = x * 2; childX < std::min(x * 2 + 2, below.width); childX++)
+						{
+							const MinMax& child{ below.At(childX, childZ) };
+							result.minHeight = std::min(result.minHeight, child.minHeight);
+							result.maxHeight = std::max(result.maxHeight, child.maxHeight);
+						}
+					}
+				}
+
+				level.At(x, z) = result;
+			}
+		}
+	}
+
+	// Refreshes the pyramid after heights in the given inclusive vertex range have changed
+	void TerrainRaycaster::UpdateRegion(int minVertX, int minVertZ, int maxVertX, int maxVertZ)
+	{
+		if (!m_heightfield)
+			return;
+
+		// A vertex touches the cells on either side of it
+		int minX{ std::max(minVertX - 1, 0) };
+		int minZ{ std::max(minVertZ - 1, 0) };
+		int maxX{ std::min(maxVertX, m_levels[0].width - 1) };
+		int maxZ{ std::min(maxVertZ, m_levels[0].depth - 1) };
+		if (minX > maxX || minZ > maxZ)
+			return;
+
+		for (size_t i = 0; i < m_levels.size(); i++)
+		{
+			RebuildLevel(i, minX, minZ, maxX, maxZ);
+			minX /= 2;
+			minZ /= 2;
+			maxX /= 2;
+			maxZ /= 2;
+		}
+	}
+
+	// Tests the two triangles of one cell, origin and direction are in grid space
+	bool TerrainRaycaster::IntersectCell(int cellX, int cellZ, const glm::vec3& origin, const glm::vec3& direction,
+		float maxT, float& t, glm::vec3& normal) const
+	{
+		const Heightfield& hf{ *m_heightfield };
+
+		// Same triangles as the index buffer built in Renderer::CreateTerrain
+		glm::ivec2 corners[2][3];
+		hf.GetCellTriangles(cellX, cellZ, corners);
+
+		glm::vec3 triangles[2][3];
+		for (int tri = 0; tri < 2; tri++)
+		{
+			for (int i = 0; i < 3; i++)
+				triangles[tri][i] = glm::vec3((float)corners[tri][i].x, hf.GetHeight(corners[tri][i].x, corners[tri][i].y), (float)corners[tri][i].y);
+		}
+
+		bool found{ false };
+		for (int i = 0; i < 2; i++)
+		{
+			float triT;
+			if (RayIntersectsTriangle(origin, direction, triangles[i][0], triangles[i][1], triangles[i][2], maxT, triT))
+			{
+				maxT = triT;
+				t = triT;
+				found = true;
+
+				// Back to world space to get the normal, z is flipped and x/z are scaled
+				glm::vec3 scale{ hf.CellSize(), 1.0f, -hf.CellSize() };
+				glm::vec3 worldEdge1{ (triangles[i][1] - triangles[i][0]) * scale };
+				glm::vec3 worldEdge2{ (triangles[i][2] - triangles[i][0]) * scale };
+				normal = glm::normalize(glm::cross(worldEdge1, worldEdge2));
+				if (normal.y < 0)
+					normal = -normal;
+			}
+		}
+
+		return found;
+	}
+
+	// Nearest hit along the ray, in world space. Returns false if nothing is hit.
+	bool TerrainRaycaster::Raycast(const TerrainRay& ray, TerrainHit& hit) const
+	{
+		hit = TerrainHit();
+		if (!m_heightfield)
+			return false;
+
+		const Heightfield& hf{ *m_heightfield };
+
+		// Work in grid space where each cell is 1x1 and z runs the same way as the grid rows
+		// The mapping is affine so distances along the ray (t) are unchanged
+		glm::vec2 gridOrigin{ hf.WorldToGrid(ray.origin.x, ray.origin.z) };
+		glm::vec3 origin{ gridOrigin.x, ray.origin.y, gridOrigin.y };
+		glm::vec3 direction{ ray.direction.x / hf.CellSize(), ray.direction.y, -ray.direction.z / hf.CellSize() };
+		glm::vec3 invDirection{ 1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z };
+
+		struct StackEntry
+		{
+			int level;
+			int x;
+			int z;
+			float tEnter;
+		};
+
+		// Each level pushes at most 4 children, 3 of which wait while the nearest is explored
+		StackEntry stack[KMaxLevels * 3 + 4];
+		int stackSize{ 0 };
+
+		auto nodeBounds = [this](int levelIndex, int x, int z, glm::vec3& boxMin, glm::vec3& boxMax)
+		{
+			const MinMax& node{ m_levels[levelIndex].At(x, z) };
+			boxMin = glm::vec3((float)(x << levelIndex), node.minHeight - KBoundsEpsilon, (float)(z << levelIndex));
+			boxMax = glm::vec3((float)std::min((x + 1) << levelIndex, m_levels[0].width), node.maxHeight + KBoundsEpsilon,
+				(float)std::min((z + 1) << levelIndex, m_levels[0].depth));
+		};
+
+		float bestT{ ray.maxDistance };
+		glm::vec3 bestNormal{ 0, 1, 0 };
+		bool found{ false };
+
+		int topLevel{ (int)m_levels.size() - 1 };
+		glm::vec3 boxMin, boxMax;
+		float tEnter;
+		nodeBounds(topLevel, 0, 0, boxMin, boxMax);
+		if (RayIntersectsBox(origin, invDirection, boxMin, boxMax, bestT, tEnter))
+			stack[stackSize++] = { topLevel, 0, 0, tEnter };
+
+		while (stackSize > 0)
+		{
+			StackEntry entry{ stack[--stackSize] };
+
+			// Something nearer has already been found
+			if (entry.tEnter > bestT)
+				continue;
+
+			if (entry.level == 0)
+			{
+				float t;
+				glm::vec3 normal;
+				if (IntersectCell(entry.x, entry.z, origin, direction, bestT, t, normal))
+				{
+					bestT = t;
+					bestNormal = normal;
+					found = true;
+				}
+				continue;
+			}
+
+			// Gather the children the ray passes through then push them furthest first
+			// so the nearest is explored next and can cut the others off early
+			StackEntry children[4];
+			int numChildren{ 0 };
+			const Level& below{ m_levels[entry.level - 1] };
+			for (int childZ = entry.z * 2; childZ < std::min(entry.z * 2 + 2, below.depth); childZ++)
+			{
+				for (int childX = entry.x * 2; childX < std::min(entry.x * 2 + 2, below.width); childX++)
+				{
+					nodeBounds(entry.level - 1, childX, childZ, boxMin, boxMax);
+					if (RayIntersectsBox(origin, invDirection, boxMin, boxMax, bestT, tEnter))
+						children[numChildren++] = { entry.level - 1, childX, childZ, tEnter };
+				}
+			}
+
+			std::sort(children, children + numChildren,
+				[](const StackEntry& a, const StackEntry& b) { return a.tEnter > b.tEnter; });
+
+			for (int i = 0; i < numChildren; i++)
+				stack[stackSize++] = children[i];
+		}
+
+		if (!found)
+			return false;
+
+		hit.hit = true;
+		hit.distance = bestT;
+		hit.position = ray.origin + ray.direction * bestT;
+		hit.normal = bestNormal;
+		return true;
+	}
+
+	// True if the terrain does not block the segment between the two points
+	bool TerrainRaycaster::HasLineOfSight(const glm::vec3& from, const glm::vec3& to) const
+	{
+		glm::vec3 delta{ to - from };
+		float length{ glm::length(delta) };
+		if (length < 1e-6f)
+			return true;
+
+		// Stop just short of the end so a target sat on the ground does not hide itself
+		TerrainRay ray;
+		ray.origin = from;
+		ray.direction = delta / length;
+		ray.maxDistance = length * 0.9999f;
+
+		TerrainHit hit;
+		return !Raycast(ray, hit);
+	}
+
+	// Many rays at once, spread across the thread pool
+	void TerrainRaycaster::RaycastBatch(const TerrainRay* rays, size_t count, TerrainHit* hits) const
+	{
+		ThreadPool::Get().ParallelFor(count, 64, [this, rays, hits](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; i++)
+				Raycast(rays[i], hits[i]);
+		});
+	}
+
+	// Many line of sight checks at once, spread across the thread pool
+	void TerrainRaycaster::LineOfSightBatch(const glm::vec3* from, const glm::vec3* to, size_t count, bool* visible) const
+	{
+		ThreadPool::Get().ParallelFor(count, 64, [this, from, to, visible](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; i++)
+				visible[i] = HasLineOfSight(from[i], to[i]);
+		});
+	}
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "ExternalLibraryHeaders.h"
+#include "Heightfield.h"
+
+#include <cfloat>
+
+namespace Helpers
+{
+	// A ray or, if maxDistance is finite, a segment. direction must be normalised.
+	struct TerrainRay
+	{
+		glm::vec3 origin{ 0 };
+		glm::vec3 direction{ 0, -1, 0 };
+		float maxDistance{ FLT_MAX };
+	};
+
+	// Result of a terrain ray query
+	struct TerrainHit
+	{
+		bool hit{ false };
+		float distance{ FLT_MAX };
+		glm::vec3 position{ 0 };
+		glm::vec3 normal{ 0, 1, 0 };
+	};
+
+	// Ray, segment and line of sight queries against a Heightfield
+	// A min/max height pyramid over the cells lets a ray skip whole blocks of cells it passes
+	// above or below, so only the handful of cells actually near the ray get triangle tests
+	class TerrainRaycaster
+	{
+	private:
+		struct MinMax
+		{
+			float minHeight;
+			float maxHeight;
+		};
+
+		struct Level
+		{
+			int width{ 0 };
+			int depth{ 0 };
+			std::vector<MinMax> nodes;
+
+			const MinMax& At(int x, int z) const { return nodes[(size_t)z * width + x]; }
+			MinMax& At(int x, int z) { return nodes[(size_t)z * width + x]; }
+		};
+
+		const Heightfield* m_heightfield{ nullptr };
+
+		// Level 0 holds one entry per cell, each level above halves the resolution down to a single node
+		std::vector<Level> m_levels;
+
+		void RebuildLevel(size_t level, int minX, int minZ, int maxX, int maxZ);
+		bool IntersectCell(int cellX, int cellZ, const glm::vec3& origin, const glm::vec3& direction, float maxT, float& t, glm::vec3& normal) const;
+	public:
+		// Builds the pyramid, the heightfield must outlive this
+		void Build(const Heightfield& heightfield);
+
+		// Refreshes the pyramid after heights in the given inclusive vertex range have changed
+		void UpdateRegion(int minVertX, int minVertZ, int maxVertX, int maxVertZ);
+
+		bool IsBuilt() const { return m_heightfield != nullptr; }
+
+		// Nearest hit along the ray, in world space. Returns false if nothing is hit.
+		bool Raycast(const TerrainRay& ray, TerrainHit& hit) const;
+
+		// True if the terrain does not block the segment between the two points
+		bool HasLineOfSight(const glm::vec3& from, const glm::vec3& to) const;
+
+		// Many rays at once, spread across the thread pool. hits must have room for count results.
+		void RaycastBatch(const TerrainRay* rays, size_t count, TerrainHit* hits) const;
+
+		// Many line of sight checks at once, spread across the thread pool
+		void LineOfSightBatch(const glm::vec3* from, const glm::vec3* to, size_t count, bool* visible) const;
+	};
+}
@@ -0,0 +1,130 @@
+#include "ThreadPool.h"
+
+#include <atomic>
+
+namespace Helpers
+{
+	// Passing 0 uses one worker per hardware thread, minus one for the calling thread
+	ThreadPool::ThreadPool(size_t numThreads)
+	{
+		if (numThreads == 0)
+		{
+			unsigned int hardwareThreads{ std::thread::hardware_concurrency() };
+			numThreads = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+		}
+
+		for (size_t i = 0; i < numThreads; i++)
+			m_workers.emplace_back(&ThreadPool::WorkerLoop, this);
+	}
+
+	// Lets any queued jobs finish and then joins the workers
+	ThreadPool::~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stopping = true;
+		}
+		m_jobAvailable.notify_all();
+
+		for (std::thread& worker : m_workers)
+			worker.join();
+	}
+
+	void ThreadPool::WorkerLoop()
+	{
+		for (;;)
+		{
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_jobAvailable.wait(lock, [this] { return m_stopping || !m_jobs.empty(); });
+
+				if (m_jobs.empty())
+					return;
+
+				job = std::move(m_jobs.front());
+				m_jobs.pop_front();
+			}
+			job();
+		}
+	}
+
+	// Queue a job to be run on a worker thread at some point, does not wait for it
+	void ThreadPool::Submit(std::function<void()> job)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_jobs.push_back(std::move(job));
+		}
+		m_jobAvailable.notify_one();
+	}
+
+	// Batches are claimed from a shared counter so the caller and the helpers simply keep taking
+	// the next one until they run out. This means it is safe to call from inside a worker job too
+	// as the caller never depends on a helper actually getting scheduled.
+	void ThreadPool::ParallelFor(size_t count, size_t minBatchSize, const std::function<void(size_t, size_t)>& func)
+	{
+		if (count == 0)
+			return;
+
+		if (minBatchSize == 0)
+			minBatchSize = 1;
+
+		// Aim for a few batches per thread so uneven work still balances out
+		size_t numBatches{ std::min((count + minBatchSize - 1) / minBatchSize, (NumThreads() + 1) * 4) };
+		if (numBatches <= 1 || NumThreads() == 0)
+		{
+			func(0, count);
+			return;
+		}
+
+		const size_t batchSize{ (count + numBatches - 1) / numBatches };
+		numBatches = (count + batchSize - 1) / batchSize;
+
+		struct SharedState
+		{
+			std::atomic<size_t> nextBatch{ 0 };
+			std::atomic<size_t> batchesDone{ 0 };
+			std::mutex mutex;
+			std::condition_variable finished;
+		};
+		std::shared_ptr<SharedState> state{ std::make_shared<SharedState>() };
+
+		// func is only used while the caller is blocked below so capturing it by pointer is fine
+		const std::function<void(size_t, size_t)>* funcPtr{ &func };
+		auto runBatches = [state, funcPtr, count, batchSize, numBatches]()
+		{
+			for (;;)
+			{
+				size_t batch{ state->nextBatch.fetch_add(1) };
+				if (batch >= numBatches)
+					return;
+
+				size_t begin{ batch * batchSize };
+				(*funcPtr)(begin, std::min(begin + batchSize, count));
+
+				if (state->batchesDone.fetch_add(1) + 1 == numBatches)
+				{
+					std::lock_guard<std::mutex> lock(state->mutex);
+					state->finished.notify_all();
+				}
+			}
+		};
+
+		size_t numHelpers{ std::min(NumThreads(), numBatches - 1) };
+		for (size_t i = 0; i < numHelpers; i++)
+			Submit(runBatches);
+
+		runBatches();
+
+		std::unique_lock<std::mutex> lock(state->mutex);
+		state->finished.wait(lock, [&state, numBatches] { return state->batchesDone.load() == numBatches; });
+	}
+
+	// Pool shared by the whole program, created on first use
+	ThreadPool& ThreadPool::Get()
+	{
+		static ThreadPool pool;
+		return pool;
+	}
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "ExternalLibraryHeaders.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+
+namespace Helpers
+{
+	// A fixed set of worker threads that CPU side jobs can be handed to
+	// Used for batched queries and anything else that wants to spread work across the cores
+	class ThreadPool
+	{
+	private:
+		std::vector<std::thread> m_workers;
+		std::deque<std::function<void()>> m_jobs;
+
+		std::mutex m_mutex;
+		std::condition_variable m_jobAvailable;
+		bool m_stopping{ false };
+
+		void WorkerLoop();
+	public:
+		// Passing 0 uses one worker per hardware thread, minus one for the calling thread
+		explicit ThreadPool(size_t numThreads = 0);
+		~ThreadPool();
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		// Number of worker threads (not counting the caller)
+		size_t NumThreads() const { return m_workers.size(); }
+
+		// Queue a job to be run on a worker thread at some point, does not wait for it
+		void Submit(std::function<void()> job);
+
+		// Splits [0, count) into batches of at least minBatchSize and calls func(begin, end) for each
+		// The calling thread takes part as well and this only returns once every batch is done
+		void ParallelFor(size_t count, size_t minBatchSize, const std::function<void(size_t, size_t)>& func);
+
+		// Pool shared by the whole program, created on first use
+		static ThreadPool& Get();
+	};
+}
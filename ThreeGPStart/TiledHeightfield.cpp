@@ -0,0 +1,441 @@
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "TiledHeightfield.h"
+#include "ImageLoader.h"
+
+#include <fstream>
+#include <cstring>
+
+namespace Helpers
+{
+	static const char KMagic[4]{ 'T', 'H', 'F', '1' };
+	// Version 1 files may be missing the coarser levels, they are converted again
+	static const uint32_t KVersion{ 2 };
+
+	// Tile data starts on a boundary that works as a mapping offset on every platform
+	static const uint64_t KTileDataAlignment{ 65536 };
+
+	// Platform handles for the open file
+	struct TiledHeightfield::MappedFile
+	{
+#ifdef _WIN32
+		HANDLE file{ INVALID_HANDLE_VALUE };
+		HANDLE mapping{ nullptr };
+#else
+		int fd{ -1 };
+#endif
+		// Mapping offsets must be a multiple of this
+		uint64_t granularity{ 65536 };
+
+		~MappedFile()
+		{
+#ifdef _WIN32
+			if (mapping)
+				CloseHandle(mapping);
+			if (file != INVALID_HANDLE_VALUE)
+				CloseHandle(file);
+#else
+			if (fd >= 0)
+				close(fd);
+#endif
+		}
+	};
+
+	// One mapped tile
+	class TiledHeightfield::TileView
+	{
+	private:
+		void* m_base{ nullptr };
+		size_t m_mappedBytes{ 0 };
+		const uint16_t* m_samples{ nullptr };
+	public:
+		TileView(const MappedFile& file, uint64_t offset, size_t bytes)
+		{
+			// Map from the granularity boundary below the tile and skip forward to it
+			uint64_t viewOffset{ offset - offset % file.granularity };
+			m_mappedBytes = (size_t)(offset - viewOffset) + bytes;
+#ifdef _WIN32
+			m_base = MapViewOfFile(file.mapping, FILE_MAP_READ, (DWORD)(viewOffset >> 32), (DWORD)(viewOffset & 0xffffffff), m_mappedBytes);
+#else
+			m_base = mmap(nullptr, m_mappedBytes, PROT_READ, MAP_SHARED, file.fd, (off_t)viewOffset);
+			if (m_base == MAP_FAILED)
+				m_base = nullptr;
+#endif
+			if (m_base)
+				m_samples = (const uint16_t*)((const char*)m_base + (offset - viewOffset));
+		}
+
+		~TileView()
+		{
+			if (!m_base)
+				return;
+#ifdef _WIN32
+			UnmapViewOfFile(m_base);
+#else
+			munmap(m_base, m_mappedBytes);
+#endif
+		}
+
+		TileView(const TileView&) = delete;
+		TileView& operator=(const TileView&) = delete;
+
+		const uint16_t* Samples() const { return m_samples; }
+	};
+
+	TiledHeightfield::TiledHeightfield() = default;
+
+	TiledHeightfield::~TiledHeightfield()
+	{
+		Close();
+	}
+
+	// Converts an image heightmap (red channel, as used by the heightmap terrain) to the tiled format
+	bool TiledHeightfield::ConvertFromImage(const std::string& imageFilename, const std::string& outputFilename,
+		float cellSize, float heightScale, int tileSize)
+	{
+		if (tileSize <= 0)
+			return false;
+
+		ImageLoader image;
+		if (!image.Load(imageFilename))
+			return false;
+
+		// Level 0 straight from the image, 8 bit red spread over the 16 bit range
+		std::vector<std::vector<uint16_t>> levelSamples(1);
+		std::vector<FileLevel> levels(1);
+		levels[0].width = (uint32_t)image.Width();
+		levels[0].depth = (uint32_t)image.Height();
+
+		const unsigned char* texels = (const unsigned char*)image.GetData();
+		levelSamples[0].resize((size_t)image.Width() * image.Height());
+		for (size_t i = 0; i < levelSamples[0].size(); i++)
+			levelSamples[0][i] = (uint16_t)(texels[i * 4] * 257);
+
+		// Each further level averages 2x2 samples of the one below until a single tile covers it
+		while (levels.back().width > (uint32_t)tileSize || levels.back().depth > (uint32_t)tileSize)
+		{
+			const FileLevel& below{ levels.back() };
+			const std::vector<uint16_t>& belowSamples{ levelSamples.back() };
+
+			FileLevel level{};
+			level.width = std::max(1u, (below.width + 1) / 2);
+			level.depth = std::max(1u, (below.depth + 1) / 2);
+
+			std::vector<uint16_t> samples((size_t)level.width * level.depth);
+			for (uint32_t z = 0; z < level.depth; z++)
+			{
+				for (uint32_t x = 0; x < level.width; x++)
+				{
+					uint32_t sum{ 0 };
+					for (uint32_t corner = 0; corner < 4; corner++)
+					{
+						uint32_t sx{ std::min(x * 2 + (corner & 1), below.width - 1) };
+						uint32_t sz{ std::min(z * 2 + (corner >> 1), below.depth - 1) };
+						sum += belowSamples[(size_t)sz * below.width + sx];
+					}
+					samples[(size_t)z * level.width + x] = (uint16_t)((sum + 2) / 4);
+				}
+			}
+
+			levels.push_back(level);
+			levelSamples.push_back(std::move(samples));
+		}
+
+		FileHeader header{};
+		std::memcpy(header.magic, KMagic, sizeof(KMagic));
+		header.version = KVersion;
+		header.width = levels[0].width;
+		header.depth = levels[0].depth;
+		header.tileSize = (uint32_t)tileSize;
+		header.numLevels = (uint32_t)levels.size();
+		header.cellSize = cellSize;
+		header.heightScale = heightScale;
+
+		const uint64_t tileBytes{ (uint64_t)tileSize * tileSize * sizeof(uint16_t) };
+		uint64_t offset{ sizeof(FileHeader) + sizeof(FileLevel) * levels.size() };
+		offset = (offset + KTileDataAlignment - 1) / KTileDataAlignment * KTileDataAlignment;
+		for (FileLevel& level : levels)
+		{
+			level.tilesX = (level.width + tileSize - 1) / tileSize;
+			level.tilesZ = (level.depth + tileSize - 1) / tileSize;
+			level.firstTileOffset = offset;
+			offset += tileBytes * level.tilesX * level.tilesZ;
+		}
+
+		std::ofstream out(outputFilename, std::ios::binary | std::ios::trunc);
+		if (!out)
+			return false;
+
+		out.write((const char*)&header, sizeof(header));
+		out.write((const char*)levels.data(), sizeof(FileLevel) * levels.size());
+
+		std::vector<char> padding((size_t)(levels[0].firstTileOffset - (uint64_t)out.tellp()), 0);
+		out.write(padding.data(), padding.size());
+
+		// Tiles on the right and bottom edges are padded by repeating the last sample
+		std::vector<uint16_t> tile((size_t)tileSize * tileSize);
+		for (size_t l = 0; l < levels.size(); l++)
+		{
+			const FileLevel& level{ levels[l] };
+			for (uint32_t tileZ = 0; tileZ < level.tilesZ; tileZ++)
+			{
+				for (uint32_t tileX = 0; tileX < level.tilesX; tileX++)
+				{
+					for (int z = 0; z < tileSize; z++)
+					{
+						uint32_t sz{ std::min(tileZ * tileSize + z, level.depth - 1) };
+						for (int x = 0; x < tileSize; x++)
+						{
+							uint32_t sx{ std::min(tileX * tileSize + x, level.width - 1) };
+							tile[(size_t)z * tileSize + x] = levelSamples[l][(size_t)sz * level.width + sx];
+						}
+					}
+					out.write((const char*)tile.data(), tileBytes);
+				}
+			}
+		}
+
+		return (bool)out;
+	}
+
+	// Opens a tiled heightfield, only the header is read
+	bool TiledHeightfield::Open(const std::string& filename)
+	{
+		Close();
+
+		std::ifstream in(filename, std::ios::binary);
+		if (!in)
+		{
+			std::cout << "Could not find: " << filename << std::endl;
+			return false;
+		}
+
+		FileHeader header{};
+		in.read((char*)&header, sizeof(header));
+		if (!in || std::memcmp(header.magic, KMagic, sizeof(KMagic)) != 0 || header.version != KVersion ||
+			header.numLevels == 0 || header.tileSize == 0)
+		{
+			std::cerr << "Not a tiled heightfield: " << filename << std::endl;
+			return false;
+		}
+
+		std::vector<FileLevel> levels(header.numLevels);
+		in.read((char*)levels.data(), sizeof(FileLevel) * levels.size());
+		if (!in)
+		{
+			std::cerr << "Tiled heightfield is truncated: " << filename << std::endl;
+			return false;
+		}
+		in.close();
+
+		std::unique_ptr<MappedFile> file{ std::make_unique<MappedFile>() };
+#ifdef _WIN32
+		SYSTEM_INFO systemInfo;
+		GetSystemInfo(&systemInfo);
+		file->granularity = systemInfo.dwAllocationGranularity;
+
+		file->file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+			FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+		if (file->file == INVALID_HANDLE_VALUE)
+			return false;
+
+		file->mapping = CreateFileMappingA(file->file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!file->mapping)
+			return false;
+#else
+		file->granularity = (uint64_t)sysconf(_SC_PAGESIZE);
+		file->fd = open(filename.c_str(), O_RDONLY);
+		if (file->fd < 0)
+			return false;
+#endif
+
+		m_header = header;
+		m_levels = std::move(levels);
+		m_file = std::move(file);
+
+		// Centred on the world origin like the other terrains, row 0 on the +z edge as in Heightfield
+		m_origin = glm::vec2(-(float)(m_header.width - 1) * m_header.cellSize / 2, (float)(m_header.depth - 1) * m_header.cellSize / 2);
+
+		return true;
+	}
+
+	void TiledHeightfield::Close()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		// Any tiles still held elsewhere stay mapped until released, closing the handles does not affect them
+		m_tiles.clear();
+		m_recentlyUsed.clear();
+		m_levels.clear();
+		m_file.reset();
+	}
+
+	size_t TiledHeightfield::NumResidentTiles() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_tiles.size();
+	}
+
+	// Unmaps the tile once nothing else holds it, m_mutex must be held
+	void TiledHeightfield::EvictTile(std::unordered_map<uint64_t, CachedTile>::iterator it) const
+	{
+		m_recentlyUsed.erase(it->second.recentlyUsed);
+		m_tiles.erase(it);
+	}
+
+	// Returns the mapped tile, mapping it first if needed
+	std::shared_ptr<const TiledHeightfield::TileView> TiledHeightfield::GetTile(int level, int tileX, int tileZ) const
+	{
+		const FileLevel& fileLevel{ m_levels[level] };
+		uint64_t key{ TileKey(level, tileX, tileZ) };
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		auto found{ m_tiles.find(key) };
+		if (found != m_tiles.end())
+		{
+			m_recentlyUsed.splice(m_recentlyUsed.begin(), m_recentlyUsed, found->second.recentlyUsed);
+			return found->second.view;
+		}
+
+		// The back of the list has gone longest without being used
+		while (!m_recentlyUsed.empty() && m_tiles.size() >= m_maxResidentTiles)
+			EvictTile(m_tiles.find(m_recentlyUsed.back()));
+
+		const uint64_t tileBytes{ (uint64_t)m_header.tileSize * m_header.tileSize * sizeof(uint16_t) };
+		uint64_t offset{ fileLevel.firstTileOffset + tileBytes * ((uint64_t)tileZ * fileLevel.tilesX + tileX) };
+
+		m_recentlyUsed.push_front(key);
+		CachedTile& cached{ m_tiles[key] };
+		cached.view = std::make_shared<TileView>(*m_file, offset, (size_t)tileBytes);
+		cached.recentlyUsed = m_recentlyUsed.begin();
+		return cached.view;
+	}
+
+	// Samples of the tile, looked up in the cache only if it is not one of those already held
+	const uint16_t* TiledHeightfield::Sampler::TileSamples(int level, int tileX, int tileZ)
+	{
+		uint64_t key{ TileKey(level, tileX, tileZ) };
+		for (const HeldTile& held : m_held)
+		{
+			if (held.key == key)
+				return held.view->Samples();
+		}
+
+		HeldTile& replaced{ m_held[m_nextReplaced] };
+		m_nextReplaced = (m_nextReplaced + 1) % 4;
+		replaced.view = m_heightfield.GetTile(level, tileX, tileZ);
+		replaced.key = key;
+		return replaced.view->Samples();
+	}
+
+	// Height of a sample, coordinates are clamped to the level
+	float TiledHeightfield::Sampler::GetHeight(int level, int x, int z)
+	{
+		const FileLevel& fileLevel{ m_heightfield.m_levels[level] };
+		x = glm::clamp(x, 0, (int)fileLevel.width - 1);
+		z = glm::clamp(z, 0, (int)fileLevel.depth - 1);
+
+		const int tileSize{ (int)m_heightfield.m_header.tileSize };
+		const uint16_t* samples{ TileSamples(level, x / tileSize, z / tileSize) };
+		if (!samples)
+			return 0.0f;
+
+		uint16_t value{ samples[(size_t)(z % tileSize) * tileSize + (x % tileSize)] };
+		return value * (m_heightfield.m_header.heightScale / 65535.0f);
+	}
+
+	// Bilinear height at a world x/z from a level, levels past the coarsest use the coarsest
+	float TiledHeightfield::Sampler::SampleHeight(float worldX, float worldZ, int level)
+	{
+		level = glm::clamp(level, 0, m_heightfield.NumLevels() - 1);
+
+		// Each sample of a level averages 2x2 of the one below, so its centre sits half a
+		// sample of that level in from the first of them
+		const float scale{ (float)(1 << level) };
+		const float centreOffset{ (scale - 1.0f) * 0.5f };
+		const float cellSize{ m_heightfield.m_header.cellSize };
+		float gridX{ ((worldX - m_heightfield.m_origin.x) / cellSize - centreOffset) / scale };
+		float gridZ{ ((m_heightfield.m_origin.y - worldZ) / cellSize - centreOffset) / scale };
+
+		float floorX{ std::floor(gridX) };
+		float floorZ{ std::floor(gridZ) };
+		int x0{ (int)floorX };
+		int z0{ (int)floorZ };
+		float fx{ gridX - floorX };
+		float fz{ gridZ - floorZ };
+
+		float h00{ GetHeight(level, x0, z0) };
+		float h10{ GetHeight(level, x0 + 1, z0) };
+		float h01{ GetHeight(level, x0, z0 + 1) };
+		float h11{ GetHeight(level, x0 + 1, z0 + 1) };
+
+		return glm::mix(glm::mix(h00, h10, fx), glm::mix(h01, h11, fx), fz);
+	}
+
+	// Height of a sample, coordinates are clamped to the level
+	float TiledHeightfield::GetHeight(int level, int x, int z) const
+	{
+		Sampler sampler(*this);
+		return sampler.GetHeight(level, x, z);
+	}
+
+	// Bilinear height at a world x/z
+	float TiledHeightfield::SampleHeight(float worldX, float worldZ, int level) const
+	{
+		Sampler sampler(*this);
+		return sampler.SampleHeight(worldX, worldZ, level);
+	}
+
+	// Bilinear heights of count points along +x, each tile is looked up once for the row
+	void TiledHeightfield::SampleRow(float worldX, float worldZ, float step, int count, int level, float* heights) const
+	{
+		Sampler sampler(*this);
+		for (int i = 0; i < count; i++)
+			heights[i] = sampler.SampleHeight(worldX + i * step, worldZ, level);
+	}
+
+	// Maps the level 0 tiles within radius of the position ahead of use and drops tiles outside it
+	void TiledHeightfield::UpdateResidency(const glm::vec3& position, float radius)
+	{
+		if (!IsOpen())
+			return;
+
+		const FileLevel& level{ m_levels[0] };
+		const float tileWorldSize{ m_header.tileSize * m_header.cellSize };
+
+		// Rows run toward -z from the origin
+		int minTileX{ std::max((int)std::floor((position.x - radius - m_origin.x) / tileWorldSize), 0) };
+		int maxTileX{ std::min((int)std::floor((position.x + radius - m_origin.x) / tileWorldSize), (int)level.tilesX - 1) };
+		int minTileZ{ std::max((int)std::floor((m_origin.y - position.z - radius) / tileWorldSize), 0) };
+		int maxTileZ{ std::min((int)std::floor((m_origin.y - position.z + radius) / tileWorldSize), (int)level.tilesZ - 1) };
+
+		// Drop level 0 tiles outside the area straight away rather than waiting for them to age out,
+		// coarser tiles cover far more ground and are left to the least recently used order
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			for (auto it = m_tiles.begin(); it != m_tiles.end() && m_tiles.size() > m_maxResidentTiles / 2;)
+			{
+				int tileLevel{ (int)(it->first >> 48) };
+				int tileZ{ (int)((it->first >> 24) & 0xffffff) };
+				int tileX{ (int)(it->first & 0xffffff) };
+				auto next{ std::next(it) };
+				if (tileLevel == 0 && (tileX < minTileX || tileX > maxTileX || tileZ < minTileZ || tileZ > maxTileZ))
+					EvictTile(it);
+				it = next;
+			}
+		}
+
+		for (int tileZ = minTileZ; tileZ <= maxTileZ; tileZ++)
+			for (int tileX = minTileX; tileX <= maxTileX; tileX++)
+				GetTile(0, tileX, tileZ);
+	}
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include "ExternalLibraryHeaders.h"
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace Helpers
+{
+	// Read only heightfield stored on disk as square tiles of 16 bit heights with a mip pyramid
+	// Opening only reads the small header. Tiles are memory mapped one at a time when first
+	// touched and unmapped again when the cache is full, so very large files can be used with a
+	// bounded amount of memory. Safe to sample from several threads at once.
+	//
+	// File layout (little endian):
+	//   FileHeader
+	//   FileLevel[numLevels]
+	//   padding to a 64KB boundary
+	//   tiles for level 0 row by row, then level 1 and so on, each tileSize * tileSize uint16_t
+	// Rows run toward -z from row 0 on the +z edge, the same way round as Heightfield.
+	class TiledHeightfield
+	{
+	public:
+		struct FileHeader
+		{
+			char magic[4];
+			uint32_t version;
+			uint32_t width;
+			uint32_t depth;
+			uint32_t tileSize;
+			uint32_t numLevels;
+			float cellSize;
+			// World height = stored value / 65535 * heightScale
+			float heightScale;
+		};
+
+		struct FileLevel
+		{
+			uint32_t width;
+			uint32_t depth;
+			uint32_t tilesX;
+			uint32_t tilesZ;
+			uint64_t firstTileOffset;
+		};
+	private:
+		// A mapped tile, unmapped when the last user lets go of it
+		class TileView;
+
+		struct CachedTile
+		{
+			std::shared_ptr<const TileView> view;
+
+			// Where the tile is in m_recentlyUsed
+			std::list<uint64_t>::iterator recentlyUsed;
+		};
+
+		// Platform file mapping handles, see the .cpp
+		struct MappedFile;
+		std::unique_ptr<MappedFile> m_file;
+
+		FileHeader m_header{};
+		std::vector<FileLevel> m_levels;
+		glm::vec2 m_origin{ 0 };
+
+		mutable std::mutex m_mutex;
+		mutable std::unordered_map<uint64_t, CachedTile> m_tiles;
+
+		// Keys of the mapped tiles, most recently used first
+		mutable std::list<uint64_t> m_recentlyUsed;
+		size_t m_maxResidentTiles{ 64 };
+
+		static uint64_t TileKey(int level, int tileX, int tileZ) { return ((uint64_t)level << 48) | ((uint64_t)tileZ << 24) | (uint64_t)tileX; }
+
+		std::shared_ptr<const TileView> GetTile(int level, int tileX, int tileZ) const;
+		void EvictTile(std::unordered_map<uint64_t, CachedTile>::iterator it) const;
+	public:
+		// Samples with the last few tiles it looked up held locally, so only moving onto a tile it does
+		// not hold takes the cache lock. For one thread sampling a row or chunk, not to be kept around
+		// as the tiles it holds stay mapped.
+		class Sampler
+		{
+		private:
+			struct HeldTile
+			{
+				uint64_t key{ UINT64_MAX };
+				std::shared_ptr<const TileView> view;
+			};
+
+			const TiledHeightfield& m_heightfield;
+			HeldTile m_held[4];
+			int m_nextReplaced{ 0 };
+
+			const uint16_t* TileSamples(int level, int tileX, int tileZ);
+		public:
+			explicit Sampler(const TiledHeightfield& heightfield) : m_heightfield(heightfield) {}
+
+			// Height of a sample, coordinates are clamped to the level
+			float GetHeight(int level, int x, int z);
+
+			// Bilinear height at a world x/z
+			float SampleHeight(float worldX, float worldZ, int level = 0);
+		};
+
+		TiledHeightfield();
+		~TiledHeightfield();
+
+		TiledHeightfield(const TiledHeightfield&) = delete;
+		TiledHeightfield& operator=(const TiledHeightfield&) = delete;
+
+		// Converts an image heightmap (red channel, as used by the heightmap terrain) to the tiled format
+		// heightScale is the world height of a full intensity texel. Returns false on error.
+		static bool ConvertFromImage(const std::string& imageFilename, const std::string& outputFilename,
+			float cellSize, float heightScale = 255.0f, int tileSize = 256);
+
+		// Opens a tiled heightfield, only the header is read. Returns false on error.
+		bool Open(const std::string& filename);
+		void Close();
+
+		bool IsOpen() const { return m_file != nullptr; }
+
+		int NumLevels() const { return (int)m_levels.size(); }
+		int Width(int level = 0) const { return (int)m_levels[level].width; }
+		int Depth(int level = 0) const { return (int)m_levels[level].depth; }
+		float CellSize() const { return m_header.cellSize; }
+
+		// Most tiles kept mapped at once, each is tileSize * tileSize * 2 bytes
+		void SetMaxResidentTiles(size_t maxTiles) { m_maxResidentTiles = std::max<size_t>(maxTiles, 4); }
+		size_t NumResidentTiles() const;
+
+		// Height of a sample, coordinates are clamped to the level
+		float GetHeight(int level, int x, int z) const;
+
+		// Bilinear height at a world x/z. The heightfield is centred on the origin.
+		// Each level is half the resolution of the one before, levels past the coarsest use the coarsest.
+		float SampleHeight(float worldX, float worldZ, int level = 0) const;
+
+		// Bilinear heights of count points from worldX, worldZ spaced step apart along +x
+		// Looks each tile up once for the row rather than once per sample.
+		void SampleRow(float worldX, float worldZ, float step, int count, int level, float* heights) const;
+
+		// Maps the level 0 tiles within radius of the position ahead of use and drops level 0 tiles
+		// outside it once the cache is half full. Called as the camera moves.
+		void UpdateResidency(const glm::vec3& position, float radius);
+	};
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+
+namespace Helpers
+{
+	// Hands the latest value from one writer thread to one reader thread without either waiting
+	// The writer fills Back and publishes it, the reader takes whatever was published most recently
+	// and reads Front until it takes another. Three slots means each side always owns one and the
+	// third holds the latest published value, exchanged atomically. Values the reader was too slow
+	// to take are overwritten, which is what is wanted for frames.
+	template <typename T>
+	class TripleBuffer
+	{
+	private:
+		T m_slots[3];
+
+		// Slot holding the latest published value, with KFresh set until the reader takes it
+		std::atomic<unsigned> m_middle{ 1 };
+
+		// Only ever touched by their own thread
+		unsigned m_back{ 0 };
+		unsigned m_front{ 2 };
+
+		enum : unsigned { KSlotMask = 3, KFresh = 4 };
+	public:
+		// Writer thread only, the slot to fill before calling Publish
+		T& Back() { return m_slots[m_back]; }
+
+		// Writer thread only, makes Back the latest value and gives the writer a new slot
+		// The new Back holds an older value, so reset whatever must not carry over
+		// Returns false if the value this replaced was never taken by the reader, the new Back is
+		// then that value, dropped unseen.
+		bool Publish()
+		{
+			unsigned previous{ m_middle.exchange(m_back | KFresh, std::memory_order_acq_rel) };
+			m_back = previous & KSlotMask;
+			return !(previous & KFresh);
+		}
+
+		// Reader thread only, moves to the latest published value if there is one newer than Front
+		bool Acquire()
+		{
+			if (!(m_middle.load(std::memory_order_relaxed) & KFresh))
+				return false;
+
+			unsigned previous{ m_middle.exchange(m_front, std::memory_order_acq_rel) };
+			m_front = previous & KSlotMask;
+			return true;
+		}
+
+		// Reader thread only, unchanged until the next Acquire
+		const T& Front() const { return m_slots[m_front]; }
+	};
+}
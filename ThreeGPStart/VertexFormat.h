@@ -0,0 +1,145 @@
+#pragma once
+
+#include "ExternalLibraryHeaders.h"
+
+#include <glm/packing.hpp>
+#include <glm/gtc/packing.hpp>
+#include <cstring>
+#include <tuple>
+#include <utility>
+
+namespace Helpers
+{
+	// Attribute descriptions for VertexFormat. Each one gives the type it is written from, how it is
+	// stored and how to pack a value. The shader always sees floats whatever the storage.
+
+	// Full precision position
+	struct Position3f
+	{
+		using Source = glm::vec3;
+		static constexpr GLint KComponents{ 3 };
+		static constexpr GLenum KType{ GL_FLOAT };
+		static constexpr GLboolean KNormalised{ GL_FALSE };
+		static constexpr size_t KSize{ sizeof(glm::vec3) };
+
+		static void Pack(const Source& value, GLubyte* dest) { std::memcpy(dest, &value, sizeof(value)); }
+	};
+
+	// Full precision normal
+	struct Normal3f
+	{
+		using Source = glm::vec3;
+		static constexpr GLint KComponents{ 3 };
+		static constexpr GLenum KType{ GL_FLOAT };
+		static constexpr GLboolean KNormalised{ GL_FALSE };
+		static constexpr size_t KSize{ sizeof(glm::vec3) };
+
+		static void Pack(const Source& value, GLubyte* dest) { std::memcpy(dest, &value, sizeof(value)); }
+	};
+
+	// Unit normal in 4 bytes as signed normalised 10:10:10, unpacked by the vertex fetch so
+	// shaders taking a vec3 normal work unchanged
+	struct NormalPacked10
+	{
+		using Source = glm::vec3;
+		static constexpr GLint KComponents{ 4 };
+		static constexpr GLenum KType{ GL_INT_2_10_10_10_REV };
+		static constexpr GLboolean KNormalised{ GL_TRUE };
+		static constexpr size_t KSize{ sizeof(glm::uint32) };
+
+		static void Pack(const Source& value, GLubyte* dest)
+		{
+			glm::uint32 packed{ glm::packSnorm3x10_1x2(glm::vec4(value, 0.0f)) };
+			std::memcpy(dest, &packed, sizeof(packed));
+		}
+	};
+
+	// Full precision texture coordinate, for uvs that repeat a long way
+	struct Uv2f
+	{
+		using Source = glm::vec2;
+		static constexpr GLint KComponents{ 2 };
+		static constexpr GLenum KType{ GL_FLOAT };
+		static constexpr GLboolean KNormalised{ GL_FALSE };
+		static constexpr size_t KSize{ sizeof(glm::vec2) };
+
+		static void Pack(const Source& value, GLubyte* dest) { std::memcpy(dest, &value, sizeof(value)); }
+	};
+
+	// Half float texture coordinate, plenty for uvs in a 0-1 sort of range
+	struct UvHalf2
+	{
+		using Source = glm::vec2;
+		static constexpr GLint KComponents{ 2 };
+		static constexpr GLenum KType{ GL_HALF_FLOAT };
+		static constexpr GLboolean KNormalised{ GL_FALSE };
+		static constexpr size_t KSize{ sizeof(glm::uint) };
+
+		static void Pack(const Source& value, GLubyte* dest)
+		{
+			glm::uint packed{ glm::packHalf2x16(value) };
+			std::memcpy(dest, &packed, sizeof(packed));
+		}
+	};
+
+	// Interleaved vertex layout built from a list of attributes, e.g. VertexFormat<Position3f, NormalPacked10, UvHalf2>
+	// Attribute i goes to shader location i. Strides and offsets are worked out at compile time.
+	template <typename... Attributes>
+	class VertexFormat
+	{
+	private:
+		template <size_t I>
+		using Attribute = typename std::tuple_element<I, std::tuple<Attributes...>>::type;
+
+		template <size_t I>
+		static void SetupAttribute()
+		{
+			glEnableVertexAttribArray(I);
+			glVertexAttribPointer(I, Attribute<I>::KComponents, Attribute<I>::KType, Attribute<I>::KNormalised,
+				(GLsizei)Stride(), (void*)Offset(I));
+		}
+
+		template <size_t... I>
+		static void SetupAttributes(std::index_sequence<I...>)
+		{
+			// One call per attribute
+			int expand[]{ 0, (SetupAttribute<I>(), 0)... };
+			(void)expand;
+		}
+
+		template <size_t... I>
+		static void WriteAt(GLubyte* dest, std::index_sequence<I...>, const typename Attributes::Source&... values)
+		{
+			int expand[]{ 0, (Attributes::Pack(values, dest + Offset(I)), 0)... };
+			(void)expand;
+		}
+	public:
+		// Byte offset of attribute index within a vertex
+		static constexpr size_t Offset(size_t index)
+		{
+			const size_t sizes[]{ Attributes::KSize..., 0 };
+			size_t offset{ 0 };
+			for (size_t i = 0; i < index; i++)
+				offset += sizes[i];
+			return offset;
+		}
+
+		// Bytes per vertex
+		static constexpr size_t Stride() { return Offset(sizeof...(Attributes)); }
+
+		static constexpr size_t NumAttributes() { return sizeof...(Attributes); }
+
+		// Describes the layout to the bound VAO, reading from the buffer bound to GL_ARRAY_BUFFER
+		static void SetupAttributes()
+		{
+			static_assert(Stride() % 4 == 0, "Vertex stride should be a multiple of 4 bytes");
+			SetupAttributes(std::index_sequence_for<Attributes...>());
+		}
+
+		// Packs vertex number index into an array of vertices, the values are given in attribute order
+		static void Write(void* vertices, size_t index, const typename Attributes::Source&... values)
+		{
+			WriteAt((GLubyte*)vertices + index * Stride(), std::index_sequence_for<Attributes...>(), values...);
+		}
+	};
+}
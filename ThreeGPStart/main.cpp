@@ -22,6 +22,10 @@
 #include "Helper.h"
 #include "Simulation.h"
 
+// Set to draw on a separate thread so the next simulation steps overlap drawing the last,
+// otherwise input, simulation and drawing take turns on this thread
+static const bool KUseRenderThread = false;
+
 int main()
 {
 	// Use the helper function to set up GLFW, GLEW and OpenGL
@@ -29,26 +33,51 @@ int main()
 	if (!window)
 		return -1;
 
-	// Create an instance of the simulation class and initialise it
-	// If it could not load, exit gracefully
-	Simulation simulation;	
-	if (!simulation.Initialise())
+	// Create an instance of the simulation class
+	Simulation simulation;
+
+	glfwSetInputMode(window, GLFW_STICKY_KEYS, GLFW_TRUE);
+
+	// The viewport and projection are only recalculated when the window is resized rather than queried every frame
+	glfwSetWindowUserPointer(window, &simulation);
+	glfwSetFramebufferSizeCallback(window, [](GLFWwindow* resizedWindow, int width, int height)
 	{
-		glfwTerminate();
-		return -1;
+		static_cast<Simulation*>(glfwGetWindowUserPointer(resizedWindow))->OnFramebufferResize(width, height);
+	});
+
+	int framebufferWidth, framebufferHeight;
+	glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+	simulation.OnFramebufferResize(framebufferWidth, framebufferHeight);
+
+	if (KUseRenderThread)
+	{
+		// Input and simulation stay here, drawing moves to its own thread with the GL context
+		// If it could not load, exit gracefully
+		if (!simulation.RunWithRenderThread(window))
+		{
+			glfwTerminate();
+			return -1;
+		}
 	}
+	else
+	{
+		// If it could not load, exit gracefully
+		if (!simulation.Initialise())
+		{
+			glfwTerminate();
+			return -1;
+		}
 
-	glfwSetInputMode(window, GLFW_STICKY_KEYS, GLFW_TRUE);
+		// Enter main GLFW loop until the user closes the window
+		while (!glfwWindowShouldClose(window))
+		{
+			if (!simulation.Update(window))
+				break;
 
-	// Enter main GLFW loop until the user closes the window
-	while (!glfwWindowShouldClose(window))
-	{				
-		if (!simulation.Update(window))
-			break;
-		
-		// GLFW updating
-		glfwSwapBuffers(window);
-		glfwPollEvents();
+			// GLFW updating
+			glfwSwapBuffers(window);
+			glfwPollEvents();
+		}
 	}
 
 	// Clean up and exit